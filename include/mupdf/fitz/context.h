@@ -22,6 +22,7 @@ typedef struct fz_locks_context_s fz_locks_context;
 typedef struct fz_tuning_context_s fz_tuning_context;
 typedef struct fz_store_s fz_store;
 typedef struct fz_glyph_cache_s fz_glyph_cache;
+typedef struct fz_pixmap_pool_s fz_pixmap_pool;
 typedef struct fz_document_handler_context_s fz_document_handler_context;
 typedef struct fz_output_context_s fz_output_context;
 typedef struct fz_context_s fz_context;
@@ -122,6 +123,7 @@ struct fz_context_s
 	fz_style_context *style;
 	fz_store *store;
 	fz_glyph_cache *glyph_cache;
+	fz_pixmap_pool *pixmap_pool;
 	fz_tuning_context *tuning;
 	fz_document_handler_context *handler;
 	fz_output_context *output;
@@ -277,9 +279,65 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/*
+	fz_tune_run_jobs_fn: Run a batch of independent jobs, possibly
+	in parallel on several worker threads, and return once every
+	one of them has completed.
+
+	MuPDF never creates threads of its own; callers that want
+	some internal operations (such as EPUB layout) spread across
+	cores supply this function to do so.
+
+	arg: The caller supplied opaque argument.
+
+	n: The number of jobs in the batch.
+
+	job: Function to call exactly once for each job index from
+	0 to n-1, passing job_arg and the index. It never throws and
+	may be called from any thread.
+
+	job_arg: Opaque argument to be passed to job.
+*/
+typedef void (fz_tune_run_jobs_fn)(void *arg, int n, void (*job)(void *job_arg, int i), void *job_arg);
+
+/*
+	fz_tune_run_jobs: Set the function to use for running batches
+	of independent jobs. Jobs are only handed to this function if
+	the context was created with locking functions.
+
+	run_jobs: Function to use, or NULL to run jobs one after
+	another on the calling thread.
+
+	arg: Opaque argument to be passed to run_jobs.
+*/
+void fz_tune_run_jobs(fz_context *ctx, fz_tune_run_jobs_fn *run_jobs, void *arg);
+
+/*
+	fz_job_fn: A single job for fz_run_jobs.
+
+	ctx: The context to use for the job. When jobs are run in
+	parallel, this is a clone of the context passed to fz_run_jobs.
+
+	arg: The opaque argument passed to fz_run_jobs.
+
+	i: The index of the job, from 0 to n-1.
+*/
+typedef void (fz_job_fn)(fz_context *ctx, void *arg, int i);
+
+/*
+	fz_run_jobs: Run n independent jobs, using the function set
+	with fz_tune_run_jobs if there is one. Jobs must not depend on
+	each other's results or order of execution.
+
+	Once all jobs have finished, the error from the lowest
+	numbered job that threw (if any) is rethrown.
+*/
+void fz_run_jobs(fz_context *ctx, int n, fz_job_fn *job, void *arg);
+
 /*
 	fz_aa_level: Get the number of bits of antialiasing we are
-	using (for graphics). Between 0 and 8.
+	using (for graphics). Between 0 and 8, or 9 for analytic
+	coverage.
 */
 int fz_aa_level(fz_context *ctx);
 
@@ -288,7 +346,10 @@ int fz_aa_level(fz_context *ctx);
 	use (for both text and graphics).
 
 	bits: The number of bits of antialiasing to use (values are clamped
-	to within the 0 to 8 range).
+	to within the 0 to 8 range). 9 (or more) draws graphics with
+	analytic coverage: the exact area of each pixel covered is used
+	rather than a count of sub-samples. This is both more accurate and
+	faster than 8 bits. Text uses 8 bits.
 */
 void fz_set_aa_level(fz_context *ctx, int bits);
 
@@ -309,7 +370,7 @@ void fz_set_text_aa_level(fz_context *ctx, int bits);
 
 /*
 	fz_graphics_aa_level: Get the number of bits of antialiasing we are
-	using for graphics. Between 0 and 8.
+	using for graphics. Between 0 and 8, or 9 for analytic coverage.
 */
 int fz_graphics_aa_level(fz_context *ctx);
 
@@ -318,7 +379,8 @@ int fz_graphics_aa_level(fz_context *ctx);
 	should use for graphics.
 
 	bits: The number of bits of antialiasing to use (values are clamped
-	to within the 0 to 8 range).
+	to within the 0 to 8 range). 9 (or more) selects analytic coverage,
+	as for fz_set_aa_level.
 */
 void fz_set_graphics_aa_level(fz_context *ctx, int bits);
 
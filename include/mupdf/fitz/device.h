@@ -195,6 +195,12 @@ enum
 	FZ_DONT_INTERPOLATE_IMAGES = 4,
 	FZ_MAINTAIN_CONTAINER_STACK = 8,
 	FZ_NO_CACHE = 16,
+
+	/* Draw reusable pieces of content (such as PDF Form XObjects) as
+	 * cached tiles, so that repeats of them (the same piece at the
+	 * same scale, rotation and color) are copied rather than drawn
+	 * again. Off by default, as the tiles cost store memory. */
+	FZ_CACHE_FORMS = 32,
 };
 
 /*
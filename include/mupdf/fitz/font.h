@@ -393,6 +393,22 @@ fz_font *fz_new_font_from_memory(fz_context *ctx, const char *name, const char *
 */
 fz_font *fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, int index, int use_glyph_bbox);
 
+/*
+	fz_new_shared_font_from_buffer: As fz_new_font_from_buffer,
+	but fonts are kept in the store keyed by a digest of the font
+	file, so that loading an identical font file again (with the
+	same name, index and use_glyph_bbox), even for another
+	document, returns the font already loaded. This saves parsing
+	the font again, and lets the glyph cache be shared too.
+
+	The returned font may be in use elsewhere, so the caller must
+	not change it.
+
+	Returns a new reference to the font, or throws exception on
+	error.
+*/
+fz_font *fz_new_shared_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, int index, int use_glyph_bbox);
+
 /*
 	fz_new_font_from_file: Create a new font from a font
 	file.
@@ -123,6 +123,18 @@ fz_pixmap *fz_load_gif(fz_context *ctx, unsigned char *data, size_t size);
 fz_pixmap *fz_load_bmp(fz_context *ctx, unsigned char *data, size_t size);
 fz_pixmap *fz_load_pnm(fz_context *ctx, unsigned char *data, size_t size);
 
+/*
+	fz_load_jpx_subarea: Decode part of a JPX image, possibly at a
+	reduced resolution.
+
+	subarea: The area of the image wanted, in full resolution pixels,
+	or NULL for all of it. Updated to the area actually decoded.
+
+	l2factor: On entry, the log2 of the subsampling wanted (or NULL).
+	Updated to the subsampling that is still left for the caller to do.
+*/
+fz_pixmap *fz_load_jpx_subarea(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace *cs, int indexed, fz_irect *subarea, int *l2factor);
+
 void fz_load_jpeg_info(fz_context *ctx, unsigned char *data, size_t size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_jpx_info(fz_context *ctx, unsigned char *data, size_t size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_png_info(fz_context *ctx, unsigned char *data, size_t size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
@@ -135,6 +147,25 @@ void fz_load_pnm_info(fz_context *ctx, unsigned char *data, size_t size, int *w,
 int fz_load_tiff_subimage_count(fz_context *ctx, unsigned char *buf, size_t len);
 fz_pixmap *fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subimage);
 
+/*
+	fz_index_tiff_subimages: Walk the chain of directories in a TIFF
+	file, reading nothing else. Returns the number of subimages.
+
+	offsets: If non-NULL, updated to point to a newly allocated array
+	of the directory offsets, for use with
+	fz_new_image_from_tiff_subimage. The caller must free it.
+*/
+int fz_index_tiff_subimages(fz_context *ctx, fz_stream *file, unsigned **offsets);
+
+/*
+	fz_new_image_from_tiff_subimage: Create an image from the TIFF
+	subimage whose directory is at the given offset in the file.
+
+	Only the strips or tiles of that subimage are read from the file,
+	and decoding only touches the ones that cover the area drawn.
+*/
+fz_image *fz_new_image_from_tiff_subimage(fz_context *ctx, fz_stream *file, unsigned ifd_offset);
+
 void fz_image_resolution(fz_image *image, int *xres, int *yres);
 
 fz_pixmap *fz_compressed_image_tile(fz_context *ctx, fz_compressed_image *cimg);
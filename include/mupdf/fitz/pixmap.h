@@ -307,7 +307,8 @@ void fz_convert_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src);
 
 	free_samples: Is zero when an application has provided its own
 	buffer for pixel data through fz_new_pixmap_with_bbox_and_data.
-	If non-zero the buffer will be freed along with the the pixmap.
+	If non-zero the buffer will be freed along with the the pixmap,
+	or given back to the pixmap pool if it is 2.
 */
 struct fz_pixmap_s
 {
@@ -344,12 +345,67 @@ fz_irect *fz_pixmap_bbox_no_ctx(const fz_pixmap *src, fz_irect *bbox);
 void fz_decode_tile(fz_context *ctx, fz_pixmap *pix, const float *decode);
 void fz_decode_indexed_tile(fz_context *ctx, fz_pixmap *pix, const float *decode, int maxval);
 void fz_unpack_tile(fz_context *ctx, fz_pixmap *dst, unsigned char * restrict src, int n, int depth, size_t stride, int scale);
+void fz_unpack_mono_tile_subsampled(fz_context *ctx, fz_pixmap *dst, unsigned char * restrict src, int w, int h, size_t stride, int factor);
 
 /*
 	fz_md5_pixmap: Return the md5 digest for a pixmap
 */
 void fz_md5_pixmap(fz_context *ctx, fz_pixmap *pixmap, unsigned char digest[16]);
 
+/*
+	Pixmap pool: Pixel buffers of 64k and up are recycled through a
+	pool shared by a context and its clones, so that rendering many
+	pages or bands does not go back to malloc for buffers of the same
+	few sizes over and over again. Buffers from the pool are aligned
+	to 64 bytes. The pool gives its buffers back when an allocation
+	would otherwise fail, before anything is evicted from the store.
+*/
+enum {
+	FZ_PIXMAP_POOL_DEFAULT = 64 << 20,
+};
+
+typedef struct fz_pixmap_pool_stats_s fz_pixmap_pool_stats;
+
+/*
+	fz_pixmap_pool_stats: Counters for the pixmap pool.
+
+	max: The most bytes the pool will keep.
+
+	size, count: The bytes and number of buffers it keeps now.
+
+	hits, misses: How many buffers have been taken from the pool,
+	and how many had to be allocated because it had none of the
+	right size.
+
+	discards: How many buffers have been freed to keep the pool
+	within max (rather than by fz_empty_pixmap_pool or the
+	scavenger).
+*/
+struct fz_pixmap_pool_stats_s
+{
+	size_t max, size;
+	int count;
+	int hits, misses, discards;
+};
+
+/*
+	fz_set_pixmap_pool_max: Set the most bytes of unused pixel
+	buffers that the pixmap pool will keep, freeing the ones that
+	have been unused longest if it is already over. Defaults to
+	FZ_PIXMAP_POOL_DEFAULT. 0 turns the pool off.
+*/
+void fz_set_pixmap_pool_max(fz_context *ctx, size_t max);
+
+/*
+	fz_empty_pixmap_pool: Free every buffer held by the pixmap pool.
+*/
+void fz_empty_pixmap_pool(fz_context *ctx);
+
+/*
+	fz_get_pixmap_pool_stats: Read the counters of the pixmap pool.
+*/
+void fz_get_pixmap_pool_stats(fz_context *ctx, fz_pixmap_pool_stats *stats);
+
 fz_pixmap *fz_new_pixmap_from_8bpp_data(fz_context *ctx, int x, int y, int w, int h, unsigned char *sp, int span);
 fz_pixmap *fz_new_pixmap_from_1bpp_data(fz_context *ctx, int x, int y, int w, int h, unsigned char *sp, int span);
 
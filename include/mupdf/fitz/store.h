@@ -131,6 +131,15 @@ typedef struct fz_store_hash_s
 			int id;
 			float m[4];
 		} im;
+		struct
+		{
+			const void *ptr;
+			unsigned char digest[16];
+		} pd;
+		struct
+		{
+			const void *ptr[2];
+		} pp;
 	} u;
 } fz_store_hash;
 
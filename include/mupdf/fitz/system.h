@@ -53,6 +53,31 @@
 #endif
 #endif
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#ifndef ARCH_X86
+#define ARCH_X86
+#endif
+#endif
+
+/*
+	On x86, code using instruction set extensions beyond the baseline
+	is compiled with per-function target attributes and selected at
+	runtime, so the same binary still runs on older processors.
+*/
+
+#if defined(ARCH_X86) && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define ARCH_X86_DISPATCH
+#endif
+
+/*
+	SSE2 is part of the x86-64 baseline, so code using it needs no
+	runtime check there (or on x86 builds that enable it).
+*/
+
+#if defined(ARCH_X86) && (defined(__SSE2__) || defined(_M_X64))
+#define ARCH_X86_SSE2
+#endif
+
 /*
 	Some differences in libc can be smoothed over
 */
@@ -10,6 +10,9 @@ typedef struct fz_html_box_s fz_html_box;
 typedef struct fz_html_flow_s fz_html_flow;
 
 typedef struct fz_css_s fz_css;
+typedef struct fz_css_import_s fz_css_import;
+typedef struct fz_css_index_s fz_css_index;
+typedef struct fz_css_cache_s fz_css_cache;
 typedef struct fz_css_rule_s fz_css_rule;
 typedef struct fz_css_match_prop_s fz_css_match_prop;
 typedef struct fz_css_match_s fz_css_match;
@@ -51,8 +54,17 @@ enum
 
 struct fz_css_s
 {
+	int refs;
 	fz_pool *pool;
 	fz_css_rule *rule;
+	fz_css_import *import; /* shared style sheets whose rules are linked into this one */
+	fz_css_index *index; /* rule lookup by tag, class and id; built on demand */
+};
+
+struct fz_css_import_s
+{
+	fz_css *css;
+	fz_css_import *next;
 };
 
 struct fz_css_rule_s
@@ -252,10 +264,17 @@ struct fz_html_flow_s
 };
 
 fz_css *fz_new_css(fz_context *ctx);
+fz_css *fz_keep_css(fz_context *ctx, fz_css *css);
 void fz_parse_css(fz_context *ctx, fz_css *css, const char *source, const char *file);
+void fz_add_css(fz_context *ctx, fz_css *css, fz_css *sheet);
 fz_css_property *fz_parse_css_properties(fz_context *ctx, fz_pool *pool, const char *source);
 void fz_drop_css(fz_context *ctx, fz_css *css);
 
+fz_css_cache *fz_new_css_cache(fz_context *ctx);
+fz_css *fz_find_cached_css(fz_context *ctx, fz_css_cache *cache, const char *name);
+void fz_cache_css(fz_context *ctx, fz_css_cache *cache, const char *name, fz_css *css);
+void fz_drop_css_cache(fz_context *ctx, fz_css_cache *cache);
+
 void fz_match_css(fz_context *ctx, fz_css_match *match, fz_css *css, fz_xml *node);
 void fz_match_css_at_page(fz_context *ctx, fz_css_match *match, fz_css *css);
 
@@ -274,7 +293,7 @@ void fz_drop_html_font_set(fz_context *ctx, fz_html_font_set *htx);
 
 void fz_add_css_font_faces(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const char *base_uri, fz_css *css);
 
-fz_html *fz_parse_html(fz_context *ctx, fz_html_font_set *htx, fz_archive *zip, const char *base_uri, fz_buffer *buf, const char *user_css);
+fz_html *fz_parse_html(fz_context *ctx, fz_html_font_set *htx, fz_css_cache *cache, fz_archive *zip, const char *base_uri, fz_buffer *buf, const char *user_css);
 void fz_layout_html(fz_context *ctx, fz_html *html, float w, float h, float em);
 void fz_draw_html(fz_context *ctx, fz_device *dev, const fz_matrix *ctm, fz_html *html, float page_top, float page_bot);
 
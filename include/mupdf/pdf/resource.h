@@ -58,6 +58,7 @@ struct pdf_pattern_s
 	pdf_document *document;
 	pdf_obj *resources;
 	pdf_obj *contents;
+	int id; /* unique id for caching rendered tiles */
 };
 
 pdf_pattern *pdf_load_pattern(fz_context *ctx, pdf_document *doc, pdf_obj *obj);
@@ -70,11 +71,27 @@ void pdf_drop_pattern(fz_context *ctx, pdf_pattern *pat);
 
 typedef struct pdf_xobject_s pdf_xobject;
 
+enum { PDF_XOBJECT_TILE_IDS = 4 };
+
 struct pdf_xobject_s
 {
 	fz_storable storable;
 	pdf_obj *obj;
 	int iteration;
+
+	/* Ids for caching the rendered form, one for each set of inherited
+	 * graphics state it has been drawn with. The colorspaces and font
+	 * in that state are kept, so that their addresses stay unique. */
+	int cacheable; /* 0 = not yet checked, 1 = yes, -1 = no */
+	int tile_iteration;
+	int tile_count;
+	struct
+	{
+		unsigned char digest[16];
+		int id;
+		fz_colorspace *fill_cs, *stroke_cs;
+		struct pdf_font_desc_s *font;
+	} tile[PDF_XOBJECT_TILE_IDS];
 };
 
 pdf_xobject *pdf_load_xobject(fz_context *ctx, pdf_document *doc, pdf_obj *obj);
@@ -0,0 +1,282 @@
+/* affinetest.c -- check the SIMD affine image painters against the C ones */
+
+/*
+	Paints random images with random transforms through both the SIMD
+	painters in draw-affine.c and the C painters they replace, and
+	checks that the results are identical. With -t it times the two
+	painting a large rotated image instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../source/fitz/draw-affine.c"
+
+#ifdef HAVE_SSE41_AFFINE
+
+static unsigned int seed = 1;
+
+static int
+rnd(int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (int)((seed >> 8) % (unsigned int)n);
+}
+
+typedef struct
+{
+	int lerp, n, sn, sa, da, alpha;
+} config;
+
+static paintfn_t *
+c_painter(const config *c, int fa, int fb)
+{
+#if FZ_PLOTTERS_RGB
+	if (c->n == 3 && c->sn == 1)
+		return c->lerp ?
+			fz_paint_affine_g2rgb_lerp(c->da, c->sa, fa, fb, c->n, c->alpha) :
+			fz_paint_affine_g2rgb_near(c->da, c->sa, fa, fb, c->n, c->alpha);
+#endif
+	return c->lerp ?
+		fz_paint_affine_lerp(c->da, c->sa, fa, fb, c->n, c->alpha) :
+		fz_paint_affine_near(c->da, c->sa, fa, fb, c->n, c->alpha);
+}
+
+static const char *
+describe(const config *c)
+{
+	static char buf[100];
+	sprintf(buf, "%s %s%s%s%s alpha=%d", c->lerp ? "lerp" : "near",
+		c->sn == c->n ? "" : "g2rgb ",
+		c->n == 1 ? "gray" : c->n == 3 ? "rgb" : "cmyk",
+		c->sa ? " sa" : "", c->da ? " da" : "", c->alpha);
+	return buf;
+}
+
+/* Set up the spans for drawing an sw x sh image through ctm to a w x h
+ * destination at the origin, the same way fz_paint_image_imp does. */
+static void
+setup(const config *c, fz_matrix ctm, int sw, int sh, int *u, int *v, int *fa, int *fb, int *fc, int *fd)
+{
+	fz_pre_scale(&ctm, 1.0f / sw, 1.0f / sh);
+	fz_invert_matrix(&ctm, &ctm);
+	*fa = (int)(ctm.a * 65536.0f);
+	*fb = (int)(ctm.b * 65536.0f);
+	*fc = (int)(ctm.c * 65536.0f);
+	*fd = (int)(ctm.d * 65536.0f);
+	*u = (int)(ctm.e * 65536.0f + (ctm.a + ctm.c) * 32768.0f);
+	*v = (int)(ctm.f * 65536.0f + (ctm.b + ctm.d) * 32768.0f);
+	if (c->lerp)
+	{
+		*u -= 32768;
+		*v -= 32768;
+	}
+}
+
+static void
+paint(paintfn_t *fn, const config *c, byte *dp, byte *hp, int w, int h, const byte *sp, int sw, int sh, int ss,
+	int u, int v, int fa, int fb, int fc, int fd)
+{
+	int dbpp = c->n + c->da;
+	int y;
+	if (c->lerp)
+	{
+		sw = (sw << 16) + 32768;
+		sh = (sh << 16) + 32768;
+	}
+	for (y = 0; y < h; y++)
+	{
+		fn(dp + y * w * dbpp, c->da, sp, sw, sh, ss, c->sa, u, v, fa, fb, w, c->n, c->alpha, NULL, hp ? hp + y * w : NULL);
+		u += fc;
+		v += fd;
+	}
+}
+
+static fz_matrix
+random_matrix(int w, int h)
+{
+	fz_matrix m, r;
+	float t = rnd(8) ? rnd(3600) / 10.0f : rnd(4) * 90.0f;
+	float sx = (1 + rnd(400)) / 100.0f * w;
+	float sy = (1 + rnd(400)) / 100.0f * h;
+	fz_scale(&m, rnd(2) ? sx : -sx, rnd(2) ? sy : -sy);
+	fz_concat(&m, &m, fz_rotate(&r, t));
+	if (!rnd(4))
+	{
+		m.c += (rnd(200) - 100) / 100.0f * sx;
+		m.b += (rnd(200) - 100) / 100.0f * sy;
+	}
+	m.e = rnd(w * 4) - w;
+	m.f = rnd(h * 4) - h;
+	return m;
+}
+
+static int
+check(const config *c, int iterations)
+{
+	int i, k, bad = 0;
+	for (i = 0; i < iterations; i++)
+	{
+		int sw = 1 + rnd(rnd(4) ? 40 : 3);
+		int sh = 1 + rnd(rnd(4) ? 40 : 3);
+		int bpp = c->sn + c->sa;
+		int ss = sw * bpp + rnd(3);
+		int size = (sh - 1) * ss + sw * bpp;
+		int w = 1 + rnd(70), h = 1 + rnd(8);
+		int dsize = w * h * (c->n + c->da);
+		int u, v, fa, fb, fc, fd;
+		byte *sp = malloc(size);
+		byte *d0 = malloc(dsize), *d1 = malloc(dsize);
+		byte *h0 = NULL, *h1 = NULL;
+		paintfn_t *fn;
+		fz_matrix m = random_matrix(w, h);
+
+		/* Premultiplied samples, or junk. */
+		for (k = 0; k < size; k++)
+			sp[k] = rnd(256);
+		if (c->sa && rnd(4))
+		{
+			int x, y, j;
+			for (y = 0; y < sh; y++)
+				for (x = 0; x < sw; x++)
+				{
+					byte *p = sp + y * ss + x * bpp;
+					int a = rnd(3) ? p[c->sn] : rnd(2) * 255;
+					p[c->sn] = a;
+					for (j = 0; j < c->sn; j++)
+						p[j] = fz_mul255(p[j], a);
+				}
+		}
+		for (k = 0; k < dsize; k++)
+			d0[k] = d1[k] = rnd(256);
+		if (rnd(2))
+		{
+			h0 = malloc(w * h);
+			h1 = malloc(w * h);
+			for (k = 0; k < w * h; k++)
+				h0[k] = h1[k] = rnd(256);
+		}
+
+		setup(c, m, sw, sh, &u, &v, &fa, &fb, &fc, &fd);
+		if (!rnd(6))
+			fa = 0;
+		else if (!rnd(5))
+			fb = 0;
+		fn = c_painter(c, fa, fb);
+		paint(fn, c, d0, h0, w, h, sp, sw, sh, ss, u, v, fa, fb, fc, fd);
+		fn = sse41_paint_affine(c->da, c->sa, fa, fb, c->n, c->sn, c->alpha, c->lerp);
+		paint(fn, c, d1, h1, w, h, sp, sw, sh, ss, u, v, fa, fb, fc, fd);
+
+		if (memcmp(d0, d1, dsize) || (h0 && memcmp(h0, h1, w * h)))
+		{
+			if (bad++ < 5)
+				fprintf(stderr, "%s: mismatch, image %dx%d, span %dx%d, u=%d v=%d fa=%d fb=%d\n",
+					describe(c), sw, sh, w, h, u, v, fa, fb);
+		}
+
+		free(sp);
+		free(d0);
+		free(d1);
+		free(h0);
+		free(h1);
+	}
+	return bad;
+}
+
+static double
+timed(paintfn_t *fn, const config *c, byte *dp, byte *hp, int w, int h, const byte *sp, int sw, int sh, int ss,
+	int u, int v, int fa, int fb, int fc, int fd)
+{
+	double best = 0;
+	int i, k;
+	for (k = 0; k < 5; k++)
+	{
+		clock_t start = clock();
+		double t;
+		for (i = 0; i < 10; i++)
+			paint(fn, c, dp, hp, w, h, sp, sw, sh, ss, u, v, fa, fb, fc, fd);
+		t = (double)(clock() - start) / CLOCKS_PER_SEC;
+		if (k == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+static void
+bench(const config *c, float angle)
+{
+	int sw = 1000, sh = 1000, w = 1000, h = 1000;
+	int bpp = c->sn + c->sa, ss = sw * bpp;
+	int u, v, fa, fb, fc, fd, k;
+	byte *sp = malloc(ss * sh);
+	byte *dp = malloc(w * h * (c->n + c->da));
+	fz_matrix m, r;
+
+	for (k = 0; k < ss * sh; k++)
+		sp[k] = rnd(256);
+	if (c->sa)
+		for (k = 0; k < sw * sh; k++)
+			sp[k * bpp + c->sn] = 255;
+	memset(dp, 0x55, w * h * (c->n + c->da));
+
+	fz_scale(&m, sw * 1.3f, sh * 1.3f);
+	fz_concat(&m, &m, fz_rotate(&r, angle));
+	m.e = 200;
+	m.f = angle ? -300 : 0;
+	setup(c, m, sw, sh, &u, &v, &fa, &fb, &fc, &fd);
+	printf("%-32s %5.0f %8.3fs %8.3fs\n", describe(c), angle,
+		timed(c_painter(c, fa, fb), c, dp, NULL, w, h, sp, sw, sh, ss, u, v, fa, fb, fc, fd),
+		timed(sse41_paint_affine(c->da, c->sa, fa, fb, c->n, c->sn, c->alpha, c->lerp), c, dp, NULL, w, h, sp, sw, sh, ss, u, v, fa, fb, fc, fd));
+	free(sp);
+	free(dp);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int ns[][2] = { { 1, 1 }, { 3, 3 }, { 4, 4 }, { 3, 1 } };
+	int time_it = argc > 1 && !strcmp(argv[1], "-t");
+	int i, lerp, sa, da, alpha, bad = 0;
+
+	if (!have_sse41())
+	{
+		printf("no SSE4.1 on this processor; nothing to test\n");
+		return 0;
+	}
+
+	for (lerp = 0; lerp < 2; lerp++)
+		for (i = 0; i < (int)nelem(ns); i++)
+			for (sa = 0; sa < 2; sa++)
+				for (da = 0; da < 2; da++)
+					for (alpha = 0; alpha < 2; alpha++)
+					{
+						config c = { lerp, ns[i][0], ns[i][1], sa, da, alpha ? 1 + rnd(254) : 255 };
+						if (!sse41_paint_affine(c.da, c.sa, 1, 1, c.n, c.sn, c.alpha, c.lerp))
+							continue;
+						if (time_it)
+						{
+							bench(&c, 0);
+							bench(&c, 30);
+						}
+						else
+						{
+							int b = check(&c, 2000);
+							printf("%-32s %s\n", describe(&c), b ? "FAILED" : "ok");
+							bad += b;
+						}
+					}
+
+	return bad ? 1 : 0;
+}
+
+#else
+
+int
+main(int argc, char **argv)
+{
+	printf("no SIMD affine painters in this build; nothing to test\n");
+	return 0;
+}
+
+#endif
@@ -14,7 +14,8 @@ struct tiff_page_s
 struct tiff_document_s
 {
 	fz_document super;
-	fz_buffer *buffer;
+	fz_stream *file;
+	unsigned *ifd_offsets;
 	int page_count;
 };
 
@@ -55,24 +56,18 @@ tiff_drop_page(fz_context *ctx, tiff_page *page)
 static tiff_page *
 tiff_load_page(fz_context *ctx, tiff_document *doc, int number)
 {
-	fz_pixmap *pixmap = NULL;
 	fz_image *image = NULL;
 	tiff_page *page = NULL;
 
 	if (number < 0 || number >= doc->page_count)
 		return NULL;
 
-	fz_var(pixmap);
 	fz_var(image);
 	fz_var(page);
 
 	fz_try(ctx)
 	{
-		size_t len;
-		unsigned char *data;
-		len = fz_buffer_storage(ctx, doc->buffer, &data);
-		pixmap = fz_load_tiff_subimage(ctx, data, len, number);
-		image = fz_new_image_from_pixmap(ctx, pixmap, NULL);
+		image = fz_new_image_from_tiff_subimage(ctx, doc->file, doc->ifd_offsets[number]);
 
 		page = fz_new_page(ctx, sizeof *page);
 		page->super.bound_page = (fz_page_bound_page_fn *)tiff_bound_page;
@@ -83,7 +78,6 @@ tiff_load_page(fz_context *ctx, tiff_document *doc, int number)
 	fz_always(ctx)
 	{
 		fz_drop_image(ctx, image);
-		fz_drop_pixmap(ctx, pixmap);
 	}
 	fz_catch(ctx)
 	{
@@ -111,7 +105,8 @@ tiff_lookup_metadata(fz_context *ctx, tiff_document *doc, const char *key, char
 static void
 tiff_drop_document(fz_context *ctx, tiff_document *doc)
 {
-	fz_drop_buffer(ctx, doc->buffer);
+	fz_free(ctx, doc->ifd_offsets);
+	fz_drop_stream(ctx, doc->file);
 }
 
 static tiff_document *
@@ -128,11 +123,8 @@ tiff_open_document_with_stream(fz_context *ctx, fz_stream *file)
 
 	fz_try(ctx)
 	{
-		size_t len;
-		unsigned char *data;
-		doc->buffer = fz_read_all(ctx, file, 1024);
-		len = fz_buffer_storage(ctx, doc->buffer, &data);
-		doc->page_count = fz_load_tiff_subimage_count(ctx, data, len);
+		doc->file = fz_keep_stream(ctx, file);
+		doc->page_count = fz_index_tiff_subimages(ctx, doc->file, &doc->ifd_offsets);
 	}
 	fz_catch(ctx)
 	{
@@ -340,6 +340,269 @@ fz_set_device_lab(fz_context *ctx, fz_colorspace *cs)
 
 /* Fast pixmap color conversions */
 
+/*
+	On x86 the fast converters below hand whole pixmaps to an SSSE3
+	version where the processor supports it. Pixels are processed 16
+	at a time: a row of interleaved samples is split into one register
+	per component with pshufb, converted using exactly the same integer
+	arithmetic as the scalar loops, and interleaved again on the way
+	out. The scalar loops remain both the fallback and the reference;
+	the two must always give identical results.
+*/
+
+#ifdef ARCH_X86_DISPATCH
+#define HAVE_SSSE3_CONVERT
+#endif
+
+#ifdef HAVE_SSSE3_CONVERT
+
+#include <tmmintrin.h>
+
+#define SSSE3 __attribute__((target("ssse3")))
+
+enum
+{
+	CONV_GRAY_TO_RGB,
+	CONV_GRAY_TO_CMYK,
+	CONV_RGB_TO_GRAY,
+	CONV_BGR_TO_GRAY,
+	CONV_RGB_TO_CMYK,
+	CONV_BGR_TO_CMYK,
+	CONV_CMYK_TO_GRAY,
+	CONV_RGB_TO_BGR
+};
+
+typedef struct
+{
+	__m128i split[5][5];
+	__m128i merge[5][5];
+} ssse3_swizzle;
+
+static int
+have_ssse3(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+/* Build the shuffles that take 16 pixels of sn bytes each to sn
+ * planes of 16 bytes, and 16 pixels worth of dn planes back to dn
+ * registers of interleaved samples. */
+static void
+init_swizzle(ssse3_swizzle *sw, fz_pixmap *dst, fz_pixmap *src)
+{
+	unsigned char m[16];
+	int sn = src->n;
+	int dn = dst->n;
+	int c, r, i;
+
+	for (c = 0; c < sn; c++)
+		for (r = 0; r < sn; r++)
+		{
+			for (i = 0; i < 16; i++)
+			{
+				int o = i * sn + c;
+				m[i] = (o >> 4) == r ? (o & 15) : 0x80;
+			}
+			memcpy(&sw->split[c][r], m, 16);
+		}
+
+	for (c = 0; c < dn; c++)
+		for (r = 0; r < dn; r++)
+		{
+			for (i = 0; i < 16; i++)
+			{
+				int o = r * 16 + i;
+				m[i] = (o % dn) == c ? o / dn : 0x80;
+			}
+			memcpy(&sw->merge[c][r], m, 16);
+		}
+}
+
+static inline SSSE3 __m128i
+mul255_epi16(__m128i a, __m128i b)
+{
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	x = _mm_add_epi16(x, _mm_srli_epi16(x, 8));
+	return _mm_srli_epi16(x, 8);
+}
+
+static inline SSSE3 __m128i
+rgb_to_gray_epi16(__m128i r, __m128i g, __m128i b)
+{
+	__m128i v = _mm_mullo_epi16(r, _mm_set1_epi16(77));
+	v = _mm_add_epi16(v, _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+	v = _mm_add_epi16(v, _mm_mullo_epi16(b, _mm_set1_epi16(28)));
+	v = _mm_add_epi16(v, _mm_set1_epi16(255));
+	return _mm_srli_epi16(v, 8);
+}
+
+static inline SSSE3 __m128i
+cmyk_to_gray_epi16(__m128i c, __m128i m, __m128i y, __m128i k)
+{
+	__m128i v = mul255_epi16(c, _mm_set1_epi16(77));
+	v = _mm_add_epi16(v, mul255_epi16(m, _mm_set1_epi16(150)));
+	v = _mm_add_epi16(v, mul255_epi16(y, _mm_set1_epi16(28)));
+	v = _mm_min_epi16(_mm_add_epi16(v, k), _mm_set1_epi16(255));
+	return _mm_sub_epi16(_mm_set1_epi16(255), v);
+}
+
+/* Convert 16 pixels from s to d. This is always inlined into callers
+ * that pass constant op, sn, dn, sa and da so that the compiler can
+ * unroll the plane loops and drop the unused cases. */
+static inline SSSE3 __attribute__((always_inline)) void
+ssse3_convert_16(const ssse3_swizzle *sw, int op, int sn, int dn, int sa, int da, unsigned char *d, const unsigned char *s)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(-1);
+	__m128i in[5], sp[5], dp[5];
+	int c, r;
+
+	for (r = 0; r < sn; r++)
+		in[r] = _mm_loadu_si128((const __m128i *)(s + r * 16));
+	for (c = 0; c < sn; c++)
+	{
+		sp[c] = _mm_shuffle_epi8(in[0], sw->split[c][0]);
+		for (r = 1; r < sn; r++)
+			sp[c] = _mm_or_si128(sp[c], _mm_shuffle_epi8(in[r], sw->split[c][r]));
+	}
+
+	switch (op)
+	{
+	case CONV_GRAY_TO_RGB:
+		dp[0] = dp[1] = dp[2] = sp[0];
+		break;
+	case CONV_GRAY_TO_CMYK:
+		dp[0] = dp[1] = dp[2] = zero;
+		dp[3] = _mm_xor_si128(sp[0], ones);
+		break;
+	case CONV_RGB_TO_GRAY:
+	case CONV_BGR_TO_GRAY:
+	{
+		__m128i R = sp[op == CONV_RGB_TO_GRAY ? 0 : 2];
+		__m128i B = sp[op == CONV_RGB_TO_GRAY ? 2 : 0];
+		__m128i lo = rgb_to_gray_epi16(_mm_unpacklo_epi8(R, zero), _mm_unpacklo_epi8(sp[1], zero), _mm_unpacklo_epi8(B, zero));
+		__m128i hi = rgb_to_gray_epi16(_mm_unpackhi_epi8(R, zero), _mm_unpackhi_epi8(sp[1], zero), _mm_unpackhi_epi8(B, zero));
+		dp[0] = _mm_packus_epi16(lo, hi);
+		break;
+	}
+	case CONV_RGB_TO_CMYK:
+	case CONV_BGR_TO_CMYK:
+	{
+		__m128i C = _mm_xor_si128(sp[op == CONV_RGB_TO_CMYK ? 0 : 2], ones);
+		__m128i M = _mm_xor_si128(sp[1], ones);
+		__m128i Y = _mm_xor_si128(sp[op == CONV_RGB_TO_CMYK ? 2 : 0], ones);
+		__m128i K = _mm_min_epu8(C, _mm_min_epu8(M, Y));
+		dp[0] = _mm_sub_epi8(C, K);
+		dp[1] = _mm_sub_epi8(M, K);
+		dp[2] = _mm_sub_epi8(Y, K);
+		dp[3] = K;
+		break;
+	}
+	case CONV_CMYK_TO_GRAY:
+	{
+		__m128i lo = cmyk_to_gray_epi16(_mm_unpacklo_epi8(sp[0], zero), _mm_unpacklo_epi8(sp[1], zero),
+				_mm_unpacklo_epi8(sp[2], zero), _mm_unpacklo_epi8(sp[3], zero));
+		__m128i hi = cmyk_to_gray_epi16(_mm_unpackhi_epi8(sp[0], zero), _mm_unpackhi_epi8(sp[1], zero),
+				_mm_unpackhi_epi8(sp[2], zero), _mm_unpackhi_epi8(sp[3], zero));
+		dp[0] = _mm_packus_epi16(lo, hi);
+		break;
+	}
+	case CONV_RGB_TO_BGR:
+		dp[0] = sp[2];
+		dp[1] = sp[1];
+		dp[2] = sp[0];
+		break;
+	}
+
+	if (da)
+		dp[dn - 1] = sa ? sp[sn - 1] : ones;
+
+	for (r = 0; r < dn; r++)
+	{
+		__m128i v = _mm_shuffle_epi8(dp[0], sw->merge[0][r]);
+		for (c = 1; c < dn; c++)
+			v = _mm_or_si128(v, _mm_shuffle_epi8(dp[c], sw->merge[c][r]));
+		_mm_storeu_si128((__m128i *)(d + r * 16), v);
+	}
+}
+
+static inline SSSE3 __attribute__((always_inline)) void
+ssse3_convert_rows(const ssse3_swizzle *sw, int op, int sn, int dn, int sa, int da, fz_pixmap *dst, fz_pixmap *src)
+{
+	unsigned char stail[16 * 5];
+	unsigned char dtail[16 * 5];
+	const unsigned char *s = src->samples;
+	unsigned char *d = dst->samples;
+	size_t w = src->w;
+	int h = src->h;
+	size_t x;
+
+	if (dst->stride == (ptrdiff_t)(w * dn) && src->stride == (ptrdiff_t)(w * sn))
+	{
+		w *= h;
+		h = 1;
+	}
+
+	memset(stail, 0, sizeof stail);
+	while (h--)
+	{
+		for (x = 0; x + 16 <= w; x += 16)
+			ssse3_convert_16(sw, op, sn, dn, sa, da, d + x * dn, s + x * sn);
+		if (x < w)
+		{
+			memcpy(stail, s + x * sn, (w - x) * sn);
+			ssse3_convert_16(sw, op, sn, dn, sa, da, dtail, stail);
+			memcpy(d + x * dn, dtail, (w - x) * dn);
+		}
+		d += dst->stride;
+		s += src->stride;
+	}
+}
+
+#define SSSE3_CONVERT_CASE(OP, SN, DN) \
+	case OP: \
+		if (sa && da) ssse3_convert_rows(&sw, OP, SN + 1, DN + 1, 1, 1, dst, src); \
+		else if (da) ssse3_convert_rows(&sw, OP, SN, DN + 1, 0, 1, dst, src); \
+		else if (sa) ssse3_convert_rows(&sw, OP, SN + 1, DN, 1, 0, dst, src); \
+		else ssse3_convert_rows(&sw, OP, SN, DN, 0, 0, dst, src); \
+		break
+
+static SSSE3 void
+ssse3_convert(fz_pixmap *dst, fz_pixmap *src, int op)
+{
+	ssse3_swizzle sw;
+	int sa = src->alpha;
+	int da = dst->alpha;
+
+	init_swizzle(&sw, dst, src);
+
+	switch (op)
+	{
+	SSSE3_CONVERT_CASE(CONV_GRAY_TO_RGB, 1, 3);
+	SSSE3_CONVERT_CASE(CONV_GRAY_TO_CMYK, 1, 4);
+	SSSE3_CONVERT_CASE(CONV_RGB_TO_GRAY, 3, 1);
+	SSSE3_CONVERT_CASE(CONV_BGR_TO_GRAY, 3, 1);
+	SSSE3_CONVERT_CASE(CONV_RGB_TO_CMYK, 3, 4);
+	SSSE3_CONVERT_CASE(CONV_BGR_TO_CMYK, 3, 4);
+	SSSE3_CONVERT_CASE(CONV_CMYK_TO_GRAY, 4, 1);
+	SSSE3_CONVERT_CASE(CONV_RGB_TO_BGR, 3, 3);
+	}
+}
+
+/* Run the SSSE3 version of a conversion if we can. Returns 0 if the
+ * caller should fall back to the scalar code. */
+static int
+fast_convert_simd(fz_pixmap *dst, fz_pixmap *src, int op)
+{
+	if (src->n > 5 || dst->n > 5 || !have_ssse3())
+		return 0;
+	ssse3_convert(dst, src, op);
+	return 1;
+}
+
+#endif
+
 static void fast_gray_to_rgb(fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
@@ -352,6 +615,11 @@ static void fast_gray_to_rgb(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_GRAY_TO_RGB))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -430,6 +698,11 @@ static void fast_gray_to_cmyk(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_GRAY_TO_CMYK))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -511,6 +784,11 @@ static void fast_rgb_to_gray(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_RGB_TO_GRAY))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -583,6 +861,11 @@ static void fast_bgr_to_gray(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_BGR_TO_GRAY))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -655,6 +938,11 @@ static void fast_rgb_to_cmyk(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_RGB_TO_CMYK))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -748,6 +1036,11 @@ static void fast_bgr_to_cmyk(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_BGR_TO_CMYK))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -841,6 +1134,11 @@ static void fast_cmyk_to_gray(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_CMYK_TO_GRAY))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -880,7 +1178,7 @@ static void fast_cmyk_to_gray(fz_pixmap *dst, fz_pixmap *src)
 					unsigned char y = fz_mul255(s[2], 28);
 					d[0] = 255 - (unsigned char)fz_mini(c + m + y + s[3], 255);
 					d[1] = 255;
-					s += 3;
+					s += 4;
 					d += 2;
 				}
 				d += d_line_inc;
@@ -1440,6 +1738,11 @@ static void fast_rgb_to_bgr(fz_pixmap *dst, fz_pixmap *src)
 	if ((int)w < 0 || h < 0)
 		return;
 
+#ifdef HAVE_SSSE3_CONVERT
+	if (fast_convert_simd(dst, src, CONV_RGB_TO_BGR))
+		return;
+#endif
+
 	if (d_line_inc == 0 && s_line_inc == 0)
 	{
 		w *= h;
@@ -1462,6 +1765,8 @@ static void fast_rgb_to_bgr(fz_pixmap *dst, fz_pixmap *src)
 					s += 4;
 					d += 4;
 				}
+				d += d_line_inc;
+				s += s_line_inc;
 			}
 		}
 		else
@@ -1478,6 +1783,8 @@ static void fast_rgb_to_bgr(fz_pixmap *dst, fz_pixmap *src)
 					s += 3;
 					d += 4;
 				}
+				d += d_line_inc;
+				s += s_line_inc;
 			}
 		}
 	}
@@ -1497,8 +1804,326 @@ static void fast_rgb_to_bgr(fz_pixmap *dst, fz_pixmap *src)
 				s += 3;
 				d += 3;
 			}
+			d += d_line_inc;
+			s += s_line_inc;
+		}
+	}
+}
+
+/*
+	Interpolated lookup tables for converting between arbitrary
+	colorspaces with 2 to 4 components.
+
+	The source color cube is sampled on a regular grid of nodes, each
+	of which is converted once with the colorspace's own functions.
+	Pixels are then converted by simplex interpolation between the
+	n + 1 surrounding nodes (for 3 components this is the usual
+	tetrahedral interpolation). Tables are kept in the store, keyed on
+	the source and destination colorspaces, so they are shared by all
+	the images and pages that use the same pair.
+*/
+
+#define COLOR_LUT_MAX 4
+
+static const int color_lut_grid[COLOR_LUT_MAX + 1] = { 0, 0, 33, 17, 11 };
+
+typedef struct color_lut_s
+{
+	fz_storable storable;
+	int srcn, dstn;
+	int grid;
+	int stride[COLOR_LUT_MAX];
+	unsigned char table[1];
+} color_lut;
+
+typedef struct color_lut_key_s
+{
+	int refs;
+	fz_colorspace *ss;
+	fz_colorspace *ds;
+} color_lut_key;
+
+static int
+color_lut_make_hash_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	color_lut_key *key = (color_lut_key *)key_;
+	hash->u.pp.ptr[0] = key->ss;
+	hash->u.pp.ptr[1] = key->ds;
+	return 1;
+}
+
+static void *
+color_lut_keep_key(fz_context *ctx, void *key_)
+{
+	color_lut_key *key = (color_lut_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+color_lut_drop_key(fz_context *ctx, void *key_)
+{
+	color_lut_key *key = (color_lut_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_colorspace(ctx, key->ss);
+		fz_drop_colorspace(ctx, key->ds);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+color_lut_cmp_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	color_lut_key *k0 = (color_lut_key *)k0_;
+	color_lut_key *k1 = (color_lut_key *)k1_;
+	return k0->ss == k1->ss && k0->ds == k1->ds;
+}
+
+static void
+color_lut_print(fz_context *ctx, fz_output *out, void *key_)
+{
+	color_lut_key *key = (color_lut_key *)key_;
+	fz_printf(ctx, out, "(color lut %s -> %s) ", key->ss->name, key->ds->name);
+}
+
+static fz_store_type color_lut_store_type =
+{
+	color_lut_make_hash_key,
+	color_lut_keep_key,
+	color_lut_drop_key,
+	color_lut_cmp_key,
+	color_lut_print
+};
+
+static void
+drop_color_lut_imp(fz_context *ctx, fz_storable *lut)
+{
+	fz_free(ctx, lut);
+}
+
+static void
+drop_color_lut(fz_context *ctx, color_lut *lut)
+{
+	fz_drop_storable(ctx, &lut->storable);
+}
+
+static color_lut *
+new_color_lut(fz_context *ctx, fz_colorspace *ds, fz_colorspace *ss)
+{
+	float srcv[FZ_MAX_COLORS];
+	float dstv[FZ_MAX_COLORS];
+	int idx[COLOR_LUT_MAX];
+	fz_color_converter cc;
+	color_lut *lut;
+	unsigned char *p;
+	int srcn = ss->n;
+	int dstn = ds->n;
+	int grid = color_lut_grid[srcn];
+	int nodes = 1;
+	int i, k;
+
+	for (k = srcn - 1; k >= 0; k--)
+		nodes *= grid;
+
+	lut = fz_malloc(ctx, sizeof *lut + (size_t)nodes * dstn);
+	FZ_INIT_STORABLE(lut, 1, drop_color_lut_imp);
+	lut->srcn = srcn;
+	lut->dstn = dstn;
+	lut->grid = grid;
+	lut->stride[srcn - 1] = 1;
+	for (k = srcn - 2; k >= 0; k--)
+		lut->stride[k] = lut->stride[k + 1] * grid;
+
+	fz_try(ctx)
+	{
+		fz_lookup_color_converter(ctx, &cc, ds, ss);
+		memset(idx, 0, sizeof idx);
+		p = lut->table;
+		for (i = 0; i < nodes; i++)
+		{
+			for (k = 0; k < srcn; k++)
+				srcv[k] = (float)idx[k] / (grid - 1);
+
+			cc.convert(ctx, &cc, dstv, srcv);
+
+			for (k = 0; k < dstn; k++)
+				*p++ = fz_clamp(dstv[k], 0, 1) * 255;
+
+			for (k = srcn - 1; k >= 0; k--)
+			{
+				if (++idx[k] < grid)
+					break;
+				idx[k] = 0;
+			}
 		}
 	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, lut);
+		fz_rethrow(ctx);
+	}
+
+	return lut;
+}
+
+/* Find the table for converting from ss to ds, building it if it will
+ * pay for itself on a conversion of npixels. Returns NULL if the
+ * caller should convert without a table. */
+static color_lut *
+find_color_lut(fz_context *ctx, fz_colorspace *ds, fz_colorspace *ss, size_t npixels)
+{
+	color_lut_key key, *new_key = NULL;
+	color_lut *lut, *existing;
+	size_t nodes;
+	int k;
+
+	if (ss->n < 2 || ss->n > COLOR_LUT_MAX)
+		return NULL;
+
+	key.refs = 1;
+	key.ss = ss;
+	key.ds = ds;
+	lut = fz_find_item(ctx, drop_color_lut_imp, &key, &color_lut_store_type);
+	if (lut)
+		return lut;
+
+	nodes = 1;
+	for (k = 0; k < ss->n; k++)
+		nodes *= color_lut_grid[ss->n];
+	if (npixels < nodes)
+		return NULL;
+
+	lut = new_color_lut(ctx, ds, ss);
+
+	fz_var(new_key);
+
+	fz_try(ctx)
+	{
+		new_key = fz_malloc_struct(ctx, color_lut_key);
+		new_key->refs = 1;
+		new_key->ss = fz_keep_colorspace(ctx, ss);
+		new_key->ds = fz_keep_colorspace(ctx, ds);
+		existing = fz_store_item(ctx, new_key, lut, sizeof *lut + nodes * lut->dstn, &color_lut_store_type);
+		if (existing)
+		{
+			drop_color_lut(ctx, lut);
+			lut = existing;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (new_key)
+			color_lut_drop_key(ctx, new_key);
+	}
+	fz_catch(ctx)
+	{
+		/* Failing to cache the table is not fatal. */
+	}
+
+	return lut;
+}
+
+/* Interpolate the color of one pixel from the table. */
+static inline void
+color_lut_lookup(const color_lut *lut, unsigned char *d, const unsigned char *s)
+{
+	int srcn = lut->srcn;
+	int dstn = lut->dstn;
+	int g1 = lut->grid - 1;
+	int f[COLOR_LUT_MAX + 1];
+	int order[COLOR_LUT_MAX];
+	int acc[FZ_MAX_COLORS];
+	const unsigned char *node;
+	int offset = 0;
+	int i, j, k, w;
+
+	/* srcn is never 0; these just keep gcc from warning that it might be */
+	f[0] = 0;
+	order[0] = 0;
+
+	for (k = 0; k < srcn; k++)
+	{
+		int x = s[k] * g1;
+		int ix = x / 255;
+		int fx = x - ix * 255;
+		if (ix == g1)
+		{
+			ix--;
+			fx = 255;
+		}
+		offset += ix * lut->stride[k];
+		f[k] = fx;
+
+		/* Insertion sort of the axes by decreasing fraction */
+		for (j = k; j > 0 && f[order[j - 1]] < fx; j--)
+			order[j] = order[j - 1];
+		order[j] = k;
+	}
+
+	/* Walk from the base node towards the far corner, one axis at a
+	 * time in order of decreasing fraction. The weights sum to 255. */
+	node = lut->table + (size_t)offset * dstn;
+	w = 255 - f[order[0]];
+	for (i = 0; i < dstn; i++)
+		acc[i] = w * node[i];
+	for (k = 0; k < srcn; k++)
+	{
+		offset += lut->stride[order[k]];
+		node = lut->table + (size_t)offset * dstn;
+		w = f[order[k]] - (k + 1 < srcn ? f[order[k + 1]] : 0);
+		for (i = 0; i < dstn; i++)
+			acc[i] += w * node[i];
+	}
+
+	for (i = 0; i < dstn; i++)
+		d[i] = (acc[i] + 127) / 255;
+}
+
+static void
+color_lut_conv_pixmap(fz_context *ctx, const color_lut *lut, fz_pixmap *dst, fz_pixmap *src)
+{
+	unsigned char *s = src->samples;
+	unsigned char *d = dst->samples;
+	unsigned char *sold = NULL;
+	unsigned char *dold = NULL;
+	size_t w = src->w;
+	int h = src->h;
+	int srcn = lut->srcn;
+	int dstn = lut->dstn;
+	int sa = src->alpha;
+	int da = dst->alpha;
+	ptrdiff_t d_line_inc = dst->stride - w * dst->n;
+	ptrdiff_t s_line_inc = src->stride - w * src->n;
+
+	if (d_line_inc == 0 && s_line_inc == 0)
+	{
+		w *= h;
+		h = 1;
+	}
+
+	while (h--)
+	{
+		size_t ww = w;
+		while (ww--)
+		{
+			/* Runs of the same color are common in images */
+			if (sold && memcmp(sold, s, srcn) == 0)
+				memcpy(d, dold, dstn);
+			else
+			{
+				color_lut_lookup(lut, d, s);
+				sold = s;
+				dold = d;
+			}
+			s += srcn;
+			d += dstn;
+			if (da)
+				*d++ = (sa ? *s : 255);
+			s += sa;
+		}
+		d += d_line_inc;
+		s += s_line_inc;
+	}
 }
 
 static void
@@ -1514,6 +2139,7 @@ fz_std_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 	ptrdiff_t s_line_inc = src->stride - w * src->n;
 	int da = dst->alpha;
 	int sa = src->alpha;
+	color_lut *lut;
 
 	fz_colorspace *ss = src->colorspace;
 	fz_colorspace *ds = dst->colorspace;
@@ -1624,6 +2250,13 @@ fz_std_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 		}
 	}
 
+	/* Interpolated lookup table for colorspaces with 2 to 4 components */
+	else if ((lut = find_color_lut(ctx, ds, ss, w*h)) != NULL)
+	{
+		color_lut_conv_pixmap(ctx, lut, dst, src);
+		drop_color_lut(ctx, lut);
+	}
+
 	/* Memoize colors using a hash table for the general case */
 	else
 	{
@@ -1764,7 +2397,7 @@ fz_convert_pixmap(fz_context *ctx, fz_pixmap *dp, fz_pixmap *sp)
 	{
 		if (ds == fz_default_gray) fast_bgr_to_gray(dp, sp);
 		else if (ds == fz_default_rgb) fast_rgb_to_bgr(dp, sp); /* bgr = rgb here */
-		else if (ds == fz_default_cmyk) fast_bgr_to_cmyk(sp, dp);
+		else if (ds == fz_default_cmyk) fast_bgr_to_cmyk(dp, sp);
 		else fz_std_conv_pixmap(ctx, dp, sp);
 	}
 
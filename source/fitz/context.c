@@ -116,6 +116,96 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_tune_run_jobs(fz_context *ctx, fz_tune_run_jobs_fn *run_jobs, void *arg)
+{
+	ctx->tuning->run_jobs = run_jobs;
+	ctx->tuning->run_jobs_arg = arg;
+}
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_job_fn *job;
+	void *arg;
+	int *errcode;
+	char (*message)[256];
+} fz_job_batch;
+
+static void
+fz_run_job_imp(void *batch_, int i)
+{
+	fz_job_batch *batch = batch_;
+	fz_context *ctx;
+
+	/* Each job gets its own clone, so that only as many exception
+	 * stacks are live at once as there are running threads. */
+	ctx = fz_clone_context(batch->ctx);
+	if (!ctx)
+	{
+		batch->errcode[i] = FZ_ERROR_OOM;
+		fz_strlcpy(batch->message[i], "cannot clone context for job", sizeof batch->message[i]);
+		return;
+	}
+
+	fz_try(ctx)
+		batch->job(ctx, batch->arg, i);
+	fz_catch(ctx)
+	{
+		batch->errcode[i] = fz_caught(ctx);
+		fz_strlcpy(batch->message[i], fz_caught_message(ctx), sizeof batch->message[i]);
+	}
+
+	fz_drop_context(ctx);
+}
+
+int
+fz_can_run_parallel_jobs(fz_context *ctx)
+{
+	/* Without real locks we cannot hand work to other threads. */
+	return ctx->tuning->run_jobs && ctx->locks != &fz_locks_default;
+}
+
+void
+fz_run_jobs(fz_context *ctx, int n, fz_job_fn *job, void *arg)
+{
+	fz_job_batch batch;
+	int i;
+
+	if (n <= 0)
+		return;
+
+	if (n == 1 || !fz_can_run_parallel_jobs(ctx))
+	{
+		for (i = 0; i < n; ++i)
+			job(ctx, arg, i);
+		return;
+	}
+
+	batch.ctx = ctx;
+	batch.job = job;
+	batch.arg = arg;
+	batch.errcode = fz_calloc(ctx, n, sizeof *batch.errcode);
+	batch.message = NULL;
+
+	fz_try(ctx)
+	{
+		batch.message = fz_malloc_array(ctx, n, sizeof *batch.message);
+		ctx->tuning->run_jobs(ctx->tuning->run_jobs_arg, n, fz_run_job_imp, &batch);
+		for (i = 0; i < n; ++i)
+			if (batch.errcode[i] != FZ_ERROR_NONE)
+				fz_throw(ctx, batch.errcode[i], "%s", batch.message[i]);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, batch.message);
+		fz_free(ctx, batch.errcode);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 void
 fz_drop_context(fz_context *ctx)
 {
@@ -126,6 +216,7 @@ fz_drop_context(fz_context *ctx)
 	fz_drop_document_handler_context(ctx);
 	fz_drop_glyph_cache_context(ctx);
 	fz_drop_store_context(ctx);
+	fz_drop_pixmap_pool_context(ctx);
 	fz_drop_aa_context(ctx);
 	fz_drop_style_context(ctx);
 	fz_drop_tuning_context(ctx);
@@ -224,6 +315,7 @@ fz_new_context_imp(const fz_alloc_context *alloc, const fz_locks_context *locks,
 	fz_try(ctx)
 	{
 		fz_new_output_context(ctx);
+		fz_new_pixmap_pool_context(ctx);
 		fz_new_store_context(ctx, max_store);
 		fz_new_glyph_cache_context(ctx);
 		fz_new_colorspace_context(ctx);
@@ -273,6 +365,8 @@ fz_clone_context_internal(fz_context *ctx)
 	new_ctx->user = ctx->user;
 	new_ctx->store = ctx->store;
 	new_ctx->store = fz_keep_store_context(new_ctx);
+	new_ctx->pixmap_pool = ctx->pixmap_pool;
+	new_ctx->pixmap_pool = fz_keep_pixmap_pool_context(new_ctx);
 	new_ctx->glyph_cache = ctx->glyph_cache;
 	new_ctx->glyph_cache = fz_keep_glyph_cache(new_ctx);
 	new_ctx->colorspace = ctx->colorspace;
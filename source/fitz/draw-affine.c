@@ -3,6 +3,15 @@
 
 typedef unsigned char byte;
 
+/* The painters below are made by specialising these templates for
+ * constant arguments, so they must be inlined. With the SSE4.1 painters
+ * also in the file GCC would otherwise give up on some of them. */
+#ifdef ARCH_X86_DISPATCH
+#define template_inline static inline __attribute__((always_inline))
+#else
+#define template_inline static inline
+#endif
+
 typedef void (paintfn_t)(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n, int alpha, const byte * restrict color, byte * restrict hp);
 
 static inline int lerp(int a, int b, int t)
@@ -26,7 +35,7 @@ static inline const byte *sample_nearest(const byte *s, int w, int h, int str, i
 
 /* Blend premultiplied source image in constant alpha over destination */
 
-static inline void
+template_inline void
 template_affine_alpha_N_lerp(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, int alpha, byte * restrict hp)
 {
 	int k;
@@ -68,7 +77,7 @@ template_affine_alpha_N_lerp(byte * restrict dp, int da, const byte * restrict s
 }
 
 /* Special case code for gray -> rgb */
-static inline void
+template_inline void
 template_affine_alpha_g2rgb_lerp(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int alpha, byte * restrict hp)
 {
 	do
@@ -98,7 +107,7 @@ template_affine_alpha_g2rgb_lerp(byte * restrict dp, int da, const byte * restri
 					hp[0] = y + fz_mul255(hp[0], t);
 			}
 		}
-		dp += 4;
+		dp += 3 + da;
 		if (hp)
 			hp++;
 		u += fa;
@@ -107,7 +116,7 @@ template_affine_alpha_g2rgb_lerp(byte * restrict dp, int da, const byte * restri
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_alpha_N_near_fa0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, int alpha, byte * restrict hp)
 {
 	int k;
@@ -142,7 +151,7 @@ template_affine_alpha_N_near_fa0(byte * restrict dp, int da, const byte * restri
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_alpha_N_near_fb0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, int alpha, byte * restrict hp)
 {
 	int k;
@@ -176,7 +185,7 @@ template_affine_alpha_N_near_fb0(byte * restrict dp, int da, const byte * restri
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_alpha_N_near(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, int alpha, byte * restrict hp)
 {
 	int k;
@@ -209,7 +218,7 @@ template_affine_alpha_N_near(byte * restrict dp, int da, const byte * restrict s
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_alpha_g2rgb_near_fa0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int alpha, byte * restrict hp)
 {
 	int ui = u >> 16;
@@ -244,7 +253,7 @@ template_affine_alpha_g2rgb_near_fa0(byte * restrict dp, int da, const byte * re
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_alpha_g2rgb_near_fb0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int alpha, byte * restrict hp)
 {
 	int vi = v >> 16;
@@ -279,7 +288,7 @@ template_affine_alpha_g2rgb_near_fb0(byte * restrict dp, int da, const byte * re
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_alpha_g2rgb_near(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int alpha, byte * restrict hp)
 {
 	do
@@ -313,7 +322,7 @@ template_affine_alpha_g2rgb_near(byte * restrict dp, int da, const byte * restri
 }
 
 /* Blend premultiplied source image over destination */
-static inline void
+template_inline void
 template_affine_N_lerp(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, byte * restrict hp)
 {
 	int k;
@@ -354,7 +363,7 @@ template_affine_N_lerp(byte * restrict dp, int da, const byte * restrict sp, int
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_solid_g2rgb_lerp(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, byte * restrict hp)
 {
 	do
@@ -392,7 +401,7 @@ template_affine_solid_g2rgb_lerp(byte * restrict dp, int da, const byte * restri
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_N_near_fa0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, byte * restrict hp)
 {
 	int k;
@@ -451,7 +460,7 @@ template_affine_N_near_fa0(byte * restrict dp, int da, const byte * restrict sp,
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_N_near_fb0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, byte * restrict hp)
 {
 	int k;
@@ -510,7 +519,7 @@ template_affine_N_near_fb0(byte * restrict dp, int da, const byte * restrict sp,
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_N_near(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n1, byte * restrict hp)
 {
 	int k;
@@ -567,7 +576,7 @@ template_affine_N_near(byte * restrict dp, int da, const byte * restrict sp, int
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_solid_g2rgb_near_fa0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, byte * restrict hp)
 {
 	int ui = u >> 16;
@@ -615,7 +624,7 @@ template_affine_solid_g2rgb_near_fa0(byte * restrict dp, int da, const byte * re
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_solid_g2rgb_near_fb0(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, byte * restrict hp)
 {
 	int vi = v >> 16;
@@ -663,7 +672,7 @@ template_affine_solid_g2rgb_near_fb0(byte * restrict dp, int da, const byte * re
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_solid_g2rgb_near(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, byte * restrict hp)
 {
 	do
@@ -711,7 +720,7 @@ template_affine_solid_g2rgb_near(byte * restrict dp, int da, const byte * restri
 
 /* Blend non-premultiplied color in source image mask over destination */
 
-static inline void
+template_inline void
 template_affine_color_N_lerp(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int u, int v, int fa, int fb, int w, int n1, const byte * restrict color, byte * restrict hp)
 {
 	int sa = color[n1];
@@ -750,7 +759,7 @@ template_affine_color_N_lerp(byte * restrict dp, int da, const byte * restrict s
 	while (--w);
 }
 
-static inline void
+template_inline void
 template_affine_color_N_near(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int u, int v, int fa, int fb, int w, int n1, const byte * restrict color, byte * restrict hp)
 {
 	int sa = color[n1];
@@ -3000,6 +3009,570 @@ fz_paint_affine_color_near(int da, int sa, int fa, int fb, int n, int alpha)
 	}
 }
 
+/*
+	On x86 the painters for gray, RGB and CMYK images (and for gray
+	images drawn to RGB) have SSE4.1 versions, which are picked at
+	runtime when the processor supports them. These do four
+	destination pixels per step: the sample positions, bounds checks
+	and offsets are worked out for all four at once, the samples are
+	fetched with scalar loads (there is no gather), and the filtering
+	and blending is done on 16 bit lanes with exactly the same integer
+	arithmetic as the templates above. Those remain the fallback, paint
+	the last few pixels of each span, and are the reference; the two
+	must always give identical results (scripts/affinetest.c checks
+	this over random transforms).
+*/
+
+#ifdef ARCH_X86_DISPATCH
+#define HAVE_SSE41_AFFINE
+#endif
+
+#ifdef HAVE_SSE41_AFFINE
+
+#include <smmintrin.h>
+
+#define SSE41 __attribute__((target("sse4.1")))
+
+static int
+have_sse41(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.1");
+}
+
+/* lerp on 16 bit lanes. pmulhw only multiplies signed values, so t
+ * is passed as its signed 16 bit value along with th, a mask of the
+ * lanes where that wrapped; adding those lanes' d back in gives the
+ * same result as the unsigned multiply. */
+static inline SSE41 __m128i
+sse41_lerp(__m128i a, __m128i b, __m128i t, __m128i th)
+{
+	__m128i d = _mm_sub_epi16(b, a);
+	return _mm_add_epi16(_mm_add_epi16(a, _mm_mulhi_epi16(d, t)), _mm_and_si128(d, th));
+}
+
+/* fz_mul255 on 16 bit lanes; every intermediate fits in 16 bits. */
+static inline SSE41 __m128i
+sse41_mul255(__m128i a, __m128i b)
+{
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline int
+load32(const byte *p)
+{
+	int x;
+	memcpy(&x, p, 4);
+	return x;
+}
+
+/* Fetch the 8 bytes at sp + off. Windows that would run off the end
+ * of the image are read from the last 8 bytes and shifted down. */
+static inline SSE41 __m128i
+sse41_window(const byte * restrict sp, int off, int lim)
+{
+	if (off <= lim)
+		return _mm_loadl_epi64((const __m128i *)(sp + off));
+	return _mm_srl_epi64(_mm_loadl_epi64((const __m128i *)(sp + lim)), _mm_cvtsi32_si128((off - lim) * 8));
+}
+
+static inline SSE41 __m128i
+sse41_load(const byte *p, int n)
+{
+	switch (n)
+	{
+	case 4: return _mm_cvtsi32_si128(load32(p));
+	case 8: return _mm_loadl_epi64((const __m128i *)p);
+	case 12: return _mm_insert_epi32(_mm_loadl_epi64((const __m128i *)p), load32(p + 8), 2);
+	default: return _mm_loadu_si128((const __m128i *)p);
+	}
+}
+
+static inline SSE41 void
+sse41_store(byte *p, __m128i x, int n)
+{
+	int y;
+	switch (n)
+	{
+	case 4:
+		y = _mm_cvtsi128_si32(x);
+		memcpy(p, &y, 4);
+		break;
+	case 12:
+		y = _mm_extract_epi32(x, 2);
+		memcpy(p + 8, &y, 4);
+		/* fallthrough */
+	case 8:
+		_mm_storel_epi64((__m128i *)p, x);
+		break;
+	default:
+		_mm_storeu_si128((__m128i *)p, x);
+		break;
+	}
+}
+
+/*
+	Paint w pixels of an sn component image (plus alpha if sa) onto a
+	dn component destination (plus alpha if da). dn is 3 with sn 1 for
+	gray to rgb. ap says whether alpha is to be applied, and lerp picks
+	bilinear rather than nearest sampling.
+
+	Samples are read as 8 byte windows, two to a register. Where there
+	is blending to do, each pixel is then spread over sl 16 bit lanes
+	of a register, colorants first and then alpha; when filtering, one
+	window holds both of a pair of horizontally neighbouring samples
+	where they fit. tail paints any pixels left over, and images too
+	small for the windows.
+*/
+static inline SSE41 __attribute__((always_inline)) void
+sse41_affine(byte * restrict dp, const byte * restrict sp, int sw, int sh, int ss, int u, int v, int fa, int fb, int w, int n, int alpha, byte * restrict hp,
+	int sn, int sa, int dn, int da, int ap, int lerp, paintfn_t *tail)
+{
+	const int bpp = sn + sa;
+	const int dbpp = dn + da;
+	const int sl = dn + (sa || da) <= 2 ? 2 : dn + (sa || da) <= 4 ? 4 : 8;
+	const int ppr = 8 / sl; /* pixels per register */
+	const int nr = 4 / ppr; /* registers per 4 pixels */
+	const int pair = 2 * bpp <= 8;
+	const int n4 = dbpp == 5 ? 16 : 4 * dbpp; /* destination bytes in the first register */
+	const int iw = lerp ? sw >> 16 : sw;
+	const int ih = lerp ? sh >> 16 : sh;
+	const int lim = (ih - 1) * ss + iw * bpp - 8;
+	const int ay = ap ? alpha : 255;
+	__m128i ma[4][2], mb[4][2], bc[4], ld[4], st[4], st_tail, pm, yb, yp[4], g2, aset;
+	__m128i zero = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi32(-1);
+	__m128i c255 = _mm_set1_epi16(255);
+	__m128i ca = _mm_set1_epi16(alpha);
+	__m128i cy = _mm_set1_epi16(ay);
+	__m128i ct = _mm_set1_epi16(255 - ay);
+	__m128i U, V, FA, FB, SW, SH, SS, BPP, W2, H1, ROW, COL;
+	byte m[16];
+	int i, j, k, r;
+
+	if (lim < 0 || (lerp && iw < 2))
+	{
+		tail(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, n, alpha, NULL, hp);
+		return;
+	}
+
+	/* Spans along a row or column of the image. */
+	ROW = COL = zero;
+	if (!lerp && fb == 0)
+	{
+		if (v >> 16 < 0 || v >> 16 >= sh)
+			return;
+		ROW = _mm_set1_epi32((v >> 16) * ss);
+	}
+	else if (!lerp && fa == 0)
+	{
+		if (u >> 16 < 0 || u >> 16 >= sw)
+			return;
+		COL = _mm_set1_epi32((u >> 16) * bpp);
+	}
+
+	/* Shuffles from the sample windows to lanes. Pixel p's window is
+	 * in half p % 2 of window register p / 2. */
+	for (r = 0; r < nr; r++)
+	{
+		for (k = 0; k < 2; k++)
+		{
+			memset(m, 0x80, 16);
+			for (i = 0; i < ppr; i++)
+				if ((r * ppr + i) / 2 == k)
+					for (j = 0; j < bpp; j++)
+						m[2 * (i * sl + j)] = (r * ppr + i) % 2 * 8 + j;
+			ma[r][k] = _mm_loadu_si128((const __m128i *)m);
+			for (i = 0; i < 16; i++)
+				if (pair && m[i] != 0x80)
+					m[i] += bpp;
+			mb[r][k] = _mm_loadu_si128((const __m128i *)m);
+		}
+
+		/* Spread each pixel's 32 bit mask over its lanes. */
+		for (i = 0; i < 16; i++)
+			m[i] = 4 * (r * ppr + i / (2 * sl));
+		bc[r] = _mm_loadu_si128((const __m128i *)m);
+
+		/* Destination bytes to lanes and back. For CMYK with alpha the
+		 * 4th pixel straddles the first 16 bytes, so it comes from a
+		 * register realigned to start at it, and all but its first byte
+		 * goes back through st_tail. */
+		memset(m, 0x80, 16);
+		for (i = 0; i < ppr; i++)
+			for (k = 0; k < dbpp; k++)
+			{
+				int b = (r * ppr + i) * dbpp + k;
+				m[2 * (i * sl + k)] = b + dbpp > 16 + k ? k : b;
+			}
+		ld[r] = _mm_loadu_si128((const __m128i *)m);
+		memset(m, 0x80, 16);
+		for (i = 0; i < ppr; i++)
+			for (k = 0; k < dbpp; k++)
+				if ((r * ppr + i) * dbpp + k < 16)
+					m[(r * ppr + i) * dbpp + k] = 2 * (i * sl + k);
+		st[r] = _mm_loadu_si128((const __m128i *)m);
+
+		/* Lane dn of each pixel to lane p of Y. */
+		memset(m, 0x80, 16);
+		for (i = 0; i < ppr; i++)
+		{
+			m[2 * (r * ppr + i)] = 2 * (i * sl + dn);
+			m[2 * (r * ppr + i) + 1] = 2 * (i * sl + dn) + 1;
+		}
+		yp[r] = _mm_loadu_si128((const __m128i *)m);
+	}
+	memset(m, 0x80, 16);
+	for (k = 1; k < 5; k++)
+		m[k - 1] = 2 * k;
+	st_tail = _mm_loadu_si128((const __m128i *)m);
+	memset(m, 0x80, 16);
+	for (i = 0; i < n4; i++)
+		m[i] = 4 * (i / dbpp);
+	pm = _mm_loadu_si128((const __m128i *)m);
+	for (i = 0; i < 16; i++)
+		m[i] = 2 * (i / (2 * sl) * sl + dn) + (i & 1);
+	yb = _mm_loadu_si128((const __m128i *)m);
+	for (i = 0; i < 16; i++)
+		m[i] = (i & 7) < 6 ? (i & 9) : (i & 9) + 2;
+	g2 = _mm_loadu_si128((const __m128i *)m);
+	for (i = 0; i < 8; i++)
+		((short *)m)[i] = (i % sl == sn) ? 255 : 0;
+	aset = _mm_loadu_si128((const __m128i *)m);
+
+	U = _mm_add_epi32(_mm_set1_epi32(u), _mm_mullo_epi32(_mm_set1_epi32(fa), _mm_setr_epi32(0, 1, 2, 3)));
+	V = _mm_add_epi32(_mm_set1_epi32(v), _mm_mullo_epi32(_mm_set1_epi32(fb), _mm_setr_epi32(0, 1, 2, 3)));
+	FA = _mm_slli_epi32(_mm_set1_epi32(fa), 2);
+	FB = _mm_slli_epi32(_mm_set1_epi32(fb), 2);
+	SW = _mm_set1_epi32(sw);
+	SH = _mm_set1_epi32(sh);
+	SS = _mm_set1_epi32(ss);
+	BPP = _mm_set1_epi32(bpp);
+	W2 = _mm_set1_epi32(iw - 2);
+	H1 = _mm_set1_epi32(ih - 1);
+
+	for (; w >= 4; w -= 4)
+	{
+		int o[2][4];
+		__m128i M, E = zero;
+		__m128i ui = _mm_srai_epi32(U, 16);
+		__m128i vi = _mm_srai_epi32(V, 16);
+
+		if (lerp)
+		{
+			/* Windows start at the left sample of each pair, clamped so
+			 * that both samples are in the image; E marks the pixels
+			 * where that was needed. */
+			__m128i lo = _mm_set1_epi32(-32769);
+			__m128i x = _mm_min_epi32(_mm_max_epi32(ui, zero), W2);
+			__m128i y0 = _mm_min_epi32(_mm_max_epi32(vi, zero), H1);
+			__m128i y1 = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(vi, _mm_set1_epi32(1)), zero), H1);
+			M = _mm_and_si128(_mm_cmpgt_epi32(U, lo), _mm_cmplt_epi32(U, SW));
+			M = _mm_and_si128(M, _mm_and_si128(_mm_cmpgt_epi32(V, lo), _mm_cmplt_epi32(V, SH)));
+			E = _mm_andnot_si128(_mm_cmpeq_epi32(x, ui), M);
+			x = _mm_mullo_epi32(x, BPP);
+			_mm_storeu_si128((__m128i *)o[0], _mm_add_epi32(_mm_mullo_epi32(y0, SS), x));
+			_mm_storeu_si128((__m128i *)o[1], _mm_add_epi32(_mm_mullo_epi32(y1, SS), x));
+		}
+		else if (fb == 0)
+		{
+			M = _mm_and_si128(_mm_cmpgt_epi32(ui, ones), _mm_cmplt_epi32(ui, SW));
+			_mm_storeu_si128((__m128i *)o[0], _mm_and_si128(M, _mm_add_epi32(ROW, _mm_mullo_epi32(ui, BPP))));
+		}
+		else if (fa == 0)
+		{
+			M = _mm_and_si128(_mm_cmpgt_epi32(vi, ones), _mm_cmplt_epi32(vi, SH));
+			_mm_storeu_si128((__m128i *)o[0], _mm_and_si128(M, _mm_add_epi32(_mm_mullo_epi32(vi, SS), COL)));
+		}
+		else
+		{
+			M = _mm_and_si128(_mm_cmpgt_epi32(ui, ones), _mm_cmplt_epi32(ui, SW));
+			M = _mm_and_si128(M, _mm_and_si128(_mm_cmpgt_epi32(vi, ones), _mm_cmplt_epi32(vi, SH)));
+			_mm_storeu_si128((__m128i *)o[0], _mm_and_si128(M, _mm_add_epi32(_mm_mullo_epi32(vi, SS), _mm_mullo_epi32(ui, BPP))));
+		}
+
+		if (_mm_movemask_epi8(M))
+		{
+			__m128i S[2][2][4], X[4], T[4], Y, dst, dst_tail = zero, out, out_tail, bm;
+
+			/* S[row][left/right][register] */
+			for (k = 0; k < (lerp ? 2 : 1); k++)
+			{
+				__m128i wa[2], wb[2];
+				for (j = 0; j < 2; j++)
+				{
+					wa[j] = _mm_unpacklo_epi64(sse41_window(sp, o[k][2 * j], lim), sse41_window(sp, o[k][2 * j + 1], lim));
+					if (lerp && !pair)
+						wb[j] = _mm_unpacklo_epi64(sse41_window(sp, o[k][2 * j] + bpp, lim), sse41_window(sp, o[k][2 * j + 1] + bpp, lim));
+					else
+						wb[j] = wa[j];
+				}
+				for (r = 0; r < nr; r++)
+				{
+					if (ppr == 4)
+						S[k][0][r] = _mm_or_si128(_mm_shuffle_epi8(wa[0], ma[r][0]), _mm_shuffle_epi8(wa[1], ma[r][1]));
+					else
+						S[k][0][r] = _mm_shuffle_epi8(wa[r * ppr / 2], ma[r][r * ppr / 2]);
+					if (!lerp)
+						continue;
+					if (ppr == 4)
+						S[k][1][r] = _mm_or_si128(_mm_shuffle_epi8(wb[0], mb[r][0]), _mm_shuffle_epi8(wb[1], mb[r][1]));
+					else
+						S[k][1][r] = _mm_shuffle_epi8(wb[r * ppr / 2], mb[r][r * ppr / 2]);
+				}
+			}
+
+			if (lerp)
+			{
+				__m128i UT[4], VT[4];
+				__m128i uf = _mm_and_si128(U, _mm_set1_epi32(0xffff));
+				__m128i vf = _mm_and_si128(V, _mm_set1_epi32(0xffff));
+				uf = _mm_packus_epi32(uf, uf);
+				vf = _mm_packus_epi32(vf, vf);
+				uf = _mm_unpacklo_epi16(uf, uf);
+				vf = _mm_unpacklo_epi16(vf, vf);
+				if (sl == 2)
+				{
+					UT[0] = uf;
+					VT[0] = vf;
+				}
+				else if (sl == 4)
+				{
+					UT[0] = _mm_unpacklo_epi32(uf, uf);
+					UT[1] = _mm_unpackhi_epi32(uf, uf);
+					VT[0] = _mm_unpacklo_epi32(vf, vf);
+					VT[1] = _mm_unpackhi_epi32(vf, vf);
+				}
+				else
+				{
+					__m128i a = _mm_unpacklo_epi32(uf, uf);
+					__m128i b = _mm_unpackhi_epi32(uf, uf);
+					UT[0] = _mm_unpacklo_epi64(a, a);
+					UT[1] = _mm_unpackhi_epi64(a, a);
+					UT[2] = _mm_unpacklo_epi64(b, b);
+					UT[3] = _mm_unpackhi_epi64(b, b);
+					a = _mm_unpacklo_epi32(vf, vf);
+					b = _mm_unpackhi_epi32(vf, vf);
+					VT[0] = _mm_unpacklo_epi64(a, a);
+					VT[1] = _mm_unpackhi_epi64(a, a);
+					VT[2] = _mm_unpacklo_epi64(b, b);
+					VT[3] = _mm_unpackhi_epi64(b, b);
+				}
+
+				/* Past the left edge both samples are the left one of
+				 * the window, and past the right edge the right one. */
+				if (_mm_movemask_epi8(E))
+				{
+					__m128i left = _mm_cmplt_epi32(ui, zero);
+					for (r = 0; r < nr; r++)
+					{
+						__m128i e = _mm_shuffle_epi8(E, bc[r]);
+						__m128i l = _mm_shuffle_epi8(left, bc[r]);
+						for (k = 0; k < 2; k++)
+						{
+							__m128i a = _mm_blendv_epi8(S[k][0][r], S[k][1][r], _mm_andnot_si128(l, e));
+							S[k][1][r] = _mm_blendv_epi8(S[k][1][r], S[k][0][r], _mm_and_si128(l, e));
+							S[k][0][r] = a;
+						}
+					}
+				}
+
+				for (r = 0; r < nr; r++)
+				{
+					__m128i uh = _mm_srai_epi16(UT[r], 15);
+					__m128i vh = _mm_srai_epi16(VT[r], 15);
+					__m128i ab = sse41_lerp(S[0][0][r], S[0][1][r], UT[r], uh);
+					__m128i cd = sse41_lerp(S[1][0][r], S[1][1][r], UT[r], uh);
+					X[r] = sse41_lerp(ab, cd, VT[r], vh);
+				}
+			}
+			else
+			{
+				for (r = 0; r < nr; r++)
+					X[r] = S[0][0][r];
+			}
+
+			for (r = 0; r < nr; r++)
+			{
+				if (!sa && da)
+					X[r] = _mm_or_si128(X[r], aset);
+				if (ap)
+					X[r] = sse41_mul255(X[r], ca);
+				if (dn != sn)
+					X[r] = _mm_shuffle_epi8(X[r], g2);
+			}
+
+			if (sa)
+			{
+				Y = _mm_shuffle_epi8(X[0], yp[0]);
+				for (r = 1; r < nr; r++)
+					Y = _mm_or_si128(Y, _mm_shuffle_epi8(X[r], yp[r]));
+				M = _mm_andnot_si128(_mm_cvtepi16_epi32(_mm_cmpeq_epi16(Y, zero)), M);
+				for (r = 0; r < nr; r++)
+					T[r] = _mm_sub_epi16(c255, _mm_shuffle_epi8(X[r], yb));
+			}
+			else
+			{
+				Y = cy;
+				for (r = 0; r < nr; r++)
+					T[r] = ct;
+			}
+
+			/* Blend the new pixels into the destination; any that are
+			 * outside the image, or transparent, keep what was there. */
+			dst = sse41_load(dp, n4);
+			if (dbpp == 5)
+				dst_tail = _mm_cvtsi32_si128(load32(dp + 16));
+			out = zero;
+			for (r = 0; r < nr; r++)
+			{
+				if (sa || ap)
+				{
+					__m128i d = (r == 3 && dbpp == 5) ? _mm_alignr_epi8(dst_tail, dst, 15) : dst;
+					X[r] = _mm_add_epi16(X[r], sse41_mul255(_mm_shuffle_epi8(d, ld[r]), T[r]));
+				}
+				out = _mm_or_si128(out, _mm_shuffle_epi8(X[r], st[r]));
+			}
+			out = _mm_blendv_epi8(dst, out, _mm_shuffle_epi8(M, pm));
+			if (dbpp == 5)
+			{
+				out_tail = _mm_shuffle_epi8(X[3], st_tail);
+				out_tail = _mm_blendv_epi8(dst_tail, out_tail, _mm_shuffle_epi32(M, 0xff));
+			}
+			sse41_store(dp, out, n4);
+			if (dbpp == 5)
+				sse41_store(dp + 16, out_tail, 4);
+
+			if (hp)
+			{
+				__m128i h0 = _mm_cvtsi32_si128(load32(hp));
+				__m128i h = _mm_cvtepu8_epi16(h0);
+				h = _mm_add_epi16(Y, sse41_mul255(h, _mm_sub_epi16(c255, Y)));
+				h = _mm_packus_epi16(_mm_and_si128(h, c255), zero);
+				bm = _mm_shuffle_epi8(M, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+				sse41_store(hp, _mm_blendv_epi8(h0, h, bm), 4);
+			}
+		}
+
+		dp += 4 * dbpp;
+		if (hp)
+			hp += 4;
+		U = _mm_add_epi32(U, FA);
+		V = _mm_add_epi32(V, FB);
+	}
+
+	if (w)
+		tail(dp, da, sp, sw, sh, ss, sa, _mm_cvtsi128_si32(U), _mm_cvtsi128_si32(V), fa, fb, w, n, alpha, NULL, hp);
+}
+
+#define SSE41_AFFINE(NAME, LERP, SN, SA, DN, DA, AP) \
+static SSE41 void \
+sse41_##NAME(byte * restrict dp, int da, const byte * restrict sp, int sw, int sh, int ss, int sa, int u, int v, int fa, int fb, int w, int n, int alpha, const byte * restrict color, byte * restrict hp) \
+{ \
+	TRACK_FN(); \
+	sse41_affine(dp, sp, sw, sh, ss, u, v, fa, fb, w, n, alpha, hp, SN, SA, DN, DA, AP, LERP, NAME); \
+}
+
+/* The tables are indexed by da * 4 + sa * 2 + (alpha < 255). Nearest
+ * sampling at full alpha is mostly copying, which the templates do as
+ * quickly, so only the constant alpha versions of those are here. */
+#define SSE41_AFFINE_LERP(N, SN, DN) \
+	SSE41_AFFINE(paint_affine_lerp_##N, 1, SN, 0, DN, 0, 0) \
+	SSE41_AFFINE(paint_affine_lerp_alpha_##N, 1, SN, 0, DN, 0, 1) \
+	SSE41_AFFINE(paint_affine_lerp_sa_##N, 1, SN, 1, DN, 0, 0) \
+	SSE41_AFFINE(paint_affine_lerp_sa_alpha_##N, 1, SN, 1, DN, 0, 1) \
+	SSE41_AFFINE(paint_affine_lerp_da_##N, 1, SN, 0, DN, 1, 0) \
+	SSE41_AFFINE(paint_affine_lerp_da_alpha_##N, 1, SN, 0, DN, 1, 1) \
+	SSE41_AFFINE(paint_affine_lerp_da_sa_##N, 1, SN, 1, DN, 1, 0) \
+	SSE41_AFFINE(paint_affine_lerp_da_sa_alpha_##N, 1, SN, 1, DN, 1, 1) \
+	static paintfn_t * const sse41_paint_affine_lerp_##N##_fns[8] = { \
+		sse41_paint_affine_lerp_##N, sse41_paint_affine_lerp_alpha_##N, \
+		sse41_paint_affine_lerp_sa_##N, sse41_paint_affine_lerp_sa_alpha_##N, \
+		sse41_paint_affine_lerp_da_##N, sse41_paint_affine_lerp_da_alpha_##N, \
+		sse41_paint_affine_lerp_da_sa_##N, sse41_paint_affine_lerp_da_sa_alpha_##N \
+	};
+
+#define SSE41_AFFINE_NEAR(N, SN, DN) \
+	SSE41_AFFINE(paint_affine_near_alpha_##N, 0, SN, 0, DN, 0, 1) \
+	SSE41_AFFINE(paint_affine_near_sa_alpha_##N, 0, SN, 1, DN, 0, 1) \
+	SSE41_AFFINE(paint_affine_near_da_alpha_##N, 0, SN, 0, DN, 1, 1) \
+	SSE41_AFFINE(paint_affine_near_da_sa_alpha_##N, 0, SN, 1, DN, 1, 1) \
+	static paintfn_t * const sse41_paint_affine_near_##N##_fns[8] = { \
+		NULL, sse41_paint_affine_near_alpha_##N, \
+		NULL, sse41_paint_affine_near_sa_alpha_##N, \
+		NULL, sse41_paint_affine_near_da_alpha_##N, \
+		NULL, sse41_paint_affine_near_da_sa_alpha_##N \
+	};
+
+#if FZ_PLOTTERS_G
+SSE41_AFFINE_LERP(1, 1, 1)
+SSE41_AFFINE_NEAR(1, 1, 1)
+#endif /* FZ_PLOTTERS_G */
+
+#if FZ_PLOTTERS_RGB
+SSE41_AFFINE_LERP(3, 3, 3)
+SSE41_AFFINE_NEAR(3, 3, 3)
+
+/* The C lerp painters for gray to rgb put _alpha last. */
+SSE41_AFFINE(paint_affine_lerp_g2rgb, 1, 1, 0, 3, 0, 0)
+SSE41_AFFINE(paint_affine_lerp_g2rgb_alpha, 1, 1, 0, 3, 0, 1)
+SSE41_AFFINE(paint_affine_lerp_sa_g2rgb, 1, 1, 1, 3, 0, 0)
+SSE41_AFFINE(paint_affine_lerp_sa_g2rgb_alpha, 1, 1, 1, 3, 0, 1)
+SSE41_AFFINE(paint_affine_lerp_da_g2rgb, 1, 1, 0, 3, 1, 0)
+SSE41_AFFINE(paint_affine_lerp_da_g2rgb_alpha, 1, 1, 0, 3, 1, 1)
+SSE41_AFFINE(paint_affine_lerp_da_sa_g2rgb, 1, 1, 1, 3, 1, 0)
+SSE41_AFFINE(paint_affine_lerp_da_sa_g2rgb_alpha, 1, 1, 1, 3, 1, 1)
+
+static paintfn_t * const sse41_paint_affine_lerp_g2rgb_fns[8] = {
+	sse41_paint_affine_lerp_g2rgb, sse41_paint_affine_lerp_g2rgb_alpha, sse41_paint_affine_lerp_sa_g2rgb, sse41_paint_affine_lerp_sa_g2rgb_alpha,
+	sse41_paint_affine_lerp_da_g2rgb, sse41_paint_affine_lerp_da_g2rgb_alpha, sse41_paint_affine_lerp_da_sa_g2rgb, sse41_paint_affine_lerp_da_sa_g2rgb_alpha
+};
+
+SSE41_AFFINE_NEAR(g2rgb, 1, 3)
+#endif /* FZ_PLOTTERS_RGB */
+
+#if FZ_PLOTTERS_CMYK
+SSE41_AFFINE_LERP(4, 4, 4)
+SSE41_AFFINE_NEAR(4, 4, 4)
+#endif /* FZ_PLOTTERS_CMYK */
+
+/* Pick an SSE4.1 painter for an sn component image drawn to an n
+ * component destination, or NULL to use the C ones. */
+static paintfn_t *
+sse41_paint_affine(int da, int sa, int fa, int fb, int n, int sn, int alpha, int lerp)
+{
+	paintfn_t * const *fns = NULL;
+
+	if (alpha <= 0 || !have_sse41())
+		return NULL;
+
+#if FZ_PLOTTERS_RGB
+	if (n == 3 && sn == 1)
+		fns = lerp ? sse41_paint_affine_lerp_g2rgb_fns : sse41_paint_affine_near_g2rgb_fns;
+#endif /* FZ_PLOTTERS_RGB */
+	if (sn == n)
+	{
+		switch (n)
+		{
+#if FZ_PLOTTERS_G
+		case 1: fns = lerp ? sse41_paint_affine_lerp_1_fns : sse41_paint_affine_near_1_fns; break;
+#endif /* FZ_PLOTTERS_G */
+#if FZ_PLOTTERS_RGB
+		case 3: fns = lerp ? sse41_paint_affine_lerp_3_fns : sse41_paint_affine_near_3_fns; break;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+		case 4: fns = lerp ? sse41_paint_affine_lerp_4_fns : sse41_paint_affine_near_4_fns; break;
+#endif /* FZ_PLOTTERS_CMYK */
+		}
+	}
+	if (!fns)
+		return NULL;
+	return fns[da * 4 + sa * 2 + (alpha < 255)];
+}
+
+#endif /* HAVE_SSE41_AFFINE */
+
 /* RJW: The following code was originally written to be sensitive to
  * FLT_EPSILON. Given the way the 'minimum representable difference'
  * between 2 floats changes size as we scale, we now pick a larger
@@ -3320,6 +3893,15 @@ fz_paint_image_imp(fz_pixmap * restrict dst, const fz_irect *scissor, const fz_p
 		}
 	}
 
+#ifdef HAVE_SSE41_AFFINE
+	if (!color)
+	{
+		paintfn_t *fast = sse41_paint_affine(da, sa, fa, fb, n, img->n - sa, alpha, dolerp);
+		if (fast)
+			paintfn = fast;
+	}
+#endif /* HAVE_SSE41_AFFINE */
+
 	assert(paintfn);
 	if (paintfn == NULL)
 		return;
@@ -333,6 +333,11 @@ fz_draw_fill_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 		fz_knockout_end(ctx, dev);
 }
 
+/* Strokes up to this wide (in pixels) are drawn as hairlines. */
+#ifndef HAIRLINE_MAX_WIDTH
+#define HAIRLINE_MAX_WIDTH 1.0f
+#endif
+
 static void
 fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *in_ctm,
 	fz_colorspace *colorspace, const float *color, float alpha)
@@ -348,10 +353,11 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 	float colorfv[FZ_MAX_COLORS];
 	fz_irect bbox;
 	int i, n;
-	float aa_level = 2.0f/(fz_graphics_aa_level(ctx)+2);
+	float aa_level = 2.0f/(fz_mini(fz_graphics_aa_level(ctx), 8)+2);
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
 	float mlw = fz_graphics_min_line_width(ctx);
+	int hairline;
 
 	if (colorspace == NULL && model != NULL)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "color destination requires source color");
@@ -363,14 +369,27 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 	if (flatness < 0.001f)
 		flatness = 0.001f;
 
-	fz_reset_gel(ctx, gel, &state->scissor);
-	if (stroke->dash_len > 0)
-		fz_flatten_dash_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
+	/* Thin strokes are drawn directly, without the gel. This is only
+	 * worth it (and only looks right) with full antialiasing. */
+	hairline = linewidth * fz_matrix_max_expansion(&ctm) <= HAIRLINE_MAX_WIDTH &&
+		fz_graphics_aa_level(ctx) >= 8;
+
+	if (hairline)
+	{
+		fz_pixmap_bbox(ctx, state->dest, &bbox);
+		fz_intersect_irect(&bbox, &state->scissor);
+	}
 	else
-		fz_flatten_stroke_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
-	fz_sort_gel(ctx, gel);
+	{
+		fz_reset_gel(ctx, gel, &state->scissor);
+		if (stroke->dash_len > 0)
+			fz_flatten_dash_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
+		else
+			fz_flatten_stroke_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
+		fz_sort_gel(ctx, gel);
 
-	fz_intersect_irect(fz_bound_gel(ctx, gel, &bbox), &state->scissor);
+		fz_intersect_irect(fz_bound_gel(ctx, gel, &bbox), &state->scissor);
+	}
 
 	if (fz_is_empty_irect(&bbox))
 		return;
@@ -396,18 +415,30 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 		fz_dump_blend(ctx, state->shape, "/");
 	printf("\n");
 #endif
-	fz_scan_convert(ctx, gel, 0, &bbox, state->dest, colorbv);
-	if (state->shape)
+	if (hairline)
 	{
-		fz_reset_gel(ctx, gel, &state->scissor);
-		if (stroke->dash_len > 0)
-			fz_flatten_dash_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
-		else
-			fz_flatten_stroke_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
-		fz_sort_gel(ctx, gel);
+		fz_stroke_hairline_path(ctx, path, stroke, &ctm, flatness, linewidth, &bbox, state->dest, colorbv);
+		if (state->shape)
+		{
+			colorbv[0] = 255;
+			fz_stroke_hairline_path(ctx, path, stroke, &ctm, flatness, linewidth, &bbox, state->shape, colorbv);
+		}
+	}
+	else
+	{
+		fz_scan_convert(ctx, gel, 0, &bbox, state->dest, colorbv);
+		if (state->shape)
+		{
+			fz_reset_gel(ctx, gel, &state->scissor);
+			if (stroke->dash_len > 0)
+				fz_flatten_dash_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
+			else
+				fz_flatten_stroke_path(ctx, gel, path, stroke, &ctm, flatness, linewidth);
+			fz_sort_gel(ctx, gel);
 
-		colorbv[0] = 255;
-		fz_scan_convert(ctx, gel, 0, &bbox, state->shape, colorbv);
+			colorbv[0] = 255;
+			fz_scan_convert(ctx, gel, 0, &bbox, state->shape, colorbv);
+		}
 	}
 #ifdef DUMP_GROUP_BLENDS
 	dump_spaces(dev->top, "");
@@ -503,7 +534,7 @@ fz_draw_clip_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path,
 	fz_irect bbox;
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model;
-	float aa_level = 2.0f/(fz_graphics_aa_level(ctx)+2);
+	float aa_level = 2.0f/(fz_mini(fz_graphics_aa_level(ctx), 8)+2);
 	float mlw = fz_graphics_min_line_width(ctx);
 
 	if (mlw > aa_level)
@@ -1915,6 +1946,10 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 		fz_knockout_end(ctx, dev);
 }
 
+/* How far (in pixels) from a whole number of pixels away from where it
+ * was drawn a cached tile may be reused. */
+#define TILE_PHASE_TOLERANCE (1/256.0f)
+
 typedef struct
 {
 	int refs;
@@ -1927,6 +1962,7 @@ typedef struct
 	fz_storable storable;
 	fz_pixmap *dest;
 	fz_pixmap *shape;
+	float e, f; /* translation of the ctm the tile was drawn with */
 } tile_record;
 
 static int
@@ -1997,12 +2033,14 @@ fz_drop_tile_record(fz_context *ctx, tile_record *tile)
 }
 
 static tile_record *
-fz_new_tile_record(fz_context *ctx, fz_pixmap *dest, fz_pixmap *shape)
+fz_new_tile_record(fz_context *ctx, fz_pixmap *dest, fz_pixmap *shape, const fz_matrix *ctm)
 {
 	tile_record *tile = fz_malloc_struct(ctx, tile_record);
 	FZ_INIT_STORABLE(tile, 1, fz_drop_tile_record_imp);
 	tile->dest = fz_keep_pixmap(ctx, dest);
 	tile->shape = fz_keep_pixmap(ctx, shape);
+	tile->e = ctm->e;
+	tile->f = ctm->f;
 	return tile;
 }
 
@@ -2055,14 +2093,35 @@ fz_draw_begin_tile(fz_context *ctx, fz_device *devp, const fz_rect *area, const
 		tk.id = id;
 
 		tile = fz_find_item(ctx, fz_drop_tile_record_imp, &tk, &fz_tile_store_type);
+
+		/* Tiles are found regardless of where they were drawn. One
+		 * drawn a whole number of pixels away from here has the same
+		 * pixels as ours would, just moved, so check for that and
+		 * that it suits our destination. If not, draw it afresh. */
+		if (tile)
+		{
+			float dx = ctm.e - tile->e;
+			float dy = ctm.f - tile->f;
+			int ix = (int)floorf(dx + 0.5f);
+			int iy = (int)floorf(dy + 0.5f);
+			if (fabsf(dx - ix) > TILE_PHASE_TOLERANCE || fabsf(dy - iy) > TILE_PHASE_TOLERANCE ||
+				tile->dest->x + ix != bbox.x0 || tile->dest->y + iy != bbox.y0 ||
+				tile->dest->w != bbox.x1 - bbox.x0 || tile->dest->h != bbox.y1 - bbox.y0 ||
+				tile->dest->colorspace != model || (state[0].shape && !tile->shape))
+			{
+				fz_drop_tile_record(ctx, tile);
+				tile = NULL;
+			}
+		}
+
 		if (tile)
 		{
 			state[1].dest = fz_keep_pixmap(ctx, tile->dest);
-			state[1].shape = fz_keep_pixmap(ctx, tile->shape);
+			state[1].shape = state[0].shape ? fz_keep_pixmap(ctx, tile->shape) : NULL;
 			state[1].blendmode |= FZ_BLEND_ISOLATED;
 			state[1].xstep = xstep;
 			state[1].ystep = ystep;
-			state[1].id = id;
+			state[1].id = 0; /* already in the store */
 			fz_irect_from_rect(&state[1].area, area);
 			state[1].ctm = ctm;
 #ifdef DUMP_GROUP_BLENDS
@@ -2118,6 +2177,7 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 	fz_draw_state *state;
 	tile_record *tile;
 	tile_key *key;
+	int dest_x, dest_y;
 
 	if (dev->top == 0)
 	{
@@ -2138,10 +2198,12 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 	fz_transform_rect(fz_expand_rect(&scissor_tmp, 1), fz_invert_matrix(&ttm, &ctm));
 	fz_intersect_irect(&area, fz_irect_from_rect(&scissor, &scissor_tmp));
 
-	tile_bbox.x0 = state[1].dest->x;
-	tile_bbox.y0 = state[1].dest->y;
-	tile_bbox.x1 = state[1].dest->w + tile_bbox.x0;
-	tile_bbox.y1 = state[1].dest->h + tile_bbox.y0;
+	/* A cached tile may have been drawn elsewhere, so work from where
+	 * it lands now (the scissor set by begin_tile) rather than from its
+	 * pixmap's origin, and put that back afterwards. */
+	tile_bbox = state[1].scissor;
+	dest_x = state[1].dest->x;
+	dest_y = state[1].dest->y;
 	fz_rect_from_irect(&tile_tmp, &tile_bbox);
 	fz_transform_rect(fz_expand_rect(&tile_tmp, 1), &ttm);
 
@@ -2162,14 +2224,9 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 	x1 = ceilf((area.x1 - tile_tmp.x0 + extra_x) / xstep);
 	y1 = ceilf((area.y1 - tile_tmp.y0 + extra_y) / ystep);
 
-	ctm.e = state[1].dest->x;
-	ctm.f = state[1].dest->y;
-	if (state[1].shape)
-	{
-		shapectm = ctm;
-		shapectm.e = state[1].shape->x;
-		shapectm.f = state[1].shape->y;
-	}
+	ctm.e = tile_bbox.x0;
+	ctm.f = tile_bbox.y0;
+	shapectm = ctm;
 
 #ifdef DUMP_GROUP_BLENDS
 	dump_spaces(dev->top, "");
@@ -2206,51 +2263,55 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 		}
 	}
 
-	state[1].dest->x = ctm.e;
-	state[1].dest->y = ctm.f;
+	state[1].dest->x = dest_x;
+	state[1].dest->y = dest_y;
 	if (state[1].shape)
 	{
-		state[1].shape->x = shapectm.e;
-		state[1].shape->y = shapectm.f;
+		state[1].shape->x = dest_x;
+		state[1].shape->y = dest_y;
 	}
 
 	/* Now we try to cache the tiles. Any failure here will just result
-	 * in us not caching. */
-	tile = NULL;
-	key = NULL;
-	fz_var(tile);
-	fz_var(key);
-	fz_try(ctx)
-	{
-		tile_record *existing_tile;
-
-		tile = fz_new_tile_record(ctx, state[1].dest, state[1].shape);
-
-		key = fz_malloc_struct(ctx, tile_key);
-		key->refs = 1;
-		key->id = state[1].id;
-		key->ctm[0] = ctm.a;
-		key->ctm[1] = ctm.b;
-		key->ctm[2] = ctm.c;
-		key->ctm[3] = ctm.d;
-		existing_tile = fz_store_item(ctx, key, tile, fz_tile_size(ctx, tile), &fz_tile_store_type);
-		if (existing_tile)
+	 * in us not caching. Tiles without an id can never be found again,
+	 * so there is no point caching those. */
+	if (state[1].id)
+	{
+		tile = NULL;
+		key = NULL;
+		fz_var(tile);
+		fz_var(key);
+		fz_try(ctx)
+		{
+			tile_record *existing_tile;
+
+			tile = fz_new_tile_record(ctx, state[1].dest, state[1].shape, &state[1].ctm);
+
+			key = fz_malloc_struct(ctx, tile_key);
+			key->refs = 1;
+			key->id = state[1].id;
+			key->ctm[0] = ctm.a;
+			key->ctm[1] = ctm.b;
+			key->ctm[2] = ctm.c;
+			key->ctm[3] = ctm.d;
+			existing_tile = fz_store_item(ctx, key, tile, fz_tile_size(ctx, tile), &fz_tile_store_type);
+			if (existing_tile)
+			{
+				/* We already have a tile. This will either have been
+				 * produced by a racing thread, or there is already
+				 * an entry for this one in the store. */
+				fz_drop_tile_record(ctx, tile);
+				tile = existing_tile;
+			}
+		}
+		fz_always(ctx)
 		{
-			/* We already have a tile. This will either have been
-			 * produced by a racing thread, or there is already
-			 * an entry for this one in the store. */
+			fz_drop_tile_key(ctx, key);
 			fz_drop_tile_record(ctx, tile);
-			tile = existing_tile;
 		}
-	}
-	fz_always(ctx)
-	{
-		fz_drop_tile_key(ctx, key);
-		fz_drop_tile_record(ctx, tile);
-	}
-	fz_catch(ctx)
-	{
-		/* Do nothing */
+		fz_catch(ctx)
+		{
+			/* Do nothing */
+		}
 	}
 
 	/* The following tests should not be required, but just occasionally
@@ -13,9 +13,15 @@ static inline int fz_idiv(int a, int b)
 /* If AA_BITS is defined, then we assume constant N bits of antialiasing. We
  * will attempt to provide at least that number of bits of accuracy in the
  * antialiasing (to a maximum of 8). If it is defined to be 0 then no
- * antialiasing is done. If it is undefined to we will leave the antialiasing
- * accuracy as a run time choice.
+ * antialiasing is done. If it is defined to be 9 or more, then graphics are
+ * antialiased with analytic coverage (see fz_scan_convert_analytic). If it is
+ * undefined to we will leave the antialiasing accuracy as a run time choice.
  */
+
+/* With analytic coverage, edges are kept on a grid this fine rather than
+ * on the sub-sample grid. */
+#define ANALYTIC_SCALE 256
+
 struct fz_aa_context_s
 {
 	int hscale;
@@ -66,7 +72,14 @@ void fz_drop_aa_context(fz_context *ctx)
 
 #define fz_aa_scale 0
 
-#if AA_BITS > 6
+#if AA_BITS > 8
+#define AA_SCALE(s, x) (x)
+#define fz_aa_hscale ANALYTIC_SCALE
+#define fz_aa_vscale ANALYTIC_SCALE
+#define fz_aa_bits 9
+#define fz_aa_text_bits 8
+
+#elif AA_BITS > 6
 #define AA_SCALE(s, x) (x)
 #define fz_aa_hscale 17
 #define fz_aa_vscale 15
@@ -126,7 +139,13 @@ fz_text_aa_level(fz_context *ctx)
 static void
 set_gfx_level(fz_context *ctx, int level)
 {
-	if (level > 6)
+	if (level > 8)
+	{
+		fz_aa_hscale = ANALYTIC_SCALE;
+		fz_aa_vscale = ANALYTIC_SCALE;
+		fz_aa_bits = 9;
+	}
+	else if (level > 6)
 	{
 		fz_aa_hscale = 17;
 		fz_aa_vscale = 15;
@@ -242,6 +261,25 @@ struct fz_edge_s
 	int xdir, ydir; /* -1 or +1 */
 };
 
+/* The line through an edge, for analytic coverage: x (in pixels, from
+ * the left of the bbox) at the top of the edge, and its change per step
+ * in y. prev and next are the edges that it carries on from and into
+ * (or -1). sign and y0, y1 are the run of bands for which it starts (1)
+ * or ends (-1) a span, whose coverage is yet to be added. */
+typedef struct
+{
+	float x, slope;
+	int prev, next;
+	int sign, y0, y1;
+} fz_analytic_line;
+
+/* An active edge, as sorted within a band */
+typedef struct
+{
+	float x0, x1;
+	int dir;
+} fz_analytic_span;
+
 struct fz_gel_s
 {
 	fz_rect clip;
@@ -250,6 +288,10 @@ struct fz_gel_s
 	fz_edge *edges;
 	int acap, alen;
 	fz_edge **active;
+	/* For analytic coverage; kept to save allocating them per path */
+	int lcap, scap;
+	fz_analytic_line *lines;
+	fz_analytic_span *spans;
 };
 
 #ifdef DUMP_GELS
@@ -312,8 +354,10 @@ fz_reset_gel(fz_context *ctx, fz_gel *gel, const fz_irect *clip)
 
 	if (fz_is_infinite_irect(clip))
 	{
-		gel->clip.x0 = gel->clip.y0 = BBOX_MIN;
-		gel->clip.x1 = gel->clip.y1 = BBOX_MAX;
+		gel->clip.x0 = BBOX_MIN * hscale;
+		gel->clip.y0 = BBOX_MIN * vscale;
+		gel->clip.x1 = BBOX_MAX * hscale;
+		gel->clip.y1 = BBOX_MAX * vscale;
 	}
 	else {
 		gel->clip.x0 = clip->x0 * hscale;
@@ -322,8 +366,10 @@ fz_reset_gel(fz_context *ctx, fz_gel *gel, const fz_irect *clip)
 		gel->clip.y1 = clip->y1 * vscale;
 	}
 
-	gel->bbox.x0 = gel->bbox.y0 = BBOX_MAX;
-	gel->bbox.x1 = gel->bbox.y1 = BBOX_MIN;
+	gel->bbox.x0 = BBOX_MAX * hscale;
+	gel->bbox.y0 = BBOX_MAX * vscale;
+	gel->bbox.x1 = BBOX_MIN * hscale;
+	gel->bbox.y1 = BBOX_MIN * vscale;
 
 	gel->len = 0;
 	gel->alen = 0;
@@ -334,6 +380,8 @@ fz_drop_gel(fz_context *ctx, fz_gel *gel)
 {
 	if (gel == NULL)
 		return;
+	fz_free(ctx, gel->spans);
+	fz_free(ctx, gel->lines);
 	fz_free(ctx, gel->active);
 	fz_free(ctx, gel->edges);
 	fz_free(ctx, gel);
@@ -1043,6 +1091,454 @@ clip_ended:
 	fz_free(ctx, alphas);
 }
 
+/*
+ * Analytic coverage scan conversion.
+ *
+ * Rather than sampling each pixel on a grid, we work out the exact area
+ * of it that is covered. Each scanline is cut into bands at the ends of
+ * the edges crossing it, so that in a band every edge runs from its top
+ * to its bottom. If no edges cross in a band, the edges sorted by x
+ * bound trapezoids, and the winding rule tells us which of those are
+ * inside. Each span of inside trapezoids adds the height of the band to
+ * the pixels right of its left edge, and takes it away again right of
+ * its right edge, in proportion to the area of each pixel involved.
+ * Summing along the scanline then gives the area covered for every
+ * pixel. See Raph Levien's font-rs for the accumulation.
+ *
+ * Where an edge carries on into another in the same direction (as along
+ * a curve), the two are taken as one, and the band is not cut there. An
+ * edge usually starts (or ends) a span for as long as it crosses the
+ * scanline, so its area is added once for all the bands.
+ *
+ * Bands in which edges cross are split until they are ANALYTIC_MIN_BAND
+ * high, and then taken as if the edges did not cross (the order is that
+ * in the middle of the band). Bands are never made thinner than that
+ * either, so that a scanline with many edge ends stays bounded in cost;
+ * an edge then counts in a band if it crosses the middle of it. At a
+ * 64th of a pixel this loses less than the sub-sample grid of 8 bits
+ * does.
+ *
+ * Edges are kept on an ANALYTIC_SCALE grid, so apart from the thin
+ * bands, the coverage is exact to within that.
+ */
+
+#define ANALYTIC_MIN_BAND (ANALYTIC_SCALE / 64)
+
+/* Add the area right of an edge running from x0 to x1 (in pixels,
+ * relative to the start of acc) across a band of height d (signed),
+ * and widen [*lo, *hi] to the entries touched. */
+static inline void
+add_edge_analytic(float * restrict acc, float x0, float x1, float d, int *lo, int *hi)
+{
+	int x0i, x1i, x;
+	float s, x0f, x1f, a0, a1, am;
+
+	if (x0 > x1)
+	{
+		s = x0; x0 = x1; x1 = s;
+	}
+
+	/* x0 >= 0, so truncating is flooring */
+	x0i = (int)x0;
+	x1i = (int)ceilf(x1);
+	if (x0i < *lo)
+		*lo = x0i;
+
+	if (x1i <= x0i + 1)
+	{
+		/* Within one pixel: the area right of the edge is that right
+		 * of its midpoint. */
+		float xm = 0.5f * (x0 + x1) - x0i;
+		acc[x0i] += d - d * xm;
+		acc[x0i + 1] += d * xm;
+		if (x0i + 1 > *hi)
+			*hi = x0i + 1;
+		return;
+	}
+
+	/* Across several pixels: a triangle in the first and the last, and
+	 * an equal share of d in each one between. */
+	s = 1 / (x1 - x0);
+	x0f = x0 - x0i;
+	a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+	x1f = x1 - x1i + 1;
+	am = 0.5f * s * x1f * x1f;
+	acc[x0i] += d * a0;
+	if (x1i == x0i + 2)
+		acc[x0i + 1] += d * (1 - a0 - am);
+	else
+	{
+		a1 = s * (1.5f - x0f);
+		acc[x0i + 1] += d * (a1 - a0);
+		for (x = x0i + 2; x < x1i - 1; x++)
+			acc[x] += d * s;
+		acc[x1i - 1] += d * (1 - a1 - (x1i - x0i - 3) * s - am);
+	}
+	acc[x1i] += d * am;
+	if (x1i > *hi)
+		*hi = x1i;
+}
+
+static inline float
+line_x_analytic(fz_gel *gel, fz_analytic_line *lines, int k, int y)
+{
+	return lines[k].x + lines[k].slope * (y - gel->edges[k].y);
+}
+
+/* The x at y of the path through edge k, following it on into the edges
+ * above or below. */
+static inline float
+path_x_analytic(fz_gel *gel, fz_analytic_line *lines, int k, int y)
+{
+	while (y < gel->edges[k].y && lines[k].prev >= 0)
+		k = lines[k].prev;
+	while (y > gel->edges[k].y + gel->edges[k].h && lines[k].next >= 0)
+		k = lines[k].next;
+	return line_x_analytic(gel, lines, k, y);
+}
+
+static inline void
+flush_run_analytic(float *acc, fz_gel *gel, fz_analytic_line *lines, int k, float ys, int w, int *lo, int *hi)
+{
+	fz_analytic_line *l = &lines[k];
+
+	if (l->sign)
+		add_edge_analytic(acc,
+			fz_clamp(line_x_analytic(gel, lines, k, l->y0), 0, w),
+			fz_clamp(line_x_analytic(gel, lines, k, l->y1), 0, w),
+			l->sign * (l->y1 - l->y0) * ys, lo, hi);
+	l->sign = 0;
+}
+
+/* Edge k starts (1) or ends (-1) a span, or neither (0), between y0 and
+ * y1. */
+static inline void
+run_analytic(float *acc, fz_gel *gel, fz_analytic_line *lines, int k, int sign, int y0, int y1, float ys, int w, int *lo, int *hi)
+{
+	fz_edge *edge = &gel->edges[k];
+	fz_analytic_line *l = &lines[k];
+
+	y0 = fz_maxi(y0, edge->y);
+	y1 = fz_mini(y1, edge->y + edge->h);
+	if (sign != l->sign || l->y1 != y0)
+	{
+		flush_run_analytic(acc, gel, lines, k, ys, w, lo, hi);
+		l->sign = sign;
+		l->y0 = y0;
+	}
+	l->y1 = y1;
+}
+
+/* Find which edges start or end spans in the band from y0 to y1. The
+ * active list is left sorted by x, so that it is nearly sorted already
+ * for the next band. */
+static void
+band_analytic(fz_gel *gel, fz_analytic_line *lines, fz_analytic_span *spans, float *acc, int y0, int y1, int eofill, float ys, int w, int *lo, int *hi)
+{
+	fz_analytic_span t;
+	fz_edge *edge, *te;
+	int i, k, m, n = gel->alen;
+	int winding, sign;
+
+	for (i = 0; i < n; i++)
+	{
+		edge = gel->active[i];
+		k = edge - gel->edges;
+		/* Does it (or the path it is on) cross the middle of the band? */
+		if (2 * edge->y <= y0 + y1 && 2 * (edge->y + edge->h) > y0 + y1)
+		{
+			spans[i].x0 = path_x_analytic(gel, lines, k, y0);
+			spans[i].x1 = path_x_analytic(gel, lines, k, y1);
+			spans[i].dir = edge->ydir;
+		}
+		else
+		{
+			spans[i].x0 = spans[i].x1 = line_x_analytic(gel, lines, k, edge->y);
+			spans[i].dir = 0;
+		}
+	}
+
+	/* insertion sort by x in the middle of the band */
+	for (i = 1; i < n; i++)
+	{
+		t = spans[i];
+		te = gel->active[i];
+		k = i - 1;
+		while (k >= 0 && spans[k].x0 + spans[k].x1 > t.x0 + t.x1)
+		{
+			spans[k + 1] = spans[k];
+			gel->active[k + 1] = gel->active[k];
+			k--;
+		}
+		spans[k + 1] = t;
+		gel->active[k + 1] = te;
+	}
+
+	if (y1 - y0 > ANALYTIC_MIN_BAND)
+	{
+		float x0 = -1, x1 = -1;
+		for (i = 0; i < n; i++)
+		{
+			if (!spans[i].dir)
+				continue;
+			if (spans[i].x0 < x0 - 1.0f / ANALYTIC_SCALE || spans[i].x1 < x1 - 1.0f / ANALYTIC_SCALE)
+			{
+				int ym = (y0 + y1) >> 1;
+				band_analytic(gel, lines, spans, acc, y0, ym, eofill, ys, w, lo, hi);
+				band_analytic(gel, lines, spans, acc, ym, y1, eofill, ys, w, lo, hi);
+				return;
+			}
+			x0 = spans[i].x0;
+			x1 = spans[i].x1;
+		}
+	}
+
+	winding = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (!spans[i].dir)
+			continue;
+		if (eofill)
+		{
+			sign = winding ? -1 : 1;
+			winding = !winding;
+		}
+		else
+		{
+			sign = winding ? 0 : 1;
+			winding += spans[i].dir;
+			if (!winding)
+				sign = -1;
+		}
+		k = gel->active[i] - gel->edges;
+		run_analytic(acc, gel, lines, k, sign, y0, y1, ys, w, lo, hi);
+		for (m = lines[k].prev; m >= 0 && gel->edges[m].y + gel->edges[m].h > y0; m = lines[m].prev)
+			run_analytic(acc, gel, lines, m, sign, y0, y1, ys, w, lo, hi);
+		for (m = lines[k].next; m >= 0 && gel->edges[m].y < y1; m = lines[m].next)
+			run_analytic(acc, gel, lines, m, sign, y0, y1, ys, w, lo, hi);
+	}
+}
+
+/* Sum acc[lo..hi] into alphas, and clear it ready for the next
+ * scanline. */
+static inline void
+undelta_analytic(float * restrict acc, unsigned char * restrict alphas, int lo, int hi)
+{
+	float sum = 0;
+	float c;
+	int x;
+
+	for (x = lo; x <= hi; x++)
+	{
+		sum += acc[x];
+		acc[x] = 0;
+		c = fz_clamp(sum, 0, 1);
+		alphas[x] = (unsigned char)(c * 255 + 0.5f);
+	}
+}
+
+/* Join each edge to the one carrying on from its bottom end in the same
+ * direction, if there is one. */
+static void
+join_edges_analytic(fz_gel *gel, fz_analytic_line *lines)
+{
+	fz_edge *edge;
+	int i, k, l, r, y, x;
+
+	for (i = 0; i < gel->len; i++)
+	{
+		edge = &gel->edges[i];
+		y = edge->y + edge->h;
+		x = edge->x + edge->xmove * edge->h + edge->xdir * edge->adj_up;
+
+		/* the edges are sorted by y, so find the first starting at y */
+		l = 0;
+		r = gel->len;
+		while (l < r)
+		{
+			k = (l + r) >> 1;
+			if (gel->edges[k].y < y)
+				l = k + 1;
+			else
+				r = k;
+		}
+		for (k = l; k < gel->len && gel->edges[k].y == y; k++)
+		{
+			if (lines[k].prev < 0 && gel->edges[k].x == x && gel->edges[k].ydir == edge->ydir)
+			{
+				lines[i].next = k;
+				lines[k].prev = i;
+				break;
+			}
+		}
+	}
+}
+
+static void
+fz_scan_convert_analytic(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *clip, fz_pixmap *dst, unsigned char *color, void *painter)
+{
+	unsigned char *alphas;
+	float *acc;
+	fz_analytic_line *lines;
+	fz_analytic_span *spans;
+	fz_edge *edge;
+	int y, e, i, k, n;
+	int top, bot, y0, y1, run, end;
+	int lo, hi, x0, x1;
+	const int hscale = fz_aa_hscale;
+	const int vscale = fz_aa_vscale;
+	const float xs = 1.0f / hscale;
+	const float ys = 1.0f / vscale;
+
+	int xmin = fz_idiv(gel->bbox.x0, hscale);
+	int xmax = fz_idiv(gel->bbox.x1, hscale) + 1;
+	int xofs = xmin * hscale;
+	int w = xmax - xmin;
+
+	if (gel->len == 0)
+		return;
+
+	assert(clip->x0 >= xmin);
+	assert(clip->x1 <= xmax);
+
+	alphas = fz_malloc_no_throw(ctx, w + 2);
+	acc = fz_malloc_no_throw(ctx, (w + 2) * sizeof(float));
+	if (alphas == NULL || acc == NULL)
+	{
+		fz_free(ctx, alphas);
+		fz_free(ctx, acc);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "scan conversion failed (malloc failure)");
+	}
+	memset(acc, 0, (w + 2) * sizeof(float));
+
+	gel->alen = 0;
+	e = 0;
+	y = fz_maxi(fz_idiv(gel->edges[0].y, vscale), clip->y0);
+
+	fz_try(ctx)
+	{
+		if (gel->lcap < gel->len)
+		{
+			gel->lines = fz_resize_array(ctx, gel->lines, gel->cap, sizeof(fz_analytic_line));
+			gel->lcap = gel->cap;
+		}
+		if (gel->scap < gel->acap)
+		{
+			gel->spans = fz_resize_array(ctx, gel->spans, gel->acap, sizeof(fz_analytic_span));
+			gel->scap = gel->acap;
+		}
+		lines = gel->lines;
+		spans = gel->spans;
+		for (i = 0; i < gel->len; i++)
+		{
+			edge = &gel->edges[i];
+			lines[i].x = (edge->x - xofs) * xs;
+			lines[i].slope = (float)(edge->xmove * edge->h + edge->xdir * edge->adj_up) / edge->h * xs;
+			lines[i].prev = lines[i].next = -1;
+			lines[i].sign = 0;
+		}
+		join_edges_analytic(gel, lines);
+
+		while (y < clip->y1)
+		{
+			top = y * vscale;
+			bot = top + vscale;
+
+			/* Add the edges that start before the end of this
+			 * scanline, and drop those that ended before it. The
+			 * order of the others is kept. */
+			while (e < gel->len && gel->edges[e].y < bot)
+			{
+				edge = &gel->edges[e++];
+				if (edge->y + edge->h <= top)
+					continue;
+				if (gel->alen + 1 == gel->acap)
+				{
+					int newcap = gel->acap + 64;
+					gel->active = fz_resize_array(ctx, gel->active, newcap, sizeof(fz_edge*));
+					gel->acap = newcap;
+					gel->spans = spans = fz_resize_array(ctx, spans, newcap, sizeof(fz_analytic_span));
+					gel->scap = newcap;
+				}
+				gel->active[gel->alen++] = edge;
+			}
+			for (i = n = 0; i < gel->alen; i++)
+				if (gel->active[i]->y + gel->active[i]->h > top)
+					gel->active[n++] = gel->active[i];
+			gel->alen = n;
+
+			if (gel->alen == 0)
+			{
+				if (e == gel->len)
+					break;
+				y = fz_idiv(gel->edges[e].y, vscale);
+				continue;
+			}
+
+			/* If every edge is vertical and crosses the whole
+			 * scanline, the following scanlines are the same up to
+			 * where one of them ends or another one starts. */
+			end = e < gel->len ? fz_idiv(gel->edges[e].y, vscale) : clip->y1;
+			for (i = 0; i < gel->alen && end > y + 1; i++)
+			{
+				edge = gel->active[i];
+				if (edge->xmove == 0 && edge->adj_up == 0 && edge->y <= top && edge->y + edge->h >= bot)
+					end = fz_mini(end, fz_idiv(edge->y + edge->h, vscale));
+				else
+					end = y;
+			}
+			run = end > y + 1 ? fz_mini(end, clip->y1) - y : 1;
+
+			/* Cut the scanline into bands at the edge ends that do
+			 * not carry on into another edge. */
+			lo = w;
+			hi = 0;
+			for (y0 = top; y0 < bot; y0 = y1)
+			{
+				y1 = bot;
+				for (i = 0; i < gel->alen; i++)
+				{
+					edge = gel->active[i];
+					k = edge - gel->edges;
+					if (edge->y > y0 && edge->y < y1 && lines[k].prev < 0)
+						y1 = edge->y;
+					if (edge->y + edge->h > y0 && edge->y + edge->h < y1 && lines[k].next < 0)
+						y1 = edge->y + edge->h;
+				}
+				if (y1 - y0 < ANALYTIC_MIN_BAND)
+					y1 = fz_mini(y0 + ANALYTIC_MIN_BAND, bot);
+				band_analytic(gel, lines, spans, acc, y0, y1, eofill, ys, w, &lo, &hi);
+			}
+			for (i = 0; i < gel->alen; i++)
+				flush_run_analytic(acc, gel, lines, gel->active[i] - gel->edges, ys, w, &lo, &hi);
+
+			if (lo > hi)
+			{
+				y += run;
+				continue;
+			}
+			undelta_analytic(acc, alphas, lo, hi);
+
+			/* Paint the part of [lo, hi] within the clip */
+			x0 = fz_maxi(lo, clip->x0 - xmin);
+			x1 = fz_mini(hi + 1, clip->x1 - xmin);
+			if (x0 < x1)
+				for (n = 0; n < run; n++)
+					blit_aa(dst, xmin + x0, y + n, alphas + x0, x1 - x0, color, painter);
+			y += run;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, acc);
+		fz_free(ctx, alphas);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 /*
  * Sharp (not anti-aliased) scan conversion
  */
@@ -1170,7 +1666,10 @@ fz_scan_convert(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *clip,
 		assert(fn);
 		if (fn == NULL)
 			return;
-		fz_scan_convert_aa(ctx, gel, eofill, &local_clip, dst, color, fn);
+		if (fz_aa_bits > 8)
+			fz_scan_convert_analytic(ctx, gel, eofill, &local_clip, dst, color, fn);
+		else
+			fz_scan_convert_aa(ctx, gel, eofill, &local_clip, dst, color, fn);
 	}
 	else
 	{
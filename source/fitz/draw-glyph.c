@@ -309,31 +309,32 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 
 	fz_try(ctx)
 	{
+		/* We drop the glyphcache lock here, and render the glyph,
+		 * so that other threads can go on using the cache (and
+		 * rendering glyphs of their own) in the meantime. The
+		 * danger here is that some other thread will come along,
+		 * and want the same glyph too. If it does, we may both end
+		 * up rendering it. We cope with this later on, by ensuring
+		 * that only one gets inserted into the cache. If we insert
+		 * ours to find one already there, we abandon ours, and use
+		 * the one there already.
+		 */
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+		locked = 0;
 		if (is_ft_font)
 		{
 			val = fz_render_ft_glyph(ctx, font, gid, &subpix_ctm, key.aa);
 		}
 		else if (fz_font_t3_procs(ctx, font))
 		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, &subpix_ctm, model, scissor);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
 		}
 		else
 		{
 			fz_warn(ctx, "assert: uninitialized font structure");
 		}
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+		locked = 1;
 		if (val && do_cache)
 		{
 			if (val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
@@ -341,22 +342,20 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
 				caching = 1;
-				if (!is_ft_font)
+
+				/* Someone else might have rendered in the
+				 * meantime. */
+				entry = cache->entry[hash];
+				while (entry)
 				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
+					if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
+						fz_drop_glyph(ctx, val);
+						move_to_front(cache, entry);
+						val = fz_keep_glyph(ctx, entry->val);
+						goto unlock_and_return_val;
 					}
+					entry = entry->bucket_next;
 				}
 
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
@@ -23,6 +23,13 @@ void fz_flatten_fill_path(fz_context *ctx, fz_gel *gel, const fz_path *path, con
 void fz_flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 void fz_flatten_dash_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 
+/*
+	fz_stroke_hairline_path: Stroke a path that is no more than about
+	a pixel wide straight into dst (within clip), without going through
+	the gel. Joins and caps are approximated.
+*/
+void fz_stroke_hairline_path(fz_context *ctx, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth, const fz_irect *clip, fz_pixmap *dst, const unsigned char *colorbv);
+
 fz_irect *fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, const fz_irect *scissor, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 
 /*
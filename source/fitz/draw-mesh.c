@@ -3,6 +3,108 @@
 
 enum { MAXN = 2 + FZ_MAX_COLORS };
 
+/* Write w pixels, stepping the 16.16 fixed point colors c by dc. This
+ * is inlined with constant n and pa so that the loop over the
+ * components unrolls. */
+static inline void paint_span(unsigned char *restrict p, int *restrict c, const int *restrict dc, int w, int n, int pa)
+{
+	int k;
+
+	do
+	{
+		for (k = 0; k < n; k++)
+		{
+			*p++ = c[k]>>16;
+			c[k] += dc[k];
+		}
+		if (pa)
+			*p++ = 255;
+	}
+	while (--w);
+}
+
+#ifdef ARCH_X86_SSE2
+#include <emmintrin.h>
+
+/*
+SSE2 span painting. Each 32 bit lane holds the fixed point value of
+one output byte. Lanes for later pixels start off already stepped, so
+adding the steps gives exactly the same (wrapping) sums as the C loop,
+and the results are bit-identical.
+*/
+
+/* The output bytes for 4 vectors of lanes: bits 16-23 of each. */
+static inline __m128i
+pack_lanes_sse2(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	a = _mm_and_si128(_mm_srli_epi32(a, 16), mask);
+	b = _mm_and_si128(_mm_srli_epi32(b, 16), mask);
+	c = _mm_and_si128(_mm_srli_epi32(c, 16), mask);
+	d = _mm_and_si128(_mm_srli_epi32(d, 16), mask);
+	return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+/* Paint a span 16 bytes at a time, for pixels of up to 5 bytes, and
+ * return the number of pixels done (c is advanced past them). Each
+ * block holds as many whole pixels as fit; with 3 or 5 byte pixels
+ * the last byte is junk, which the next block overwrites, so we stop
+ * while there are still 16 bytes of span left to write. */
+static int
+paint_span_sse2(unsigned char *restrict p, int *restrict c, const int *restrict dc, int w, int n, int pa)
+{
+	int bpp = n + pa;
+	int ppb = 16 / bpp; /* pixels per block */
+	int lane[16], step[16];
+	__m128i v0, v1, v2, v3, s0, s1, s2, s3;
+	int j, k, done;
+
+	for (j = 0; j < 16; j++)
+	{
+		int i = j / bpp;
+		k = j % bpp;
+		if (i >= ppb)
+		{
+			lane[j] = 0;
+			step[j] = 0;
+		}
+		else if (k < n)
+		{
+			lane[j] = (int)((unsigned int)c[k] + (unsigned int)i * (unsigned int)dc[k]);
+			step[j] = (int)((unsigned int)ppb * (unsigned int)dc[k]);
+		}
+		else
+		{
+			lane[j] = 255<<16;
+			step[j] = 0;
+		}
+	}
+	v0 = _mm_loadu_si128((const __m128i *)&lane[0]);
+	v1 = _mm_loadu_si128((const __m128i *)&lane[4]);
+	v2 = _mm_loadu_si128((const __m128i *)&lane[8]);
+	v3 = _mm_loadu_si128((const __m128i *)&lane[12]);
+	s0 = _mm_loadu_si128((const __m128i *)&step[0]);
+	s1 = _mm_loadu_si128((const __m128i *)&step[4]);
+	s2 = _mm_loadu_si128((const __m128i *)&step[8]);
+	s3 = _mm_loadu_si128((const __m128i *)&step[12]);
+
+	for (done = 0; (w - done) * bpp >= 16; done += ppb)
+	{
+		_mm_storeu_si128((__m128i *)p, pack_lanes_sse2(v0, v1, v2, v3));
+		v0 = _mm_add_epi32(v0, s0);
+		v1 = _mm_add_epi32(v1, s1);
+		v2 = _mm_add_epi32(v2, s2);
+		v3 = _mm_add_epi32(v3, s3);
+		p += ppb * bpp;
+	}
+
+	for (k = 0; k < n; k++)
+		c[k] = (int)((unsigned int)c[k] + (unsigned int)done * (unsigned int)dc[k]);
+
+	return done;
+}
+#endif /* ARCH_X86_SSE2 */
+
 static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0, int cx1, const int *restrict v0, const int *restrict v1, int n)
 {
 	unsigned char *p;
@@ -43,17 +145,28 @@ static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0
 
 	p = pix->samples + ((x0 - pix->x) * pix->n) + ((y - pix->y) * pix->stride);
 	pa = pix->alpha;
-	do
+
+#ifdef ARCH_X86_SSE2
+	if (n + pa <= 5 && w * (n + pa) >= 16)
 	{
-		for (k = 0; k < n; k++)
-		{
-			*p++ = c[k]>>16;
-			c[k] += dc[k];
-		}
-		if (pa)
-			*p++ = 255;
+		int done = paint_span_sse2(p, c, dc, w, n, pa);
+		p += done * (n + pa);
+		w -= done;
+		if (w == 0)
+			return;
+	}
+#endif
+
+	switch (n + pa * 8)
+	{
+	case 1: paint_span(p, c, dc, w, 1, 0); break;
+	case 3: paint_span(p, c, dc, w, 3, 0); break;
+	case 4: paint_span(p, c, dc, w, 4, 0); break;
+	case 1 + 8: paint_span(p, c, dc, w, 1, 1); break;
+	case 3 + 8: paint_span(p, c, dc, w, 3, 1); break;
+	case 4 + 8: paint_span(p, c, dc, w, 4, 1); break;
+	default: paint_span(p, c, dc, w, n, pa); break;
 	}
-	while (--w);
 }
 
 typedef struct edge_data_s edge_data;
@@ -180,9 +293,17 @@ prepare_mesh_vertex(fz_context *ctx, void *arg, fz_vertex *v, const float *input
 	else
 	{
 		int n = fz_colorspace_n(ctx, dest->colorspace);
-		ptd->cc.convert(ctx, &ptd->cc, output, input);
-		for (i = 0; i < n; i++)
-			output[i] *= 255;
+		if (ptd->cc.convert)
+		{
+			ptd->cc.convert(ctx, &ptd->cc, output, input);
+			for (i = 0; i < n; i++)
+				output[i] *= 255;
+		}
+		else
+		{
+			for (i = 0; i < n; i++)
+				output[i] = input[i] * 255;
+		}
 	}
 }
 
@@ -247,7 +368,10 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 		ptd.shade = shade;
 		ptd.bbox = bbox;
 
-		fz_init_cached_color_converter(ctx, &ptd.cc, temp->colorspace, shade->colorspace);
+		/* Converting to the same colorspace is a copy, and is not worth
+		 * a cache lookup for every vertex. */
+		if (!shade->use_function && temp->colorspace != shade->colorspace)
+			fz_init_cached_color_converter(ctx, &ptd.cc, temp->colorspace, shade->colorspace);
 		fz_process_shade(ctx, shade, &local_ctm, &prepare_mesh_vertex, &do_paint_tri, &ptd);
 
 		if (shade->use_function)
@@ -256,6 +256,14 @@ typedef struct sctx
 	float phase;
 	fz_point dash_cur;
 	fz_point dash_beg;
+
+	/* Set when drawing a hairline directly, rather than adding edges
+	 * to the gel. */
+	fz_pixmap *dst;
+	const unsigned char *color;
+	fz_span_color_painter_t *painter;
+	fz_irect clip;
+	struct { int x, y; float cov; } pending[64];
 } sctx;
 
 static void
@@ -364,6 +372,240 @@ fz_add_arc(fz_context *ctx, sctx *s,
 	fz_add_line(ctx, s, xc + ox, yc + oy, xc + x1, yc + y1);
 }
 
+/*
+	Hairlines: strokes no more than about a pixel wide are drawn straight
+	into the destination rather than being turned into polygons and
+	scan converted. Each segment is a strip cut off square to its major
+	axis, and the coverage of each pixel it crosses is worked out exactly
+	from the area of the strip within the pixel. Joins are not drawn:
+	the ends of the segments meeting at a join overlap by less than a
+	pixel, which stands in for them. Caps and dots are drawn as short
+	extra segments with the same area as the real cap or dot.
+
+	Where segments share a pixel (which is most of them, for flattened
+	curves), their coverage has to be added up rather than painted one
+	over the other, or the line comes out too light. So pixels wait in
+	a small cache to collect coverage from the following segments, and
+	are painted when they are pushed out of it.
+*/
+
+/* The integral of clamp(v, 0, 1). */
+static inline float
+ramp_integral(float v)
+{
+	if (v <= 0)
+		return 0;
+	if (v >= 1)
+		return v - 0.5f;
+	return v * v * 0.5f;
+}
+
+/* The average of clamp(v, 0, 1) as v goes evenly from v0 to v1. */
+static inline float
+ramp_average(float v0, float v1)
+{
+	float d = v1 - v0;
+	if (d > -1e-3f && d < 1e-3f)
+		return fz_clamp((v0 + v1) * 0.5f, 0, 1);
+	return (ramp_integral(v1) - ramp_integral(v0)) / d;
+}
+
+static void
+hairline_paint(sctx *s, int x, int y, float cov)
+{
+	fz_pixmap *dst = s->dst;
+	unsigned char *dp;
+	unsigned char mask;
+	int c = cov * 255 + 0.5f;
+
+	if (c <= 0)
+		return;
+	mask = c > 255 ? 255 : c;
+	dp = dst->samples + (unsigned int)((y - dst->y) * dst->stride + (x - dst->x) * dst->n);
+	s->painter(dp, &mask, dst->n, 1, s->color, dst->alpha);
+}
+
+static inline void
+hairline_plot(sctx *s, int x, int y, float cov)
+{
+	int i = (x * 3 + y * 5) & (nelem(s->pending) - 1);
+
+	if (!(cov > 0))
+		return;
+	if (s->pending[i].cov > 0)
+	{
+		if (s->pending[i].x == x && s->pending[i].y == y)
+		{
+			s->pending[i].cov += cov;
+			return;
+		}
+		hairline_paint(s, s->pending[i].x, s->pending[i].y, s->pending[i].cov);
+	}
+	s->pending[i].x = x;
+	s->pending[i].y = y;
+	s->pending[i].cov = cov;
+}
+
+static void
+hairline_flush(sctx *s)
+{
+	int i;
+	for (i = 0; i < nelem(s->pending); i++)
+		if (s->pending[i].cov > 0)
+			hairline_paint(s, s->pending[i].x, s->pending[i].y, s->pending[i].cov);
+}
+
+/* Draw the strip of the given width (across u) whose centre line runs
+ * from (u0, v0) to (u1, v1), where |u1 - u0| >= |v1 - v0|. u and v are
+ * x and y, or y and x if swap is set. */
+static void
+hairline_strip(sctx *s, float u0, float v0, float u1, float v1, float width, int swap)
+{
+	float du, slope, half;
+	float umin, umax, vmin, vmax;
+	int i, i0, i1, j, j0, j1;
+
+	if (u0 > u1)
+	{
+		float t;
+		t = u0; u0 = u1; u1 = t;
+		t = v0; v0 = v1; v1 = t;
+	}
+	du = u1 - u0;
+	if (!(du > 0))
+		return;
+	slope = (v1 - v0) / du;
+	half = width * sqrtf(1 + slope * slope) * 0.5f;
+	/* Also rules out NaNs, before anything is converted to int. */
+	if (!(fabsf(slope) <= 1 && half >= 0 && half < 2))
+		return;
+
+	umin = swap ? s->clip.y0 : s->clip.x0;
+	umax = swap ? s->clip.y1 : s->clip.x1;
+	vmin = swap ? s->clip.x0 : s->clip.y0;
+	vmax = swap ? s->clip.x1 : s->clip.y1;
+
+	i0 = fz_clamp(floorf(u0), umin, umax);
+	i1 = fz_clamp(ceilf(u1), umin, umax);
+	for (i = i0; i < i1; i++)
+	{
+		float a = fz_max(u0, i);
+		float b = fz_min(u1, i + 1);
+		float fu = b - a;
+		float va = v0 + (a - u0) * slope;
+		float vb = v0 + (b - u0) * slope;
+
+		j0 = fz_clamp(floorf(fz_min(va, vb) - half), vmin, vmax);
+		j1 = fz_clamp(ceilf(fz_max(va, vb) + half), vmin, vmax);
+		for (j = j0; j < j1; j++)
+		{
+			float cov = ramp_average(va + half - j, vb + half - j) - ramp_average(va - half - j, vb - half - j);
+			if (swap)
+				hairline_plot(s, j, i, fu * cov);
+			else
+				hairline_plot(s, i, j, fu * cov);
+		}
+	}
+}
+
+/* Draw a segment of the given half width, all in user space. */
+static void
+hairline_segment(fz_context *ctx, sctx *s, float ax, float ay, float bx, float by, float linewidth)
+{
+	const fz_matrix *m = s->ctm;
+	float dx = bx - ax;
+	float dy = by - ay;
+	float scale = linewidth / sqrtf(dx * dx + dy * dy);
+	float tax = m->a * ax + m->c * ay + m->e;
+	float tay = m->b * ax + m->d * ay + m->f;
+	float tbx = m->a * bx + m->c * by + m->e;
+	float tby = m->b * bx + m->d * by + m->f;
+	float tdx = tbx - tax;
+	float tdy = tby - tay;
+	/* The perpendicular offset to the edge of the stroke, on the device. */
+	float tlx = (m->a * dy - m->c * dx) * scale;
+	float tly = (m->b * dy - m->d * dx) * scale;
+	float len = sqrtf(tdx * tdx + tdy * tdy);
+	float width;
+
+	if (!(len > 0))
+		return;
+	width = 2 * fabsf(tdx * tly - tdy * tlx) / len;
+
+	if (fabsf(tdx) >= fabsf(tdy))
+		hairline_strip(s, tax, tay, tbx, tby, width, 0);
+	else
+		hairline_strip(s, tay, tax, tby, tbx, width, 1);
+}
+
+static void
+hairline_cap(fz_context *ctx, sctx *s, float ax, float ay, float bx, float by, fz_linecap linecap)
+{
+	float dx = bx - ax;
+	float dy = by - ay;
+	float scale = s->linewidth / sqrtf(dx * dx + dy * dy);
+
+	switch (linecap)
+	{
+	case FZ_LINECAP_ROUND:
+		scale *= (float)M_PI / 4;
+		break;
+	case FZ_LINECAP_SQUARE:
+		break;
+	case FZ_LINECAP_TRIANGLE:
+		scale *= 0.5f;
+		break;
+	default:
+		return;
+	}
+	hairline_segment(ctx, s, bx, by, bx + dx * scale, by + dy * scale, s->linewidth);
+}
+
+static void
+hairline_dot(fz_context *ctx, sctx *s, float ax, float ay)
+{
+	/* A square of the same area as the round dot. */
+	float r = s->linewidth * 0.886227f; /* sqrt(pi)/2 */
+	hairline_segment(ctx, s, ax - r, ay, ax + r, ay, r);
+}
+
+/* Round and bevel joins are left to the overlapping ends of the
+ * segments. A miter adds a kite beyond those ends, out to its tip, which
+ * is drawn as a segment along the bisector, as long as the miter and as
+ * wide as gives the same area. (dmx, dmy) is the outer offset at the join
+ * averaged over both segments, as in fz_add_line_join. */
+static void
+hairline_join(fz_context *ctx, sctx *s, float bx, float by, float dmx, float dmy, float dmr2, fz_linejoin linejoin)
+{
+	float w2 = s->linewidth * s->linewidth;
+	float limit = s->linewidth * s->miterlimit;
+	float dm, tip, side, reach, area;
+
+	if (linejoin != FZ_LINEJOIN_MITER && linejoin != FZ_LINEJOIN_MITER_XPS)
+		return;
+	if (!(dmr2 > 0) || dmr2 >= w2)
+		return;
+
+	dm = sqrtf(dmr2); /* how far the outer corners are along the bisector */
+	tip = w2 / dm; /* and the tip */
+	side = sqrtf(w2 - dmr2); /* half the width of the kite at the corners */
+
+	reach = tip;
+	if (tip > limit)
+	{
+		if (linejoin == FZ_LINEJOIN_MITER)
+			return; /* bevelled */
+		reach = limit; /* XPS cuts the miter off at the limit */
+	}
+
+	if (reach <= dm)
+		area = side * reach * reach / dm;
+	else
+		area = side * tip - side * (tip - reach) * (tip - reach) / (tip - dm);
+
+	hairline_segment(ctx, s, bx, by, bx - dmx * reach / dm, by - dmy * reach / dm, area / (2 * reach));
+}
+
 static void
 fz_add_line_stroke(fz_context *ctx, sctx *s, float ax, float ay, float bx, float by)
 {
@@ -373,6 +615,12 @@ fz_add_line_stroke(fz_context *ctx, sctx *s, float ax, float ay, float bx, float
 	float dlx = dy * scale;
 	float dly = -dx * scale;
 
+	if (s->dst)
+	{
+		hairline_segment(ctx, s, ax, ay, bx, by, s->linewidth);
+		return;
+	}
+
 	if (0 && dx == 0)
 	{
 		fz_add_vert_rect(ctx, s, ax - dlx, ay, bx + dlx, by);
@@ -455,6 +703,12 @@ fz_add_line_join(fz_context *ctx, sctx *s, float ax, float ay, float bx, float b
 	if (cross * cross < FLT_EPSILON && dx0 * dx1 + dy0 * dy1 >= 0)
 		linejoin = FZ_LINEJOIN_BEVEL;
 
+	if (s->dst)
+	{
+		hairline_join(ctx, s, bx, by, dmx, dmy, dmr2, linejoin);
+		return;
+	}
+
 	if (join_under)
 	{
 		fz_add_line(ctx, s, bx + dlx1, by + dly1, bx + dlx0, by + dly0);
@@ -534,6 +788,12 @@ fz_add_line_cap(fz_context *ctx, sctx *s, float ax, float ay, float bx, float by
 	float dlx = dy * scale;
 	float dly = -dx * scale;
 
+	if (s->dst)
+	{
+		hairline_cap(ctx, s, ax, ay, bx, by, linecap);
+		return;
+	}
+
 	switch (linecap)
 	{
 	case FZ_LINECAP_BUTT:
@@ -594,6 +854,12 @@ fz_add_line_dot(fz_context *ctx, sctx *s, float ax, float ay)
 	float oy = ay;
 	int i;
 
+	if (s->dst)
+	{
+		hairline_dot(ctx, s, ax, ay);
+		return;
+	}
+
 	if (n < 3)
 		n = 3;
 	for (i = 1; i < n; i++)
@@ -841,36 +1107,42 @@ static const fz_path_walker stroke_proc =
 	stroke_quadto
 };
 
-void
-fz_flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
+static void
+flatten_stroke(fz_context *ctx, sctx *s, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
 {
-	struct sctx s;
+	s->stroke = stroke;
+	s->ctm = ctm;
+	s->flatness = flatness;
+
+	s->linejoin = stroke->linejoin;
+	s->linewidth = linewidth * 0.5f; /* hairlines use a different value from the path value */
+	s->miterlimit = stroke->miterlimit;
+	s->sn = 0;
+	s->dot = 0;
 
-	s.stroke = stroke;
-	s.gel = gel;
-	s.ctm = ctm;
-	s.flatness = flatness;
+	s->dash_list = NULL;
+	s->dash_phase = 0;
+	s->dash_len = 0;
+	s->toggle = 0;
+	s->offset = 0;
+	s->phase = 0;
 
-	s.linejoin = stroke->linejoin;
-	s.linewidth = linewidth * 0.5f; /* hairlines use a different value from the path value */
-	s.miterlimit = stroke->miterlimit;
-	s.sn = 0;
-	s.dot = 0;
+	s->cap = stroke->start_cap;
 
-	s.dash_list = NULL;
-	s.dash_phase = 0;
-	s.dash_len = 0;
-	s.toggle = 0;
-	s.offset = 0;
-	s.phase = 0;
+	s->cur.x = s->cur.y = 0;
 
-	s.cap = stroke->start_cap;
+	fz_walk_path(ctx, path, &stroke_proc, s);
+	fz_stroke_flush(ctx, s, stroke->start_cap, stroke->end_cap);
+}
 
-	s.cur.x = s.cur.y = 0;
-	s.stroke = stroke;
+void
+fz_flatten_stroke_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
+{
+	struct sctx s;
 
-	fz_walk_path(ctx, path, &stroke_proc, &s);
-	fz_stroke_flush(ctx, &s, stroke->start_cap, stroke->end_cap);
+	s.gel = gel;
+	s.dst = NULL;
+	flatten_stroke(ctx, &s, path, stroke, ctm, flatness, linewidth);
 }
 
 static void
@@ -1300,57 +1572,96 @@ static const fz_path_walker dash_proc =
 	dash_quadto
 };
 
-void
-fz_flatten_dash_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
+static void
+flatten_dash(fz_context *ctx, sctx *s, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth, const fz_rect *scissor)
 {
-	struct sctx s;
 	float max_expand;
 	int i;
 	fz_matrix inv;
 
-	s.stroke = stroke;
-	s.gel = gel;
-	s.ctm = ctm;
-	s.flatness = flatness;
-
-	s.linejoin = stroke->linejoin;
-	s.linewidth = linewidth * 0.5f;
-	s.miterlimit = stroke->miterlimit;
-	s.sn = 0;
-	s.dot = 0;
-
-	s.dash_list = stroke->dash_list;
-	s.dash_len = stroke->dash_len;
-
-	s.dash_total = 0;
-	for (i = 0; i < s.dash_len; i++)
-		s.dash_total += s.dash_list[i];
-	if (s.dash_len > 0 && s.dash_total == 0)
+	s->stroke = stroke;
+	s->ctm = ctm;
+	s->flatness = flatness;
+
+	s->linejoin = stroke->linejoin;
+	s->linewidth = linewidth * 0.5f;
+	s->miterlimit = stroke->miterlimit;
+	s->sn = 0;
+	s->dot = 0;
+
+	s->dash_list = stroke->dash_list;
+	s->dash_len = stroke->dash_len;
+
+	s->dash_total = 0;
+	for (i = 0; i < s->dash_len; i++)
+		s->dash_total += s->dash_list[i];
+	if (s->dash_len > 0 && s->dash_total == 0)
 		return;
 
-	s.dash_phase = fmodf(stroke->dash_phase, s.dash_total);
-	s.cap = stroke->start_cap;
-	s.toggle = 0;
-	s.offset = 0;
-	s.phase = 0;
+	s->dash_phase = fmodf(stroke->dash_phase, s->dash_total);
+	s->cap = stroke->start_cap;
+	s->toggle = 0;
+	s->offset = 0;
+	s->phase = 0;
 
-	fz_gel_scissor(ctx, gel, &s.rect);
+	s->rect = *scissor;
 	if (fz_try_invert_matrix(&inv, ctm))
 		return;
-	fz_transform_rect(&s.rect, &inv);
-	s.rect.x0 -= linewidth;
-	s.rect.x1 += linewidth;
-	s.rect.y0 -= linewidth;
-	s.rect.y1 += linewidth;
+	fz_transform_rect(&s->rect, &inv);
+	s->rect.x0 -= linewidth;
+	s->rect.x1 += linewidth;
+	s->rect.y0 -= linewidth;
+	s->rect.y1 += linewidth;
 
 	max_expand = fz_matrix_max_expansion(ctm);
-	if (s.dash_total < 0.01f || s.dash_total * max_expand < 0.5f)
+	if (s->dash_total < 0.01f || s->dash_total * max_expand < 0.5f)
 	{
-		fz_flatten_stroke_path(ctx, gel, path, stroke, ctm, flatness, linewidth);
+		flatten_stroke(ctx, s, path, stroke, ctm, flatness, linewidth);
 		return;
 	}
 
-	s.cur.x = s.cur.y = 0;
-	fz_walk_path(ctx, path, &dash_proc, &s);
-	fz_stroke_flush(ctx, &s, s.cap, stroke->end_cap);
+	s->cur.x = s->cur.y = 0;
+	fz_walk_path(ctx, path, &dash_proc, s);
+	fz_stroke_flush(ctx, s, s->cap, stroke->end_cap);
+}
+
+void
+fz_flatten_dash_path(fz_context *ctx, fz_gel *gel, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth)
+{
+	struct sctx s;
+	fz_rect scissor;
+
+	s.gel = gel;
+	s.dst = NULL;
+	fz_gel_scissor(ctx, gel, &scissor);
+	flatten_dash(ctx, &s, path, stroke, ctm, flatness, linewidth, &scissor);
+}
+
+void
+fz_stroke_hairline_path(fz_context *ctx, const fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth, const fz_irect *clip, fz_pixmap *dst, const unsigned char *colorbv)
+{
+	struct sctx s;
+	fz_irect bbox;
+
+	s.gel = NULL;
+	s.dst = dst;
+	s.color = colorbv;
+	s.painter = fz_get_span_color_painter(dst->n, dst->alpha, colorbv);
+	if (!s.painter)
+		return;
+	s.clip = *clip;
+	fz_intersect_irect(&s.clip, fz_pixmap_bbox_no_ctx(dst, &bbox));
+	if (fz_is_empty_irect(&s.clip))
+		return;
+	memset(s.pending, 0, sizeof s.pending);
+
+	if (stroke->dash_len > 0)
+	{
+		fz_rect scissor;
+		fz_rect_from_irect(&scissor, &s.clip);
+		flatten_dash(ctx, &s, path, stroke, ctm, flatness, linewidth, &scissor);
+	}
+	else
+		flatten_stroke(ctx, &s, path, stroke, ctm, flatness, linewidth);
+	hairline_flush(&s);
 }
@@ -12,6 +12,7 @@ intermediate results rather than ints.
 
 #include "mupdf/fitz.h"
 #include "draw-imp.h"
+#include "fitz-imp.h"
 
 /* Do we special case handling of single pixel high/wide images? The
  * 'purest' handling is given by not special casing them, but certain
@@ -201,10 +202,125 @@ struct fz_scale_cache_s
 	fz_weights *weights;
 };
 
+/*
+Weight tables are kept in the store, so that drawing the same image at
+the same size again (on another page, or by another device) does not
+have to recalculate them. fz_scale_cache only saves a store lookup when
+a device draws the same size repeatedly.
+*/
+
+typedef struct fz_weights_item_s
+{
+	fz_storable storable;
+	fz_weights weights; /* Must be last, as it is variable length */
+} fz_weights_item;
+
+typedef struct fz_weights_key_s
+{
+	int refs;
+	int src_w;
+	float x;
+	float dst_w;
+	fz_scale_filter *filter;
+	int vertical;
+	int dst_w_int;
+	int patch_l;
+	int patch_r;
+	int n;
+	int flip;
+} fz_weights_key;
+
+static int
+make_hash_weights_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+	int params[9];
+	fz_md5 md5;
+
+	params[0] = key->src_w;
+	memcpy(&params[1], &key->x, sizeof(float));
+	memcpy(&params[2], &key->dst_w, sizeof(float));
+	params[3] = key->vertical;
+	params[4] = key->dst_w_int;
+	params[5] = key->patch_l;
+	params[6] = key->patch_r;
+	params[7] = key->n;
+	params[8] = key->flip;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (unsigned char *)params, sizeof params);
+	fz_md5_final(&md5, hash->u.pd.digest);
+	hash->u.pd.ptr = key->filter;
+	return 1;
+}
+
+static void *
+keep_weights_key(fz_context *ctx, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+drop_weights_key(fz_context *ctx, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+cmp_weights_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_weights_key *k0 = (fz_weights_key *)k0_;
+	fz_weights_key *k1 = (fz_weights_key *)k1_;
+	return k0->src_w == k1->src_w && k0->x == k1->x && k0->dst_w == k1->dst_w &&
+		k0->filter == k1->filter && k0->vertical == k1->vertical &&
+		k0->dst_w_int == k1->dst_w_int &&
+		k0->patch_l == k1->patch_l && k0->patch_r == k1->patch_r &&
+		k0->n == k1->n && k0->flip == k1->flip;
+}
+
+static void
+print_weights_key(fz_context *ctx, fz_output *out, void *key_)
+{
+	fz_weights_key *key = (fz_weights_key *)key_;
+	fz_printf(ctx, out, "(scale weights %d -> %g %s) ", key->src_w, key->dst_w, key->vertical ? "v" : "h");
+}
+
+static fz_store_type fz_weights_store_type =
+{
+	make_hash_weights_key,
+	keep_weights_key,
+	drop_weights_key,
+	cmp_weights_key,
+	print_weights_key
+};
+
+static void
+drop_weights_imp(fz_context *ctx, fz_storable *item)
+{
+	fz_free(ctx, item);
+}
+
+static fz_weights_item *
+weights_item(fz_weights *weights)
+{
+	return (fz_weights_item *)((char *)weights - offsetof(fz_weights_item, weights));
+}
+
+static void
+drop_weights(fz_context *ctx, fz_weights *weights)
+{
+	if (weights)
+		fz_drop_storable(ctx, &weights_item(weights)->storable);
+}
+
 static fz_weights *
-new_weights(fz_context *ctx, fz_scale_filter *filter, int src_w, float dst_w, int patch_w, int n, int flip, int patch_l)
+new_weights(fz_context *ctx, fz_scale_filter *filter, int src_w, float dst_w, int patch_w, int n, int flip, int patch_l, size_t *size)
 {
 	int max_len;
+	fz_weights_item *item;
 	fz_weights *weights;
 
 	if (src_w > dst_w)
@@ -228,9 +344,10 @@ new_weights(fz_context *ctx, fz_scale_filter *filter, int src_w, float dst_w, in
 	 * plus (2+max_len)*sizeof(int) for the weights
 	 * plus room for an extra set of weights for reordering.
 	 */
-	weights = fz_malloc(ctx, sizeof(*weights)+(max_len+3)*(patch_w+1)*sizeof(int));
-	if (!weights)
-		return NULL;
+	*size = sizeof(*item)+(max_len+3)*(patch_w+1)*sizeof(int);
+	item = fz_malloc(ctx, *size);
+	FZ_INIT_STORABLE(item, 1, drop_weights_imp);
+	weights = &item->weights;
 	weights->count = -1;
 	weights->max_len = max_len;
 	weights->index[0] = patch_w;
@@ -420,14 +537,17 @@ check_weights(fz_weights *weights, int j, int w, float x, float wf)
 static fz_weights *
 make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip, fz_scale_cache *cache)
 {
+	fz_weights_key key, *new_key = NULL;
+	fz_weights_item *existing;
 	fz_weights *weights;
+	size_t size;
 	float F, G;
 	float window;
 	int j;
 
 	if (cache)
 	{
-		if (cache->src_w == src_w && cache->x == x && cache->dst_w == dst_w &&
+		if (cache->weights && cache->src_w == src_w && cache->x == x && cache->dst_w == dst_w &&
 			cache->filter == filter && cache->vertical == vertical &&
 			cache->dst_w_int == dst_w_int &&
 			cache->patch_l == patch_l && cache->patch_r == patch_r &&
@@ -445,10 +565,30 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 		cache->patch_r = patch_r;
 		cache->n = n;
 		cache->flip = flip;
-		fz_free(ctx, cache->weights);
+		drop_weights(ctx, cache->weights);
 		cache->weights = NULL;
 	}
 
+	key.refs = 1;
+	key.src_w = src_w;
+	key.x = x;
+	key.dst_w = dst_w;
+	key.filter = filter;
+	key.vertical = vertical;
+	key.dst_w_int = dst_w_int;
+	key.patch_l = patch_l;
+	key.patch_r = patch_r;
+	key.n = n;
+	key.flip = flip;
+	existing = fz_find_item(ctx, drop_weights_imp, &key, &fz_weights_store_type);
+	if (existing)
+	{
+		weights = &existing->weights;
+		if (cache)
+			cache->weights = weights;
+		return weights;
+	}
+
 	if (dst_w < src_w)
 	{
 		/* Scaling down */
@@ -462,9 +602,7 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 		G = src_w / dst_w;
 	}
 	window = filter->width / F;
-	weights	= new_weights(ctx, filter, src_w, dst_w, patch_r-patch_l, n, flip, patch_l);
-	if (!weights)
-		return NULL;
+	weights	= new_weights(ctx, filter, src_w, dst_w, patch_r-patch_l, n, flip, patch_l, &size);
 	for (j = patch_l; j < patch_r; j++)
 	{
 		/* find the position of the centre of dst[j] in src space */
@@ -484,6 +622,30 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 		}
 	}
 	weights->count++; /* weights->count = dst_w_int now */
+
+	fz_var(new_key);
+
+	fz_try(ctx)
+	{
+		new_key = fz_malloc_struct(ctx, fz_weights_key);
+		*new_key = key;
+		existing = fz_store_item(ctx, new_key, weights_item(weights), size, &fz_weights_store_type);
+		if (existing)
+		{
+			drop_weights(ctx, weights);
+			weights = &existing->weights;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (new_key)
+			drop_weights_key(ctx, new_key);
+	}
+	fz_catch(ctx)
+	{
+		/* Failing to share the weights is not fatal. */
+	}
+
 	if (cache)
 	{
 		cache->weights = weights;
@@ -1000,6 +1162,8 @@ scale_row_from_temp_alpha(unsigned char * restrict dst, const unsigned char * re
 	);
 }
 #else
+/* With SSE2, the versions further down take the place of some of these */
+#ifndef ARCH_X86_SSE2
 static void
 scale_row_to_temp1(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights)
 {
@@ -1038,6 +1202,7 @@ scale_row_to_temp1(unsigned char * restrict dst, const unsigned char * restrict
 		}
 	}
 }
+#endif
 
 static void
 scale_row_to_temp2(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights)
@@ -1084,6 +1249,7 @@ scale_row_to_temp2(unsigned char * restrict dst, const unsigned char * restrict
 	}
 }
 
+#ifndef ARCH_X86_SSE2
 static void
 scale_row_to_temp3(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights)
 {
@@ -1219,6 +1385,7 @@ scale_row_from_temp(unsigned char * restrict dst, const unsigned char * restrict
 		src++;
 	}
 }
+#endif
 
 static void
 scale_row_from_temp_alpha(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights, int w, int n, int row)
@@ -1252,6 +1419,211 @@ scale_row_from_temp_alpha(unsigned char * restrict dst, const unsigned char * re
 }
 #endif
 
+#ifdef ARCH_X86_SSE2
+#include <emmintrin.h>
+
+/*
+SSE2 versions of the row scalers, used in place of the C versions of
+the same names above. They give exactly the same results: samples and
+weights (which never exceed 256) are multiplied as 16 bit values and
+summed in 32 bits by _mm_madd_epi16, which lets us feed in two source
+pixels (or two temp rows) at once.
+*/
+
+/* Load an n byte pixel. When more source pixels follow it, 3 byte
+ * pixels can be fetched with a single 4 byte load. */
+static inline __m128i
+load_pixel_sse2(const unsigned char *p, int n, int more)
+{
+	int v;
+	if (n == 4 || more)
+		memcpy(&v, p, 4);
+	else
+		v = p[0] | (p[1]<<8) | (p[2]<<16);
+	return _mm_cvtsi32_si128(v);
+}
+
+static inline __m128i
+weight_pair_sse2(int w0, int w1)
+{
+	return _mm_set1_epi32((w1 << 16) | (w0 & 0xffff));
+}
+
+static inline void
+scale_row_to_temp_n_sse2(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights, int n)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	const __m128i zero = _mm_setzero_si128();
+	int step = n;
+	int len, i, v;
+	const unsigned char *min;
+
+	if (weights->flip)
+	{
+		dst += (weights->count-1)*n;
+		step = -n;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_set1_epi32(128);
+		__m128i p;
+		min = &src[n * *contrib++];
+		len = *contrib++;
+		for (; len >= 2; len -= 2)
+		{
+			p = _mm_unpacklo_epi8(load_pixel_sse2(min, n, 1), load_pixel_sse2(min + n, n, len > 2));
+			p = _mm_unpacklo_epi8(p, zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair_sse2(contrib[0], contrib[1])));
+			min += 2*n;
+			contrib += 2;
+		}
+		if (len)
+		{
+			p = _mm_unpacklo_epi8(load_pixel_sse2(min, n, 0), zero);
+			p = _mm_unpacklo_epi16(p, zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair_sse2(*contrib++, 0)));
+		}
+		acc = _mm_srai_epi32(acc, 8);
+		acc = _mm_packs_epi32(acc, acc);
+		v = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		memcpy(dst, &v, n);
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp1(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	const __m128i zero = _mm_setzero_si128();
+	int step = 1;
+	int len, i;
+	const unsigned char *min;
+
+	assert(weights->n == 1);
+	if (weights->flip)
+	{
+		dst += weights->count-1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		int val = 128;
+		min = &src[*contrib++];
+		len = *contrib++;
+		if (len >= 8)
+		{
+			__m128i acc = zero;
+			do
+			{
+				__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), zero);
+				__m128i w = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)contrib), _mm_loadu_si128((const __m128i *)(contrib + 4)));
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(p, w));
+				min += 8;
+				contrib += 8;
+				len -= 8;
+			}
+			while (len >= 8);
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+			val += _mm_cvtsi128_si32(acc);
+		}
+		if (len >= 4)
+		{
+			int v;
+			__m128i p, w;
+			memcpy(&v, min, 4);
+			p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+			w = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)contrib), zero);
+			p = _mm_madd_epi16(p, w);
+			val += _mm_cvtsi128_si32(_mm_add_epi32(p, _mm_srli_si128(p, 4)));
+			min += 4;
+			contrib += 4;
+			len -= 4;
+		}
+		while (len-- > 0)
+		{
+			val += *min++ * *contrib++;
+		}
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp3(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights)
+{
+	assert(weights->n == 3);
+	scale_row_to_temp_n_sse2(dst, src, weights, 3);
+}
+
+static void
+scale_row_to_temp4(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights)
+{
+	assert(weights->n == 4);
+	scale_row_to_temp_n_sse2(dst, src, weights, 4);
+}
+
+static void
+scale_row_from_temp(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(128);
+	int len, x, k;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const unsigned char *min = src + x;
+		__m128i acc0 = round;
+		__m128i acc1 = round;
+		__m128i acc2 = round;
+		__m128i acc3 = round;
+		__m128i a, b, wt, lo, hi;
+
+		for (k = 0; k < len; k += 2)
+		{
+			a = _mm_loadu_si128((const __m128i *)min);
+			if (k + 1 < len)
+			{
+				b = _mm_loadu_si128((const __m128i *)(min + width));
+				wt = weight_pair_sse2(contrib[k], contrib[k+1]);
+			}
+			else
+			{
+				b = zero;
+				wt = weight_pair_sse2(contrib[k], 0);
+			}
+			lo = _mm_unpacklo_epi8(a, b);
+			hi = _mm_unpackhi_epi8(a, b);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wt));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wt));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wt));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wt));
+			min += 2*width;
+		}
+		lo = _mm_packs_epi32(_mm_srai_epi32(acc0, 8), _mm_srai_epi32(acc1, 8));
+		hi = _mm_packs_epi32(_mm_srai_epi32(acc2, 8), _mm_srai_epi32(acc3, 8));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	for (; x < width; x++)
+	{
+		const unsigned char *min = src + x;
+		int val = 128;
+
+		for (k = 0; k < len; k++)
+		{
+			val += *min * contrib[k];
+			min += width;
+		}
+		dst[x] = (unsigned char)(val>>8);
+	}
+}
+#endif /* ARCH_X86_SSE2 */
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char * restrict dst, const unsigned char * restrict src, int n, int forcealpha, int w, int h, int stride)
@@ -1518,6 +1890,65 @@ adjust_alpha_edges(fz_pixmap * restrict pix, const fz_weights * restrict rows, c
 	}
 }
 
+/* Don't split scales into bands of fewer output rows than this, or at all
+ * when there are fewer source samples than SCALE_BAND_MIN_WORK. */
+#define SCALE_BAND_MIN_ROWS 32
+#define SCALE_BAND_MIN_WORK (1<<20)
+#define SCALE_MAX_BANDS 16
+
+typedef struct
+{
+	const fz_pixmap *src;
+	fz_pixmap *output;
+	const fz_weights *rows;
+	const fz_weights *cols;
+	int flip_y;
+	int temp_span;
+	int temp_rows;
+	int band_h;
+	void (*row_scale_in)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights);
+	void (*row_scale_out)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights, int w, int n, int row);
+} scale_job;
+
+static void
+scale_band(fz_context *ctx, void *arg, int band)
+{
+	scale_job *job = (scale_job *)arg;
+	const fz_pixmap *src = job->src;
+	fz_pixmap *output = job->output;
+	const fz_weights *contrib_rows = job->rows;
+	int temp_span = job->temp_span;
+	int temp_rows = job->temp_rows;
+	int row = band * job->band_h;
+	int row_end = fz_mini(row + job->band_h, contrib_rows->count);
+	int max_row;
+	unsigned char *temp;
+
+	temp = fz_calloc(ctx, temp_span*temp_rows, sizeof(unsigned char));
+	max_row = contrib_rows->index[contrib_rows->index[row]];
+	for (; row < row_end; row++)
+	{
+		/*
+		Which source rows do we need to have scaled into the
+		temporary buffer in order to be able to do the final
+		scale?
+		*/
+		int row_index = contrib_rows->index[row];
+		int row_min = contrib_rows->index[row_index++];
+		int row_len = contrib_rows->index[row_index];
+		while (max_row < row_min+row_len)
+		{
+			/* Scale another row */
+			assert(max_row < src->h);
+			(*job->row_scale_in)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(job->flip_y ? (src->h-1-max_row): max_row)*src->stride], job->cols);
+			max_row++;
+		}
+
+		(*job->row_scale_out)(&output->samples[row*output->stride], temp, contrib_rows, job->cols->count, src->n, row);
+	}
+	fz_free(ctx, temp);
+}
+
 fz_pixmap *
 fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_irect *clip)
 {
@@ -1531,8 +1962,6 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	fz_weights *contrib_rows = NULL;
 	fz_weights *contrib_cols = NULL;
 	fz_pixmap *output = NULL;
-	unsigned char *temp = NULL;
-	int max_row, temp_span, temp_rows, row;
 	int dst_w_int, dst_h_int, dst_x_int, dst_y_int;
 	int flip_x, flip_y, forcealpha;
 	fz_rect patch;
@@ -1709,9 +2138,9 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	fz_catch(ctx)
 	{
 		if (!cache_x)
-			fz_free(ctx, contrib_cols);
+			drop_weights(ctx, contrib_cols);
 		if (!cache_y)
-			fz_free(ctx, contrib_rows);
+			drop_weights(ctx, contrib_rows);
 		fz_rethrow(ctx);
 	}
 	output->x = dst_x_int;
@@ -1744,67 +2173,66 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	else
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
-		void (*row_scale_in)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights);
-		void (*row_scale_out)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights, int w, int n, int row);
-
-		temp_span = contrib_cols->count * src->n;
-		temp_rows = contrib_rows->max_len;
-		if (temp_span <= 0 || temp_rows > INT_MAX / temp_span)
+		scale_job job;
+		int bands;
+
+		job.src = src;
+		job.output = output;
+		job.rows = contrib_rows;
+		job.cols = contrib_cols;
+		job.flip_y = flip_y;
+		job.temp_span = contrib_cols->count * src->n;
+		job.temp_rows = contrib_rows->max_len;
+		if (job.temp_span <= 0 || job.temp_rows > INT_MAX / job.temp_span)
 			goto cleanup;
-		fz_try(ctx)
-		{
-			temp = fz_calloc(ctx, temp_span*temp_rows, sizeof(unsigned char));
-		}
-		fz_catch(ctx)
-		{
-			fz_drop_pixmap(ctx, output);
-			if (!cache_x)
-				fz_free(ctx, contrib_cols);
-			if (!cache_y)
-				fz_free(ctx, contrib_rows);
-			fz_rethrow(ctx);
-		}
 		switch (src->n)
 		{
 		default:
-			row_scale_in = scale_row_to_temp;
+			job.row_scale_in = scale_row_to_temp;
 			break;
 		case 1: /* Image mask case or Greyscale case */
-			row_scale_in = scale_row_to_temp1;
+			job.row_scale_in = scale_row_to_temp1;
 			break;
 		case 2: /* Greyscale with alpha case */
-			row_scale_in = scale_row_to_temp2;
+			job.row_scale_in = scale_row_to_temp2;
 			break;
 		case 3: /* RGB case */
-			row_scale_in = scale_row_to_temp3;
+			job.row_scale_in = scale_row_to_temp3;
 			break;
 		case 4: /* RGBA or CMYK case */
-			row_scale_in = scale_row_to_temp4;
+			job.row_scale_in = scale_row_to_temp4;
 			break;
 		}
-		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
-		max_row = contrib_rows->index[contrib_rows->index[0]];
-		for (row = 0; row < contrib_rows->count; row++)
+		job.row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
+
+		/* Each band of output rows scales the source rows it needs into
+		 * its own temporary buffer, so bands can be run in parallel at
+		 * the cost of repeating the horizontal pass for the few source
+		 * rows that neighbouring bands share. */
+		bands = 1;
+		if (fz_can_run_parallel_jobs(ctx))
 		{
-			/*
-			Which source rows do we need to have scaled into the
-			temporary buffer in order to be able to do the final
-			scale?
-			*/
-			int row_index = contrib_rows->index[row];
-			int row_min = contrib_rows->index[row_index++];
-			int row_len = contrib_rows->index[row_index];
-			while (max_row < row_min+row_len)
-			{
-				/* Scale another row */
-				assert(max_row < src->h);
-				(*row_scale_in)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(flip_y ? (src->h-1-max_row): max_row)*src->stride], contrib_cols);
-				max_row++;
-			}
+			size_t work = (size_t)job.temp_span * src->h;
+			bands = fz_mini(contrib_rows->count / SCALE_BAND_MIN_ROWS, SCALE_MAX_BANDS);
+			if (work < SCALE_BAND_MIN_WORK)
+				bands = 1;
+			if (bands < 1)
+				bands = 1;
+		}
+		job.band_h = (contrib_rows->count + bands - 1) / bands;
+		bands = (contrib_rows->count + job.band_h - 1) / job.band_h;
 
-			(*row_scale_out)(&output->samples[row*output->stride], temp, contrib_rows, contrib_cols->count, src->n, row);
+		fz_try(ctx)
+			fz_run_jobs(ctx, bands, scale_band, &job);
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, output);
+			if (!cache_x)
+				drop_weights(ctx, contrib_cols);
+			if (!cache_y)
+				drop_weights(ctx, contrib_rows);
+			fz_rethrow(ctx);
 		}
-		fz_free(ctx, temp);
 
 		if (forcealpha)
 			adjust_alpha_edges(output, contrib_rows, contrib_cols);
@@ -1814,9 +2242,9 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 
 cleanup:
 	if (!cache_y)
-		fz_free(ctx, contrib_rows);
+		drop_weights(ctx, contrib_rows);
 	if (!cache_x)
-		fz_free(ctx, contrib_cols);
+		drop_weights(ctx, contrib_cols);
 
 	return output;
 }
@@ -1826,7 +2254,7 @@ fz_drop_scale_cache(fz_context *ctx, fz_scale_cache *sc)
 {
 	if (!sc)
 		return;
-	fz_free(ctx, sc->weights);
+	drop_weights(ctx, sc->weights);
 	fz_free(ctx, sc);
 }
 
@@ -195,6 +195,87 @@ fz_unpack_tile(fz_context *ctx, fz_pixmap *dst, unsigned char * restrict src, in
 	}
 }
 
+/* Unpack 1 bit data straight to a pixmap 1<<factor times smaller in
+ * each direction, each pixel holding the coverage of its box. This
+ * gives what fz_unpack_tile followed by fz_subsample_pixmap would,
+ * without ever holding the image at 8 bits per pixel. */
+
+static const unsigned char bitcount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+#define popcount8(b) (bitcount[(b) >> 4] + bitcount[(b) & 15])
+
+void
+fz_unpack_mono_tile_subsampled(fz_context *ctx, fz_pixmap *dst, unsigned char * restrict src, int w, int h, size_t stride, int factor)
+{
+	int f = 1 << factor;
+	int nbytes = (w + 7) >> 3;
+	int lastmask = (w & 7) ? 0xff00 >> (w & 7) : 0xff;
+	int dw = dst->w;
+	int dh = fz_mini(dst->h, (h + f - 1) >> factor);
+	int *acc;
+	int x, y, k, ox, oy;
+
+	assert(dst->n == 1 && factor > 0);
+
+	acc = fz_malloc_array(ctx, nbytes * 8, sizeof(int));
+
+	for (oy = 0; oy < dh; oy++)
+	{
+		int bh = fz_mini(f, h - (oy << factor));
+		unsigned char *dp = dst->samples + oy * dst->stride;
+
+		memset(acc, 0, nbytes * 8 * sizeof(int));
+		for (y = 0; y < bh; y++)
+		{
+			unsigned char *sp = src + ((oy << factor) + y) * stride;
+
+			if (f >= 8)
+			{
+				/* Each box spans whole bytes */
+				int bytes = f >> 3;
+				for (ox = 0, x = 0; x < nbytes; ox++)
+				{
+					int c = 0;
+					for (k = 0; k < bytes && x < nbytes; k++, x++)
+					{
+						int b = sp[x];
+						if (x == nbytes - 1)
+							b &= lastmask;
+						c += popcount8(b);
+					}
+					acc[ox] += c;
+				}
+			}
+			else
+			{
+				/* Each byte spans several boxes */
+				int per = 8 >> factor;
+				int m = (1 << f) - 1;
+				int *ap = acc;
+				for (x = 0; x < nbytes; x++)
+				{
+					int b = sp[x];
+					if (x == nbytes - 1)
+						b &= lastmask;
+					for (k = per - 1; k >= 0; k--)
+						*ap++ += popcount8((b >> (k << factor)) & m);
+				}
+			}
+		}
+
+		for (ox = 0; ox < dw; ox++)
+		{
+			int bw = fz_mini(f, w - (ox << factor));
+			if (bw == f && bh == f)
+				dp[ox] = (acc[ox] * 255) >> (factor * 2);
+			else
+				dp[ox] = (acc[ox] * 255) / (bw * bh);
+		}
+	}
+
+	fz_free(ctx, acc);
+}
+
 /* Apply decode array */
 
 void
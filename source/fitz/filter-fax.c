@@ -154,15 +154,13 @@ static const cfd_node cf_2d_decode[] = {
 
 /* bit magic */
 
-static inline int getbit(const unsigned char *buf, int x)
+/* count leading zeros of a non-zero word */
+#if defined(__GNUC__)
+static inline int clz32(uint32_t v)
 {
-	return ( buf[x >> 3] >> ( 7 - (x & 7) ) ) & 1;
+	return __builtin_clz(v);
 }
-
-static const unsigned char mask[8] = {
-	0x7F, 0x3F, 0x1F, 0x0F, 0x07, 0x03, 0x01, 0
-};
-
+#else
 static const unsigned char clz[256] = {
 	8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
 	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
@@ -182,77 +180,89 @@ static const unsigned char clz[256] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+static inline int clz32(uint32_t v)
+{
+	if (v >> 16)
+		return (v >> 24) ? clz[v >> 24] : 8 + clz[v >> 16];
+	return (v >> 8) ? 16 + clz[(v >> 8) & 0xFF] : 24 + clz[v & 0xFF];
+}
+#endif
+
+/* Fetch pixels 32*i to 32*i+31 of a line, leftmost pixel in the most
+ * significant bit. Lines carry 3 bytes of zero padding so that this is
+ * safe for any word that starts within the line. */
+static inline uint32_t load_word(const unsigned char *line, int i)
+{
+	const unsigned char *p = line + (i << 2);
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+enum
+{
+	CHANGE_TO_WHITE,
+	CHANGE_TO_BLACK,
+	CHANGE_ANY
+};
+
+/* Find the first changing element at or after x, looking only for
+ * changes of the given kind. The pixel before the start of the line
+ * counts as white. Returns w if there is no such element. Runs are
+ * skipped a word at a time rather than a byte at a time. */
 static inline int
-find_changing(const unsigned char *line, int x, int w)
+scan_changing(const unsigned char *line, int x, int w, int kind)
 {
-	int a, b, m, W;
+	uint32_t word, prev, bits;
+	int i;
 
-	if (!line)
+	if (x >= w)
 		return w;
 
-	/* We assume w > 0, -1 <= x < w */
-	if (x < 0)
+	i = x >> 5;
+	word = load_word(line, i);
+	prev = i > 0 ? line[(i << 2) - 1] & 1 : 0;
+	bits = word ^ ((word >> 1) | (prev << 31));
+	if (kind == CHANGE_TO_BLACK)
+		bits &= word;
+	else if (kind == CHANGE_TO_WHITE)
+		bits &= ~word;
+	bits &= 0xFFFFFFFFU >> (x & 31);
+
+	while (bits == 0)
 	{
-		x = 0;
-		m = 0xFF;
+		if ((++i << 5) >= w)
+			return w;
+		prev = word & 1;
+		word = load_word(line, i);
+		bits = word ^ ((word >> 1) | (prev << 31));
+		if (kind == CHANGE_TO_BLACK)
+			bits &= word;
+		else if (kind == CHANGE_TO_WHITE)
+			bits &= ~word;
 	}
-	else
-	{
-		/* Mask out the bits we've already used (including the one
-		 * we started from) */
-		m = mask[x & 7];
-	}
-	/* We have 'w' pixels (bits) in line. The last pixel that can be
-	 * safely accessed is the (w-1)th bit of line.
-	 * By taking W = w>>3, we know that the first W bytes of line are
-	 * full, with w&7 stray bits following. */
-	W = w>>3;
-	x >>= 3;
-	a = line[x]; /* Safe as x < w => x <= w-1 => x>>3 <= (w-1)>>3 */
-	b = a ^ (a>>1);
-	b &= m;
-	if (x >= W)
-	{
-		/* Within the last byte already */
-		x = (x<<3) + clz[b];
-		if (x > w)
-			x = w;
-		return x;
-	}
-	while (b == 0)
-	{
-		if (++x >= W)
-			goto nearend;
-		b = a & 1;
-		a = line[x];
-		b = (b<<7) ^ a ^ (a>>1);
-	}
-	return (x<<3) + clz[b];
-nearend:
-	/* We have less than a byte to go. If no stray bits, exit now. */
-	if ((x<<3) == w)
-		return w;
-	b = a&1;
-	a = line[x];
-	b = (b<<7) ^ a ^ (a>>1);
-	x = (x<<3) + clz[b];
-	if (x > w)
-		x = w;
-	return x;
+
+	x = (i << 5) + clz32(bits);
+	return x < w ? x : w;
 }
 
 static inline int
-find_changing_color(const unsigned char *line, int x, int w, int color)
+find_changing(const unsigned char *line, int x, int w)
 {
-	if (!line || x >= w)
+	if (!line)
 		return w;
 
-	x = find_changing(line, (x > 0 || !color) ? x : -1, w);
+	/* We assume w > 0, -1 <= x < w */
+	return scan_changing(line, x + 1, w, CHANGE_ANY);
+}
 
-	if (x < w && getbit(line, x) != color)
-		x = find_changing(line, x, w);
+static inline int
+find_changing_color(const unsigned char *line, int x, int w, int color)
+{
+	if (!line)
+		return w;
 
-	return x;
+	/* Changes onto the first pixel only count if we have not
+	 * started the line yet (or are looking for a black pixel). */
+	return scan_changing(line, x > 0 ? x + 1 : 0, w, color ? CHANGE_TO_BLACK : CHANGE_TO_WHITE);
 }
 
 static const unsigned char lm[8] = {
@@ -284,8 +294,11 @@ static inline void setbits(unsigned char *line, int x0, int x1)
 	else
 	{
 		line[a0] |= lm[b0];
-		for (a = a0 + 1; a < a1; a++)
-			line[a] = 0xFF;
+		if (a1 - a0 > 8)
+			memset(line + a0 + 1, 0xFF, a1 - a0 - 1);
+		else
+			for (a = a0 + 1; a < a1; a++)
+				line[a] = 0xFF;
 		if (b1)
 			line[a1] |= rm[b1];
 	}
@@ -349,7 +362,7 @@ fill_bits(fz_context *ctx, fz_faxd *fax)
 		if (c == EOF)
 			return EOF;
 		fax->bidx -= 8;
-		fax->word |= c << fax->bidx;
+		fax->word |= (unsigned int)c << fax->bidx;
 	}
 	return 0;
 }
@@ -375,8 +388,8 @@ get_code(fz_context *ctx, fz_faxd *fax, const cfd_node *table, int initialbits)
 	return val;
 }
 
-/* decode one 1d code */
-static void
+/* decode one 1d code, returning non-zero on error */
+static int
 dec1d(fz_context *ctx, fz_faxd *fax)
 {
 	int code;
@@ -390,13 +403,22 @@ dec1d(fz_context *ctx, fz_faxd *fax)
 		code = get_code(ctx, fax, cf_white_decode, cfd_white_initial_bits);
 
 	if (code == UNCOMPRESSED)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+	{
+		fz_warn(ctx, "uncompressed data in faxd");
+		return 1;
+	}
 
 	if (code < 0)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "negative code in 1d faxd");
+	{
+		fz_warn(ctx, "negative code in 1d faxd");
+		return 1;
+	}
 
 	if (fax->a + code > fax->columns)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "overflow in 1d faxd");
+	{
+		fz_warn(ctx, "overflow in 1d faxd");
+		return 1;
+	}
 
 	if (fax->c)
 		setbits(fax->dst, fax->a, fax->a + code);
@@ -410,10 +432,12 @@ dec1d(fz_context *ctx, fz_faxd *fax)
 	}
 	else
 		fax->stage = STATE_MAKEUP;
+
+	return 0;
 }
 
-/* decode one 2d code */
-static void
+/* decode one 2d code, returning non-zero on error */
+static int
 dec2d(fz_context *ctx, fz_faxd *fax)
 {
 	int code, b1, b2;
@@ -429,13 +453,22 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 			code = get_code(ctx, fax, cf_white_decode, cfd_white_initial_bits);
 
 		if (code == UNCOMPRESSED)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+		{
+			fz_warn(ctx, "uncompressed data in faxd");
+			return 1;
+		}
 
 		if (code < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "negative code in 2d faxd");
+		{
+			fz_warn(ctx, "negative code in 2d faxd");
+			return 1;
+		}
 
 		if (fax->a + code > fax->columns)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "overflow in 2d faxd");
+		{
+			fz_warn(ctx, "overflow in 2d faxd");
+			return 1;
+		}
 
 		if (fax->c)
 			setbits(fax->dst, fax->a, fax->a + code);
@@ -451,7 +484,7 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 				fax->stage = STATE_NORMAL;
 		}
 
-		return;
+		return 0;
 	}
 
 	code = get_code(ctx, fax, cf_2d_decode, cfd_2d_initial_bits);
@@ -528,14 +561,19 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 		break;
 
 	case UNCOMPRESSED:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+		fz_warn(ctx, "uncompressed data in faxd");
+		return 1;
 
 	case ERROR:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid code in 2d faxd");
+		fz_warn(ctx, "invalid code in 2d faxd");
+		return 1;
 
 	default:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid code in 2d faxd (%d)", code);
+		fz_warn(ctx, "invalid code in 2d faxd (%d)", code);
+		return 1;
 	}
+
+	return 0;
 }
 
 static int
@@ -617,26 +655,14 @@ loop:
 	else if (fax->dim == 1)
 	{
 		fax->eolc = 0;
-		fz_try(ctx)
-		{
-			dec1d(ctx, fax);
-		}
-		fz_catch(ctx)
-		{
+		if (dec1d(ctx, fax))
 			goto error;
-		}
 	}
 	else if (fax->dim == 2)
 	{
 		fax->eolc = 0;
-		fz_try(ctx)
-		{
-			dec2d(ctx, fax);
-		}
-		fz_catch(ctx)
-		{
+		if (dec2d(ctx, fax))
 			goto error;
-		}
 	}
 
 	/* no eol check after makeup codes nor in the middle of an H code */
@@ -806,13 +832,11 @@ fz_open_faxd(fz_context *ctx, fz_stream *chain,
 		fax->dim = fax->k < 0 ? 2 : 1;
 		fax->eolc = 0;
 
-		fax->ref = fz_malloc(ctx, fax->stride);
-		fax->dst = fz_malloc(ctx, fax->stride);
+		/* pad the lines for the word-at-a-time scanning */
+		fax->ref = fz_calloc(ctx, fax->stride + 3, 1);
+		fax->dst = fz_calloc(ctx, fax->stride + 3, 1);
 		fax->rp = fax->dst;
 		fax->wp = fax->dst + fax->stride;
-
-		memset(fax->ref, 0, fax->stride);
-		memset(fax->dst, 0, fax->stride);
 	}
 	fz_catch(ctx)
 	{
@@ -64,16 +64,98 @@ fz_predict_tiff(fz_predict *state, unsigned char *out, unsigned char *in)
 	int left[FZ_MAX_COLORS];
 	int i, k;
 	const int mask = (1 << state->bpc)-1;
+	const int colors = state->colors;
+	const int columns = state->columns;
 
-	for (k = 0; k < state->colors; k++)
+	for (k = 0; k < colors; k++)
 		left[k] = 0;
 
-	/* special fast case */
+	/* special fast cases */
 	if (state->bpc == 8)
 	{
-		for (i = 0; i < state->columns; i++)
-			for (k = 0; k < state->colors; k++)
-				*out++ = left[k] = (*in++ + left[k]) & 0xFF;
+		if (colors == 1)
+		{
+			unsigned char g = 0;
+			for (i = 0; i < columns; i++)
+				*out++ = g = *in++ + g;
+		}
+		else if (colors == 3)
+		{
+			unsigned char r = 0, g = 0, b = 0;
+			for (i = 0; i < columns; i++)
+			{
+				out[0] = r = in[0] + r;
+				out[1] = g = in[1] + g;
+				out[2] = b = in[2] + b;
+				in += 3;
+				out += 3;
+			}
+		}
+		else if (colors == 4)
+		{
+			unsigned char c = 0, m = 0, y = 0, K = 0;
+			for (i = 0; i < columns; i++)
+			{
+				out[0] = c = in[0] + c;
+				out[1] = m = in[1] + m;
+				out[2] = y = in[2] + y;
+				out[3] = K = in[3] + K;
+				in += 4;
+				out += 4;
+			}
+		}
+		else
+		{
+			for (i = 0; i < columns; i++)
+				for (k = 0; k < colors; k++)
+					*out++ = left[k] = (*in++ + left[k]) & 0xFF;
+		}
+		return;
+	}
+
+	if (state->bpc == 16)
+	{
+		for (i = 0; i < columns; i++)
+		{
+			for (k = 0; k < colors; k++)
+			{
+				int c = (((in[0]<<8) | in[1]) + left[k]) & 0xFFFF;
+				out[0] = c >> 8;
+				out[1] = c;
+				left[k] = c;
+				in += 2;
+				out += 2;
+			}
+		}
+		return;
+	}
+
+	/* Adding 1 bit samples is an xor, so a byte's worth of single
+	 * component samples is a prefix xor, flipped by the last sample of
+	 * the previous byte. Padding bits at the end are left clear. */
+	if (state->bpc == 1 && colors == 1)
+	{
+		int n = columns >> 3;
+		int x, carry = 0;
+		for (i = 0; i < n; i++)
+		{
+			x = in[i];
+			x ^= x >> 1;
+			x ^= x >> 2;
+			x ^= x >> 4;
+			x ^= -carry & 0xFF;
+			out[i] = x;
+			carry = x & 1;
+		}
+		if (columns & 7)
+		{
+			x = in[n];
+			x ^= x >> 1;
+			x ^= x >> 2;
+			x ^= x >> 4;
+			x ^= -carry & 0xFF;
+			out[n] = x & (0xFF00 >> (columns & 7));
+		}
 		return;
 	}
 
@@ -81,77 +163,203 @@ fz_predict_tiff(fz_predict *state, unsigned char *out, unsigned char *in)
 	if (state->bpc < 8)
 		memset(out, 0, state->stride);
 
-	for (i = 0; i < state->columns; i++)
+	for (i = 0; i < columns; i++)
 	{
-		for (k = 0; k < state->colors; k++)
+		for (k = 0; k < colors; k++)
 		{
-			int a = getcomponent(in, i * state->colors + k, state->bpc);
+			int a = getcomponent(in, i * colors + k, state->bpc);
 			int b = a + left[k];
 			int c = b & mask;
-			putcomponent(out, i * state->colors + k, state->bpc, c);
+			putcomponent(out, i * colors + k, state->bpc, c);
 			left[k] = c;
 		}
 	}
 }
 
+#ifdef ARCH_X86_SSE2
+#include <emmintrin.h>
+
+/*
+SSE2 versions of the PNG predictors. Up works on 16 bytes at a time.
+Sub, Average and Paeth depend on the pixel to the left, so they work a
+pixel at a time instead, with every byte of the pixel widened to 16
+bits and handled in parallel. They give exactly the same results as
+the C versions.
+*/
+
+/* Load an n byte group (n is 4 or 8) widened to 16 bits per byte. */
+static inline __m128i
+load_pixel_sse2(const unsigned char *p, int n)
+{
+	__m128i v;
+	if (n == 4)
+	{
+		int i;
+		memcpy(&i, p, 4);
+		v = _mm_cvtsi32_si128(i);
+	}
+	else
+		v = _mm_loadl_epi64((const __m128i *)p);
+	return _mm_unpacklo_epi8(v, _mm_setzero_si128());
+}
+
+static inline void
+store_pixel_sse2(unsigned char *p, int n, __m128i v)
+{
+	v = _mm_packus_epi16(v, v);
+	if (n == 4)
+	{
+		int i = _mm_cvtsi128_si32(v);
+		memcpy(p, &i, 4);
+	}
+	else
+		_mm_storel_epi64((__m128i *)p, v);
+}
+
+static inline __m128i
+abs_epi16_sse2(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline __m128i
+select_sse2(__m128i m, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+/* Decode as much of a row as can be done with whole 4 or 8 byte
+ * accesses, for pixels of 3, 4, 6 or 8 bytes, and return how many
+ * bytes were done. A 3 (or 6) byte pixel is handled as 4 (or 8) bytes
+ * whose last byte is garbage; this is overwritten by the next pixel. */
+static size_t
+predict_png_pixels_sse2(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len, int bpp, int predictor)
+{
+	const int n = bpp <= 4 ? 4 : 8;
+	const __m128i lo = _mm_set1_epi16(0xFF);
+	__m128i a = _mm_setzero_si128();
+	__m128i c = _mm_setzero_si128();
+	__m128i b, x, pa, pb, pc, m;
+	size_t i;
+
+	for (i = 0; i + n <= len; i += bpp)
+	{
+		x = load_pixel_sse2(in + i, n);
+		b = load_pixel_sse2(ref + i, n);
+		switch (predictor)
+		{
+		case 1:
+			x = _mm_add_epi16(x, a);
+			break;
+		case 3:
+			x = _mm_add_epi16(x, _mm_srli_epi16(_mm_add_epi16(a, b), 1));
+			break;
+		default:
+			/* The definitions of pa and pb are correct, not a typo. */
+			pa = _mm_sub_epi16(b, c);
+			pb = _mm_sub_epi16(a, c);
+			pc = abs_epi16_sse2(_mm_add_epi16(pa, pb));
+			pa = abs_epi16_sse2(pa);
+			pb = abs_epi16_sse2(pb);
+			m = _mm_min_epi16(pa, _mm_min_epi16(pb, pc));
+			x = _mm_add_epi16(x, select_sse2(_mm_cmpeq_epi16(pa, m), a,
+				select_sse2(_mm_cmpeq_epi16(pb, m), b, c)));
+			c = b;
+			break;
+		}
+		a = _mm_and_si128(x, lo);
+		store_pixel_sse2(out + i, n, a);
+	}
+
+	return i;
+}
+
+static size_t
+predict_png_up_sse2(unsigned char *out, const unsigned char *in, const unsigned char *ref, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(ref + i));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_add_epi8(x, y));
+	}
+
+	return i;
+}
+#endif /* ARCH_X86_SSE2 */
+
 static void
 fz_predict_png(fz_predict *state, unsigned char *out, unsigned char *in, size_t len, int predictor)
 {
 	int bpp = state->bpp;
-	size_t i;
+	size_t i = 0;
 	unsigned char *ref = state->ref;
 
 	if ((size_t)bpp > len)
 		bpp = (int)len;
 
+#ifdef ARCH_X86_SSE2
+	if (predictor == 2)
+		i = predict_png_up_sse2(out, in, ref, len);
+	else if ((predictor == 1 || predictor == 3 || predictor == 4) &&
+		(bpp == 3 || bpp == 4 || bpp == 6 || bpp == 8))
+		i = predict_png_pixels_sse2(out, in, ref, len, bpp, predictor);
+#endif
+
+	/* Single byte pixels (grey, and most xref streams) are common
+	 * enough to keep the left hand pixels in registers. */
+	if (bpp == 1 && i == 0)
+	{
+		unsigned char a = 0, c = 0;
+		switch (predictor)
+		{
+		case 1:
+			for (i = 0; i < len; i++)
+				out[i] = a = in[i] + a;
+			return;
+		case 3:
+			for (i = 0; i < len; i++)
+				out[i] = a = in[i] + ((a + ref[i]) >> 1);
+			return;
+		case 4:
+			for (i = 0; i < len; i++)
+			{
+				unsigned char b = ref[i];
+				out[i] = a = in[i] + paeth(a, b, c);
+				c = b;
+			}
+			return;
+		}
+	}
+
 	switch (predictor)
 	{
 	case 0:
 		memcpy(out, in, len);
 		break;
 	case 1:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out = *in++ + out[-bpp];
-			out++;
-		}
+		for (; i < (size_t)bpp; i++)
+			out[i] = in[i];
+		for (; i < len; i++)
+			out[i] = in[i] + out[i - bpp];
 		break;
 	case 2:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + *ref++;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out++ = *in++ + *ref++;
-		}
+		for (; i < len; i++)
+			out[i] = in[i] + ref[i];
 		break;
 	case 3:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + (*ref++) / 2;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out = *in++ + (out[-bpp] + *ref++) / 2;
-			out++;
-		}
+		for (; i < (size_t)bpp; i++)
+			out[i] = in[i] + ref[i] / 2;
+		for (; i < len; i++)
+			out[i] = in[i] + (out[i - bpp] + ref[i]) / 2;
 		break;
 	case 4:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + paeth(0, *ref++, 0);
-		}
-		for (i = len - bpp; i > 0; i --)
-		{
-			*out = *in++ + paeth(out[-bpp], *ref, ref[-bpp]);
-			ref++;
-			out++;
-		}
+		for (; i < (size_t)bpp; i++)
+			out[i] = in[i] + paeth(0, ref[i], 0);
+		for (; i < len; i++)
+			out[i] = in[i] + paeth(out[i - bpp], ref[i], ref[i - bpp]);
 		break;
 	}
 }
@@ -170,8 +378,10 @@ next_predict(fz_context *ctx, fz_stream *stm, size_t len)
 		len = sizeof(state->buffer);
 	ep = buf + len;
 
-	while (state->rp < state->wp && p < ep)
-		*p++ = *state->rp++;
+	n = fz_mini(state->wp - state->rp, ep - p);
+	memcpy(p, state->rp, n);
+	p += n;
+	state->rp += n;
 
 	while (p < ep)
 	{
@@ -192,8 +402,10 @@ next_predict(fz_context *ctx, fz_stream *stm, size_t len)
 		state->rp = state->out;
 		state->wp = state->out + n - ispng;
 
-		while (state->rp < state->wp && p < ep)
-			*p++ = *state->rp++;
+		n = fz_mini(state->wp - state->rp, ep - p);
+		memcpy(p, state->rp, n);
+		p += n;
+		state->rp += n;
 	}
 
 	stm->rp = buf;
@@ -66,6 +66,8 @@ struct fz_tuning_context_s
 	void *image_decode_arg;
 	fz_tune_image_scale_fn *image_scale;
 	void *image_scale_arg;
+	fz_tune_run_jobs_fn *run_jobs;
+	void *run_jobs_arg;
 };
 
 fz_tune_image_decode_fn fz_default_image_decode;
@@ -73,6 +75,15 @@ fz_tune_image_scale_fn fz_default_image_scale;
 
 fz_context *fz_clone_context_internal(fz_context *ctx);
 
+/*
+	fz_can_run_parallel_jobs: Returns non-zero if fz_run_jobs may
+	hand jobs to other threads. Callers use this to avoid splitting
+	work into pieces that would only be run one after another.
+
+	For internal use only.
+*/
+int fz_can_run_parallel_jobs(fz_context *ctx);
+
 void fz_new_aa_context(fz_context *ctx);
 void fz_drop_aa_context(fz_context *ctx);
 void fz_copy_aa_context(fz_context *dst, fz_context *src);
@@ -81,6 +92,19 @@ void fz_new_glyph_cache_context(fz_context *ctx);
 fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
 
+void fz_new_pixmap_pool_context(fz_context *ctx);
+fz_pixmap_pool *fz_keep_pixmap_pool_context(fz_context *ctx);
+void fz_drop_pixmap_pool_context(fz_context *ctx);
+
+/*
+	fz_scavenge_pixmap_pool: Free every buffer held by the pixmap
+	pool. Called by the scavenger with the alloc lock held. Returns
+	non-zero if anything was freed.
+
+	For internal use only.
+*/
+int fz_scavenge_pixmap_pool(fz_context *ctx);
+
 void fz_new_document_handler_context(fz_context *ctx);
 void fz_drop_document_handler_context(fz_context *ctx);
 fz_document_handler_context *fz_keep_document_handler_context(fz_context *ctx);
@@ -10,6 +10,8 @@ struct fz_font_s
 	fz_font_flags_t flags;
 
 	void *ft_face; /* has an FT_Face if used */
+	void **ft_spare; /* copies of ft_face for other threads to render with */
+	int ft_spare_count;
 	fz_shaper_data_t shaper_data;
 
 	fz_matrix t3matrix;
@@ -34,6 +36,9 @@ struct fz_font_s
 	short width_default; /* in 1000 units */
 	short *width_table; /* in 1000 units */
 
+	/* identifies the font's glyph outlines in the store, once it has any */
+	int outline_id;
+
 	/* cached glyph metrics */
 	float *advance_cache;
 
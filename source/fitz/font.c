@@ -14,6 +14,7 @@
 
 #define MAX_BBOX_TABLE_SIZE 4096
 #define MAX_ADVANCE_CACHE 4096
+#define MAX_SPARE_FACES 32
 
 #ifndef FT_SFNT_OS2
 #define FT_SFNT_OS2 ft_sfnt_os2
@@ -142,8 +143,11 @@ fz_drop_font(fz_context *ctx, fz_font *font)
 	if (font->ft_face)
 	{
 		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		for (i = 0; i < font->ft_spare_count; i++)
+			FT_Done_Face((FT_Face)font->ft_spare[i]);
 		fterr = FT_Done_Face((FT_Face)font->ft_face);
 		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_free(ctx, font->ft_spare);
 		if (fterr)
 			fz_warn(ctx, "freetype finalizing face: %s", ft_error_string(fterr));
 		fz_drop_freetype(ctx);
@@ -296,6 +300,27 @@ fz_font *fz_load_system_cjk_font(fz_context *ctx, const char *name, int ros, int
 	return font;
 }
 
+/* Fallback fonts are loaded lazily, possibly from several threads at
+ * once (see fz_run_jobs). Keep whichever copy is installed first. */
+static fz_font *
+install_fallback_font(fz_context *ctx, fz_font **slot, fz_font *font)
+{
+	fz_font *old;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	old = *slot;
+	if (!old)
+		*slot = font;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (old)
+	{
+		fz_drop_font(ctx, font);
+		return old;
+	}
+	return font;
+}
+
 fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int serif, int bold, int italic)
 {
 	const char *data;
@@ -330,20 +355,16 @@ fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int se
 			return ctx->font->fallback[index].serif;
 		data = fz_lookup_noto_font(ctx, script, language, 1, &size);
 		if (data)
-		{
-			ctx->font->fallback[index].serif = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
-			return ctx->font->fallback[index].serif;
-		}
+			return install_fallback_font(ctx, &ctx->font->fallback[index].serif,
+				fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
 
 	if (ctx->font->fallback[index].sans)
 		return ctx->font->fallback[index].sans;
 	data = fz_lookup_noto_font(ctx, script, language, 0, &size);
 	if (data)
-	{
-		ctx->font->fallback[index].sans = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
-		return ctx->font->fallback[index].sans;
-	}
+		return install_fallback_font(ctx, &ctx->font->fallback[index].sans,
+			fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 
 	return NULL;
 }
@@ -356,7 +377,8 @@ fz_font *fz_load_fallback_symbol_font(fz_context *ctx)
 	{
 		data = fz_lookup_noto_symbol_font(ctx, &size);
 		if (data)
-			ctx->font->symbol = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			return install_fallback_font(ctx, &ctx->font->symbol,
+				fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
 	return ctx->font->symbol;
 }
@@ -369,7 +391,8 @@ fz_font *fz_load_fallback_emoji_font(fz_context *ctx)
 	{
 		data = fz_lookup_noto_emoji_font(ctx, &size);
 		if (data)
-			ctx->font->emoji = fz_new_font_from_memory(ctx, NULL, data, size, 0, 0);
+			return install_fallback_font(ctx, &ctx->font->emoji,
+				fz_new_font_from_memory(ctx, NULL, data, size, 0, 0));
 	}
 	return ctx->font->emoji;
 }
@@ -500,6 +523,153 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 	return font;
 }
 
+/*
+ * Shared fonts are kept in the store, keyed by the MD5 of the font file
+ * and the parameters it was loaded with. The store owns one reference
+ * to the font through a small storable wrapper, so dropping the wrapper
+ * (when the store is emptied, or runs short of space) leaves the font
+ * alive for as long as anyone else is still using it.
+ */
+
+typedef struct
+{
+	fz_storable storable;
+	fz_font *font;
+} shared_font;
+
+typedef struct
+{
+	int refs;
+	unsigned char digest[16];
+} shared_font_key;
+
+static void
+drop_shared_font_imp(fz_context *ctx, fz_storable *sf_)
+{
+	shared_font *sf = (shared_font *)sf_;
+	fz_drop_font(ctx, sf->font);
+	fz_free(ctx, sf);
+}
+
+static int
+make_hash_shared_font_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	shared_font_key *key = (shared_font_key *)key_;
+	hash->u.pd.ptr = NULL;
+	memcpy(hash->u.pd.digest, key->digest, 16);
+	return 1;
+}
+
+static void *
+keep_shared_font_key(fz_context *ctx, void *key_)
+{
+	shared_font_key *key = (shared_font_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+drop_shared_font_key(fz_context *ctx, void *key_)
+{
+	shared_font_key *key = (shared_font_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+cmp_shared_font_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	shared_font_key *k0 = (shared_font_key *)k0_;
+	shared_font_key *k1 = (shared_font_key *)k1_;
+	return memcmp(k0->digest, k1->digest, 16);
+}
+
+static void
+print_shared_font_key(fz_context *ctx, fz_output *out, void *key_)
+{
+	shared_font_key *key = (shared_font_key *)key_;
+	int i;
+	fz_printf(ctx, out, "(shared font ");
+	for (i = 0; i < 16; i++)
+		fz_printf(ctx, out, "%02x", key->digest[i]);
+	fz_printf(ctx, out, ") ");
+}
+
+static fz_store_type shared_font_store_type =
+{
+	make_hash_shared_font_key,
+	keep_shared_font_key,
+	drop_shared_font_key,
+	cmp_shared_font_key,
+	print_shared_font_key
+};
+
+fz_font *
+fz_new_shared_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, int index, int use_glyph_bbox)
+{
+	shared_font_key *key = NULL;
+	shared_font *sf = NULL;
+	shared_font *existing;
+	fz_font *font = NULL;
+	int params[3];
+	fz_md5 md5;
+
+	fz_var(key);
+	fz_var(sf);
+	fz_var(font);
+
+	params[0] = index;
+	params[1] = !!use_glyph_bbox;
+	params[2] = name ? (int)strlen(name) : -1;
+
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, shared_font_key);
+		key->refs = 1;
+		fz_md5_init(&md5);
+		fz_md5_update(&md5, (unsigned char *)params, sizeof params);
+		if (name)
+			fz_md5_update(&md5, (const unsigned char *)name, strlen(name));
+		fz_md5_update(&md5, buffer->data, buffer->len);
+		fz_md5_final(&md5, key->digest);
+
+		sf = fz_find_item(ctx, drop_shared_font_imp, key, &shared_font_store_type);
+		if (sf)
+			font = fz_keep_font(ctx, sf->font);
+		else
+		{
+			font = fz_new_font_from_buffer(ctx, name, buffer, index, use_glyph_bbox);
+
+			sf = fz_malloc_struct(ctx, shared_font);
+			FZ_INIT_STORABLE(sf, 1, drop_shared_font_imp);
+			sf->font = fz_keep_font(ctx, font);
+
+			existing = fz_store_item(ctx, key, sf, buffer->len, &shared_font_store_type);
+			if (existing)
+			{
+				/* Someone else loaded the same font at the same time. */
+				fz_drop_storable(ctx, &sf->storable);
+				fz_drop_font(ctx, font);
+				sf = existing;
+				font = fz_keep_font(ctx, sf->font);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		if (sf)
+			fz_drop_storable(ctx, &sf->storable);
+		if (key)
+			drop_shared_font_key(ctx, key);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_font(ctx, font);
+		fz_rethrow(ctx);
+	}
+
+	return font;
+}
+
 fz_font *
 fz_new_font_from_memory(fz_context *ctx, const char *name, const char *data, int len, int index, int use_glyph_bbox)
 {
@@ -528,8 +698,89 @@ fz_new_font_from_file(fz_context *ctx, const char *name, const char *path, int i
 	return font;
 }
 
+/*
+	FreeType faces hold the size, transform and glyph slot of the
+	glyph last loaded, so only one thread at a time may load glyphs
+	from a face. Everything else that uses a font's ft_face does so
+	under the freetype lock, but holding that lock while rendering
+	glyphs would let only one thread render text at a time.
+
+	So when there can be several threads (because we have real
+	locks), fonts keep a stack of spare copies of their face, made
+	from the same font file, and a thread that needs to render lends
+	itself one of them (making a new one if none are free) for as long
+	as it needs it. Only making and destroying faces, which FreeType
+	requires to be serialised, and taking spares from and returning
+	them to the stack, happen under the freetype lock. There are never
+	more spares than threads rendering at once from the same font (or
+	MAX_SPARE_FACES, after which extra copies are thrown away when
+	done with).
+
+	Without real locks there is only ever one thread, so the font's
+	own face is used, as it always has been.
+
+	fz_borrow_ft_face returns either a spare face, or the font's own
+	face with the freetype lock held. Either way, pass it back to
+	fz_return_ft_face when done.
+*/
+static FT_Face
+fz_borrow_ft_face(fz_context *ctx, fz_font *font)
+{
+	FT_Face face = NULL;
+	void **spare = NULL;
+	int fterr;
+
+	if (ctx->locks == &fz_locks_default || !font->buffer)
+	{
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		return font->ft_face;
+	}
+
+	/* Allocate the stack before taking the lock. */
+	if (!font->ft_spare)
+		spare = fz_malloc_no_throw(ctx, MAX_SPARE_FACES * sizeof(void *));
+
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	if (!font->ft_spare)
+	{
+		font->ft_spare = spare;
+		spare = NULL;
+	}
+	if (font->ft_spare_count > 0)
+		face = font->ft_spare[--font->ft_spare_count];
+	else
+	{
+		fterr = FT_New_Memory_Face(ctx->font->ftlib, font->buffer->data, (FT_Long)font->buffer->len,
+			((FT_Face)font->ft_face)->face_index, &face);
+		if (fterr)
+		{
+			/* Make do with the font's own face. */
+			fz_free(ctx, spare);
+			return font->ft_face;
+		}
+	}
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+
+	fz_free(ctx, spare);
+	return face;
+}
+
+static void
+fz_return_ft_face(fz_context *ctx, fz_font *font, FT_Face face)
+{
+	if (face != font->ft_face)
+	{
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		if (font->ft_spare && font->ft_spare_count < MAX_SPARE_FACES)
+			font->ft_spare[font->ft_spare_count++] = face;
+		else
+			FT_Done_Face(face);
+	}
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+}
+
 static fz_matrix *
-fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, int gid, fz_matrix *trm)
+fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, FT_Face face, int gid, fz_matrix *trm)
 {
 	/* Fudge the font matrix to stretch the glyph if we've substituted the font. */
 	if (font->flags.ft_stretch && font->width_table /* && font->wmode == 0 */)
@@ -538,11 +789,9 @@ fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, int gid, fz_matrix *trm
 		float subw;
 		float realw;
 
-		fz_lock(ctx, FZ_LOCK_FREETYPE);
-		FT_Get_Advance(font->ft_face, gid, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM, &adv);
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		FT_Get_Advance(face, gid, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM, &adv);
 
-		realw = (float)adv * 1000 / ((FT_Face)font->ft_face)->units_per_EM;
+		realw = (float)adv * 1000 / face->units_per_EM;
 		if (gid < font->width_count)
 			subw = font->width_table[gid];
 		else
@@ -574,11 +823,10 @@ pixmap_from_ft_bitmap(fz_context *ctx, int left, int top, FT_Bitmap *bitmap)
 		return fz_new_pixmap_from_8bpp_data(ctx, left, top - bitmap->rows, bitmap->width, bitmap->rows, bitmap->buffer + (bitmap->rows-1)*bitmap->pitch, -bitmap->pitch);
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* face must have been borrowed with fz_borrow_ft_face */
 static FT_GlyphSlot
-do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, int aa)
+do_ft_render_glyph(fz_context *ctx, fz_font *font, FT_Face face, int gid, const fz_matrix *trm, int aa)
 {
-	FT_Face face = font->ft_face;
 	FT_Matrix m;
 	FT_Vector v;
 	FT_Error fterr;
@@ -586,7 +834,7 @@ do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm
 
 	float strength = fz_matrix_expansion(trm) * 0.02f;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &local_trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &local_trm);
 
 	if (font->flags.fake_italic)
 		fz_pre_shear(&local_trm, SHEAR, 0);
@@ -606,7 +854,6 @@ do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm
 	v.x = local_trm.e * 64;
 	v.y = local_trm.f * 64;
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
 	fterr = FT_Set_Char_Size(face, 65536, 65536, 72, 72); /* should be 64, 64 */
 	if (fterr)
 		fz_warn(ctx, "freetype setting character size: %s", ft_error_string(fterr));
@@ -677,22 +924,18 @@ retry_unhinted:
 fz_pixmap *
 fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, int aa)
 {
-	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa);
-	fz_pixmap *pixmap;
-
-	if (slot == NULL)
-	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
-		return NULL;
-	}
+	FT_Face face = fz_borrow_ft_face(ctx, font);
+	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, face, gid, trm, aa);
+	fz_pixmap *pixmap = NULL;
 
 	fz_try(ctx)
 	{
-		pixmap = pixmap_from_ft_bitmap(ctx, slot->bitmap_left, slot->bitmap_top, &slot->bitmap);
+		if (slot)
+			pixmap = pixmap_from_ft_bitmap(ctx, slot->bitmap_left, slot->bitmap_top, &slot->bitmap);
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_return_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -702,26 +945,21 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const fz_matr
 	return pixmap;
 }
 
-/* The glyph cache lock is always taken when this is called. */
 fz_glyph *
 fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, int aa)
 {
-	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa);
-	fz_glyph *glyph;
-
-	if (slot == NULL)
-	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
-		return NULL;
-	}
+	FT_Face face = fz_borrow_ft_face(ctx, font);
+	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, face, gid, trm, aa);
+	fz_glyph *glyph = NULL;
 
 	fz_try(ctx)
 	{
-		glyph = glyph_from_ft_bitmap(ctx, slot->bitmap_left, slot->bitmap_top, &slot->bitmap);
+		if (slot)
+			glyph = glyph_from_ft_bitmap(ctx, slot->bitmap_left, slot->bitmap_top, &slot->bitmap);
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_return_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -731,11 +969,10 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm
 	return glyph;
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* face must have been borrowed with fz_borrow_ft_face */
 static FT_Glyph
-do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, const fz_matrix *ctm, const fz_stroke_state *state)
+do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, FT_Face face, int gid, const fz_matrix *trm, const fz_matrix *ctm, const fz_stroke_state *state)
 {
-	FT_Face face = font->ft_face;
 	float expansion = fz_matrix_expansion(ctm);
 	int linewidth = state->linewidth * expansion * 64 / 2;
 	FT_Matrix m;
@@ -747,7 +984,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 	FT_Stroker_LineCap line_cap;
 	fz_matrix local_trm = *trm;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &local_trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &local_trm);
 
 	if (font->flags.fake_italic)
 		fz_pre_shear(&local_trm, SHEAR, 0);
@@ -759,7 +996,6 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 	v.x = local_trm.e * 64;
 	v.y = local_trm.f * 64;
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
 	fterr = FT_Set_Char_Size(face, 65536, 65536, 72, 72); /* should be 64, 64 */
 	if (fterr)
 	{
@@ -829,24 +1065,21 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 fz_pixmap *
 fz_render_ft_stroked_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, const fz_matrix *ctm, const fz_stroke_state *state)
 {
-	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state);
+	FT_Face face = fz_borrow_ft_face(ctx, font);
+	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, face, gid, trm, ctm, state);
 	FT_BitmapGlyph bitmap = (FT_BitmapGlyph)glyph;
-	fz_pixmap *pixmap;
-
-	if (bitmap == NULL)
-	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
-		return NULL;
-	}
+	fz_pixmap *pixmap = NULL;
 
 	fz_try(ctx)
 	{
-		pixmap = pixmap_from_ft_bitmap(ctx, bitmap->left, bitmap->top, &bitmap->bitmap);
+		if (bitmap)
+			pixmap = pixmap_from_ft_bitmap(ctx, bitmap->left, bitmap->top, &bitmap->bitmap);
 	}
 	fz_always(ctx)
 	{
-		FT_Done_Glyph(glyph);
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		if (glyph)
+			FT_Done_Glyph(glyph);
+		fz_return_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -859,24 +1092,21 @@ fz_render_ft_stroked_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, const
 fz_glyph *
 fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm, const fz_matrix *ctm, const fz_stroke_state *state)
 {
-	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state);
+	FT_Face face = fz_borrow_ft_face(ctx, font);
+	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, face, gid, trm, ctm, state);
 	FT_BitmapGlyph bitmap = (FT_BitmapGlyph)glyph;
-	fz_glyph *result;
-
-	if (bitmap == NULL)
-	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
-		return NULL;
-	}
+	fz_glyph *result = NULL;
 
 	fz_try(ctx)
 	{
-		result = glyph_from_ft_bitmap(ctx, bitmap->left, bitmap->top, &bitmap->bitmap);
+		if (bitmap)
+			result = glyph_from_ft_bitmap(ctx, bitmap->left, bitmap->top, &bitmap->bitmap);
 	}
 	fz_always(ctx)
 	{
-		FT_Done_Glyph(glyph);
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		if (glyph)
+			FT_Done_Glyph(glyph);
+		fz_return_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -889,7 +1119,7 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, const fz_mat
 static fz_rect *
 fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 {
-	FT_Face face = font->ft_face;
+	FT_Face face = fz_borrow_ft_face(ctx, font);
 	FT_Error fterr;
 	FT_BBox cbox;
 	FT_Matrix m;
@@ -905,7 +1135,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	const float strength = 0.02f;
 	fz_matrix local_trm = fz_identity;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &local_trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &local_trm);
 
 	if (font->flags.fake_italic)
 		fz_pre_shear(&local_trm, SHEAR, 0);
@@ -926,7 +1156,6 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 		ft_flags = FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING;
 	}
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
 	/* Set the char size to scale=face->units_per_EM to effectively give
 	 * us unscaled results. This avoids quantisation. We then apply the
 	 * scale ourselves below. */
@@ -939,7 +1168,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	if (fterr)
 	{
 		fz_warn(ctx, "freetype load glyph (gid %d): %s", gid, ft_error_string(fterr));
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_return_ft_face(ctx, font, face);
 		bounds->x0 = bounds->x1 = local_trm.e;
 		bounds->y0 = bounds->y1 = local_trm.f;
 		return bounds;
@@ -952,7 +1181,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	}
 
 	FT_Outline_Get_CBox(&face->glyph->outline, &cbox);
-	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	fz_return_ft_face(ctx, font, face);
 	bounds->x0 = cbox.xMin * recip;
 	bounds->y0 = cbox.yMin * recip;
 	bounds->x1 = cbox.xMax * recip;
@@ -1032,26 +1261,112 @@ static const FT_Outline_Funcs outline_funcs = {
 	move_to, line_to, conic_to, cubic_to, 0, 0
 };
 
-fz_path *
-fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm)
+/*
+ * Glyph outlines are kept in the store, so that text that is too big
+ * for the glyph cache, or is stroked or clipped to, does not need to
+ * go back to FreeType every time. They are stored as they are in the
+ * font (scaled to a 1 unit em square, with any width adjustment and
+ * fake italic of the font applied), and are transformed when used.
+ *
+ * The key holds an id for the font rather than a reference to it, so
+ * that the store does not keep fonts alive; the outlines of fonts
+ * that have been dropped are simply never found again, and are
+ * evicted in due course.
+ */
+
+typedef struct
+{
+	fz_storable storable;
+	fz_path *path;
+} glyph_outline;
+
+typedef struct
+{
+	int refs;
+	int font_id;
+	int gid;
+	int flags;
+} glyph_outline_key;
+
+static void
+drop_glyph_outline_imp(fz_context *ctx, fz_storable *outline_)
+{
+	glyph_outline *outline = (glyph_outline *)outline_;
+	fz_drop_path(ctx, outline->path);
+	fz_free(ctx, outline);
+}
+
+static int
+make_hash_glyph_outline_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	glyph_outline_key *key = (glyph_outline_key *)key_;
+	int ids[4];
+	ids[0] = key->font_id;
+	ids[1] = key->gid;
+	ids[2] = key->flags;
+	ids[3] = 0;
+	hash->u.pd.ptr = NULL;
+	memcpy(hash->u.pd.digest, ids, 16);
+	return 1;
+}
+
+static void *
+keep_glyph_outline_key(fz_context *ctx, void *key_)
+{
+	glyph_outline_key *key = (glyph_outline_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+drop_glyph_outline_key(fz_context *ctx, void *key_)
+{
+	glyph_outline_key *key = (glyph_outline_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+cmp_glyph_outline_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	glyph_outline_key *k0 = (glyph_outline_key *)k0_;
+	glyph_outline_key *k1 = (glyph_outline_key *)k1_;
+	return k0->font_id != k1->font_id || k0->gid != k1->gid || k0->flags != k1->flags;
+}
+
+static void
+print_glyph_outline_key(fz_context *ctx, fz_output *out, void *key_)
+{
+	glyph_outline_key *key = (glyph_outline_key *)key_;
+	fz_printf(ctx, out, "(glyph outline font=%d gid=%d) ", key->font_id, key->gid);
+}
+
+static fz_store_type glyph_outline_store_type =
+{
+	make_hash_glyph_outline_key,
+	keep_glyph_outline_key,
+	drop_glyph_outline_key,
+	cmp_glyph_outline_key,
+	print_glyph_outline_key
+};
+
+static fz_path *
+fz_load_ft_glyph_outline(fz_context *ctx, fz_font *font, int gid, size_t *size)
 {
 	struct closure cc;
-	FT_Face face = font->ft_face;
+	FT_Face face = fz_borrow_ft_face(ctx, font);
 	int fterr;
-	fz_matrix local_trm = *trm;
+	fz_matrix local_trm = fz_identity;
 	int ft_flags;
 
 	const int scale = face->units_per_EM;
 	const float recip = 1 / (float)scale;
 	const float strength = 0.02f;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &local_trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &local_trm);
 
 	if (font->flags.fake_italic)
 		fz_pre_shear(&local_trm, SHEAR, 0);
 
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
-
 	if (font->flags.force_hinting)
 	{
 		ft_flags = FT_LOAD_NO_BITMAP | FT_LOAD_IGNORE_TRANSFORM;
@@ -1068,7 +1383,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *tr
 	if (fterr)
 	{
 		fz_warn(ctx, "freetype load glyph (gid %d): %s", gid, ft_error_string(fterr));
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_return_ft_face(ctx, font, face);
 		return NULL;
 	}
 
@@ -1078,6 +1393,9 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *tr
 		FT_Outline_Translate(&face->glyph->outline, -strength * 0.5 * scale, -strength * 0.5 * scale);
 	}
 
+	/* Roughly what the path will take. */
+	*size = sizeof(glyph_outline) + 64 + face->glyph->outline.n_points * (2 * sizeof(float) + 1);
+
 	cc.path = NULL;
 	fz_try(ctx)
 	{
@@ -1087,21 +1405,91 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *tr
 		fz_moveto(ctx, cc.path, cc.trm.e, cc.trm.f);
 		FT_Outline_Decompose(&face->glyph->outline, &outline_funcs, &cc);
 		fz_closepath(ctx, cc.path);
+		fz_trim_path(ctx, cc.path);
 	}
 	fz_always(ctx)
 	{
-		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_return_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
 		fz_warn(ctx, "freetype cannot decompose outline");
-		fz_free(ctx, cc.path);
+		fz_drop_path(ctx, cc.path);
 		return NULL;
 	}
 
 	return cc.path;
 }
 
+fz_path *
+fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm)
+{
+	glyph_outline_key *key = NULL;
+	glyph_outline *outline = NULL;
+	glyph_outline *existing;
+	fz_path *path = NULL;
+	size_t size;
+
+	fz_var(key);
+	fz_var(outline);
+	fz_var(path);
+
+	if (font->outline_id == 0)
+	{
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		if (font->outline_id == 0)
+			font->outline_id = fz_gen_id(ctx);
+		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	}
+
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, glyph_outline_key);
+		key->refs = 1;
+		key->font_id = font->outline_id;
+		key->gid = gid;
+		key->flags = font->flags.fake_bold | (font->flags.fake_italic << 1) | (font->flags.force_hinting << 2);
+
+		outline = fz_find_item(ctx, drop_glyph_outline_imp, key, &glyph_outline_store_type);
+		if (!outline)
+		{
+			outline = fz_malloc_struct(ctx, glyph_outline);
+			FZ_INIT_STORABLE(outline, 1, drop_glyph_outline_imp);
+			outline->path = fz_load_ft_glyph_outline(ctx, font, gid, &size);
+			if (outline->path)
+			{
+				existing = fz_store_item(ctx, key, outline, size, &glyph_outline_store_type);
+				if (existing)
+				{
+					fz_drop_storable(ctx, &outline->storable);
+					outline = existing;
+				}
+			}
+		}
+
+		if (outline->path)
+		{
+			path = fz_clone_path(ctx, outline->path);
+			fz_transform_path(ctx, path, trm);
+		}
+	}
+	fz_always(ctx)
+	{
+		if (key)
+			drop_glyph_outline_key(ctx, key);
+		if (outline)
+			fz_drop_storable(ctx, &outline->storable);
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "cannot outline glyph (gid %d)", gid);
+		fz_drop_path(ctx, path);
+		return NULL;
+	}
+
+	return path;
+}
+
 /*
  * Type 3 fonts...
  */
@@ -1472,10 +1860,20 @@ fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
 		{
 			if (!font->advance_cache)
 			{
+				float *cache;
 				int i;
-				font->advance_cache = fz_malloc_array(ctx, font->glyph_count, sizeof(float));
+				cache = fz_malloc_array(ctx, font->glyph_count, sizeof(float));
 				for (i = 0; i < font->glyph_count; ++i)
-					font->advance_cache[i] = fz_advance_ft_glyph(ctx, font, i, 0);
+					cache[i] = fz_advance_ft_glyph(ctx, font, i, 0);
+				/* Only publish the table once it is complete. */
+				fz_lock(ctx, FZ_LOCK_FREETYPE);
+				if (!font->advance_cache)
+				{
+					font->advance_cache = cache;
+					cache = NULL;
+				}
+				fz_unlock(ctx, FZ_LOCK_FREETYPE);
+				fz_free(ctx, cache);
 			}
 			return font->advance_cache[gid];
 		}
@@ -1498,14 +1896,30 @@ fz_encode_character(fz_context *ctx, fz_font *font, int ucs)
 			int ix = ucs & 0xFF;
 			if (!font->encoding_cache[pg])
 			{
+				uint16_t *cache;
 				int i;
-				font->encoding_cache[pg] = fz_malloc_array(ctx, 256, sizeof(uint16_t));
-				for (i = 0; i < 256; ++i)
-					font->encoding_cache[pg][i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
+				cache = fz_malloc_array(ctx, 256, sizeof(uint16_t));
+				fz_lock(ctx, FZ_LOCK_FREETYPE);
+				if (!font->encoding_cache[pg])
+				{
+					for (i = 0; i < 256; ++i)
+						cache[i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
+					font->encoding_cache[pg] = cache;
+					cache = NULL;
+				}
+				fz_unlock(ctx, FZ_LOCK_FREETYPE);
+				fz_free(ctx, cache);
 			}
 			return font->encoding_cache[pg][ix];
 		}
-		return FT_Get_Char_Index(font->ft_face, ucs);
+		else
+		{
+			int gid;
+			fz_lock(ctx, FZ_LOCK_FREETYPE);
+			gid = FT_Get_Char_Index(font->ft_face, ucs);
+			fz_unlock(ctx, FZ_LOCK_FREETYPE);
+			return gid;
+		}
 	}
 	return ucs;
 }
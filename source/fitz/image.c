@@ -185,8 +185,35 @@ fz_unblend_masked_tile(fz_context *ctx, fz_pixmap *tile, fz_image *image)
 	fz_drop_pixmap(ctx, mask);
 }
 
-fz_pixmap *
-fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor)
+/* Skip over image data, seeking rather than decoding if the stream
+ * allows it (uncompressed data in memory, or the DCT decoder). */
+static size_t
+skip_image_data(fz_context *ctx, fz_stream *stm, size_t len)
+{
+	fz_off_t pos;
+
+	if (!stm->seek)
+		return fz_skip(ctx, stm, len);
+
+	pos = fz_tell(ctx, stm);
+	fz_seek(ctx, stm, len, SEEK_CUR);
+	return (size_t)(fz_tell(ctx, stm) - pos);
+}
+
+/* Can we box filter this image from its packed bits while unpacking it?
+ * Only for 1 bit images whose decoding is at most an inversion. */
+static int
+can_unpack_mono_subsampled(fz_compressed_image *cimg, int indexed)
+{
+	fz_image *image = &cimg->super;
+
+	if (image->n != 1 || image->bpc != 1 || indexed || image->use_colorkey)
+		return 0;
+	return !image->use_decode || (image->decode[0] == 1 && image->decode[1] == 0);
+}
+
+static fz_pixmap *
+decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra)
 {
 	fz_image *image = &cimg->super;
 	fz_pixmap *tile = NULL;
@@ -195,6 +222,8 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 	int f = 1<<l2factor;
 	int w = image->w;
 	int h = image->h;
+	int mono = 0;
+	int invert;
 
 	if (subarea)
 	{
@@ -255,12 +284,19 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 	fz_var(tile);
 	fz_var(samples);
 
+	/* Subsample bilevel images as we unpack them */
+	if (l2extra && *l2extra > 0 && can_unpack_mono_subsampled(cimg, indexed))
+		mono = *l2extra;
+
 	fz_try(ctx)
 	{
 		int alpha = (image->colorspace == NULL);
 		if (image->use_colorkey)
 			alpha = 1;
-		tile = fz_new_pixmap(ctx, image->colorspace, w, h, alpha);
+		if (mono)
+			tile = fz_new_pixmap(ctx, image->colorspace, (w + (1<<mono) - 1) >> mono, (h + (1<<mono) - 1) >> mono, alpha);
+		else
+			tile = fz_new_pixmap(ctx, image->colorspace, w, h, alpha);
 		tile->interpolate = image->interpolate;
 
 		stride = (w * image->n * image->bpc + 7) / 8;
@@ -276,12 +312,10 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 			int l_margin = subarea->x0 >> l2factor;
 			int t_margin = subarea->y0 >> l2factor;
 			int r_margin = (image->w + f - 1 - subarea->x1) >> l2factor;
-			int b_margin = (image->h + f - 1 - subarea->y1) >> l2factor;
 			int l_skip = (l_margin * image->n * image->bpc)/8;
 			int r_skip = (r_margin * image->n * image->bpc + 7)/8;
 			size_t t_skip = t_margin * stream_stride + l_skip;
-			size_t b_skip = b_margin * stream_stride + r_skip;
-			size_t l = fz_skip(ctx, stm, t_skip);
+			size_t l = skip_image_data(ctx, stm, t_skip);
 			len = 0;
 			if (l == t_skip)
 			{
@@ -295,12 +329,12 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 						break;
 					if (--hh == 0)
 						break;
-					l = fz_skip(ctx, stm, r_skip + l_skip);
+					l = skip_image_data(ctx, stm, r_skip + l_skip);
 					if (l < (size_t)(r_skip + l_skip))
 						break;
 				}
 				while (1);
-				(void)fz_skip(ctx, stm, r_skip + b_skip);
+				/* The rows below the subarea are never decoded. */
 			}
 		}
 		else
@@ -315,17 +349,26 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 			memset(samples + len, 0, stride * h - len);
 		}
 
-		/* Invert 1-bit image masks */
-		if (image->imagemask)
+		/* Invert 1-bit image masks; 0=opaque and 1=transparent.
+		 * A [1 0] decode array on a 1-bit image is an inversion too. */
+		invert = image->imagemask;
+		if (mono && image->use_decode)
+			invert = !invert;
+		if (invert)
 		{
-			/* 0=opaque and 1=transparent so we need to invert */
 			unsigned char *p = samples;
 			len = h * stride;
 			for (i = 0; i < len; i++)
 				p[i] = ~p[i];
 		}
 
-		fz_unpack_tile(ctx, tile, samples, image->n, image->bpc, stride, indexed);
+		if (mono)
+		{
+			fz_unpack_mono_tile_subsampled(ctx, tile, samples, w, h, stride, mono);
+			*l2extra = 0;
+		}
+		else
+			fz_unpack_tile(ctx, tile, samples, image->n, image->bpc, stride, indexed);
 
 		fz_free(ctx, samples);
 		samples = NULL;
@@ -342,7 +385,7 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 			fz_drop_pixmap(ctx, tile);
 			tile = conv;
 		}
-		else if (image->use_decode)
+		else if (image->use_decode && !mono)
 		{
 			fz_decode_tile(ctx, tile, image->decode);
 		}
@@ -365,6 +408,12 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 	return tile;
 }
 
+fz_pixmap *
+fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor)
+{
+	return decomp_image_from_stream(ctx, stm, cimg, subarea, indexed, l2factor, NULL);
+}
+
 void
 fz_drop_image_imp(fz_context *ctx, fz_storable *image_)
 {
@@ -436,7 +485,8 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_JPX:
-		tile = fz_load_jpx(ctx, image->buffer->buffer->data, image->buffer->buffer->len, NULL, 0);
+		tile = fz_load_jpx_subarea(ctx, image->buffer->buffer->data, image->buffer->buffer->len, NULL, 0, subarea, l2factor);
+		can_sub = 1;
 		break;
 	case FZ_IMAGE_JPEG:
 		/* Scan JPEG stream and patch missing height values in header */
@@ -465,7 +515,7 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 
 		indexed = fz_colorspace_is_indexed(ctx, image->super.colorspace);
 		can_sub = 1;
-		tile = fz_decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor);
+		tile = decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor, l2factor);
 
 		/* CMYK JPEGs in XPS documents have to be inverted */
 		if (image->super.invert_cmyk_jpeg &&
@@ -547,13 +597,140 @@ void fz_default_image_decode(void *arg, int w, int h, int l2factor, fz_irect *su
 	}
 }
 
+/* Size in device space of the given area of an image. */
+static void
+image_extent(fz_image *image, const fz_matrix *ctm, const fz_irect *rect, int *w, int *h)
+{
+	if (ctm)
+	{
+		float frac_w = (rect->x1 - rect->x0) / (float)image->w;
+		float frac_h = (rect->y1 - rect->y0) / (float)image->h;
+		float a = ctm->a * frac_w;
+		float b = ctm->b * frac_h;
+		float c = ctm->c * frac_w;
+		float d = ctm->d * frac_h;
+
+		*w = sqrtf(a * a + b * b);
+		*h = sqrtf(c * c + d * d);
+	}
+	else
+	{
+		*w = image->w;
+		*h = image->h;
+	}
+}
+
+/* Put a decoded tile into the store. Returns the tile to use, which may
+ * be one put there by a racing thread. Any failure here will just
+ * result in us not caching. */
+static fz_pixmap *
+store_image_tile(fz_context *ctx, fz_image *image, int l2factor, const fz_irect *rect, fz_pixmap *tile)
+{
+	fz_image_key *keyp = NULL;
+
+	fz_var(keyp);
+	fz_try(ctx)
+	{
+		fz_pixmap *existing_tile;
+
+		keyp = fz_malloc_struct(ctx, fz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image_store_key(ctx, image);
+		keyp->l2factor = l2factor;
+		keyp->rect = *rect;
+		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
+		if (existing_tile)
+		{
+			/* We already have a tile. This must have been produced by a
+			 * racing thread. We'll throw away ours and use that one. */
+			fz_drop_pixmap(ctx, tile);
+			tile = existing_tile;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_image_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return tile;
+}
+
+/* Copy a tile, subsampling it by a further 2^factor. */
+static fz_pixmap *
+subsample_image_tile(fz_context *ctx, fz_pixmap *tile, int factor)
+{
+	fz_pixmap *copy = fz_new_pixmap(ctx, tile->colorspace, tile->w, tile->h, tile->alpha);
+	unsigned char *s = tile->samples;
+	unsigned char *d = copy->samples;
+	int y;
+
+	for (y = 0; y < tile->h; y++)
+	{
+		memcpy(d, s, (size_t)tile->w * tile->n);
+		s += tile->stride;
+		d += copy->stride;
+	}
+	copy->interpolate = tile->interpolate;
+	copy->xres = tile->xres;
+	copy->yres = tile->yres;
+
+	fz_try(ctx)
+		fz_subsample_pixmap(ctx, copy, factor);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, copy);
+		fz_rethrow(ctx);
+	}
+	return copy;
+}
+
+/*
+	Look for a cached tile of the area given by key at the given
+	l2factor. Failing that, a tile of the same area cached at a higher
+	resolution is subsampled down to the wanted l2factor, and the
+	result stored too, so that zooming out never needs the image to be
+	decoded again.
+*/
+static fz_pixmap *
+find_image_tile(fz_context *ctx, fz_image_key *key, int l2factor)
+{
+	fz_pixmap *tile = NULL;
+
+	for (key->l2factor = l2factor; key->l2factor >= 0; key->l2factor--)
+	{
+		tile = fz_find_item(ctx, fz_drop_pixmap_imp, key, &fz_image_store_type);
+		if (tile)
+			break;
+	}
+	if (!tile || key->l2factor == l2factor)
+		return tile;
+
+	fz_var(tile);
+
+	fz_try(ctx)
+	{
+		fz_pixmap *smaller = subsample_image_tile(ctx, tile, l2factor - key->l2factor);
+		fz_drop_pixmap(ctx, tile);
+		tile = store_image_tile(ctx, key->image, l2factor, &key->rect, smaller);
+		key->l2factor = l2factor;
+	}
+	fz_catch(ctx)
+	{
+		/* Just use the larger tile. */
+	}
+	return tile;
+}
+
 fz_pixmap *
 fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh)
 {
 	fz_pixmap *tile;
 	int l2factor, l2factor_remaining;
 	fz_image_key key;
-	fz_image_key *keyp;
 	int w;
 	int h;
 
@@ -624,23 +801,7 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	}
 
 	/* Based on that subarea, recalculate the extents */
-	if (ctm)
-	{
-		float frac_w = (key.rect.x1 - key.rect.x0) / (float)image->w;
-		float frac_h = (key.rect.y1 - key.rect.y0) / (float)image->h;
-		float a = ctm->a * frac_w;
-		float b = ctm->b * frac_h;
-		float c = ctm->c * frac_w;
-		float d = ctm->d * frac_h;
-
-		w = sqrtf(a * a + b * b);
-		h = sqrtf(c * c + d * d);
-	}
-	else
-	{
-		w = image->w;
-		h = image->h;
-	}
+	image_extent(image, ctm, &key.rect, &w, &h);
 
 	/* Return the true sizes to the caller */
 	if (dw)
@@ -658,18 +819,33 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	/* Can we find any suitable tiles in the cache? */
 	key.refs = 1;
 	key.image = image;
-	key.l2factor = l2factor;
-	do
+	tile = find_image_tile(ctx, &key, l2factor);
+
+	/* A subarea can be drawn from a cached tile of the whole image. */
+	if (!tile && (key.rect.x0 != 0 || key.rect.y0 != 0 || key.rect.x1 != image->w || key.rect.y1 != image->h))
 	{
-		tile = fz_find_item(ctx, fz_drop_pixmap_imp, &key, &fz_image_store_type);
+		fz_image_key whole = key;
+		whole.rect.x0 = 0;
+		whole.rect.y0 = 0;
+		whole.rect.x1 = image->w;
+		whole.rect.y1 = image->h;
+		tile = find_image_tile(ctx, &whole, l2factor);
 		if (tile)
 		{
-			update_ctm_for_subarea(ctm, &key.rect, image->w, image->h);
-			return tile;
+			key.rect = whole.rect;
+			image_extent(image, ctm, &key.rect, &w, &h);
+			if (dw)
+				*dw = w;
+			if (dh)
+				*dh = h;
 		}
-		key.l2factor--;
 	}
-	while (key.l2factor >= 0);
+
+	if (tile)
+	{
+		update_ctm_for_subarea(ctm, &key.rect, image->w, image->h);
+		return tile;
+	}
 
 	/* We'll have to decode the image; request the correct amount of
 	 * downscaling. */
@@ -686,37 +862,8 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 		fz_subsample_pixmap(ctx, tile, l2factor_remaining);
 	}
 
-	/* Now we try to cache the pixmap. Any failure here will just result
-	 * in us not caching. */
-	fz_var(keyp);
-	fz_try(ctx)
-	{
-		fz_pixmap *existing_tile;
-
-		keyp = fz_malloc_struct(ctx, fz_image_key);
-		keyp->refs = 1;
-		keyp->image = fz_keep_image_store_key(ctx, image);
-		keyp->l2factor = l2factor;
-		keyp->rect = key.rect;
-		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
-		if (existing_tile)
-		{
-			/* We already have a tile. This must have been produced by a
-			 * racing thread. We'll throw away ours and use that one. */
-			fz_drop_pixmap(ctx, tile);
-			tile = existing_tile;
-		}
-	}
-	fz_always(ctx)
-	{
-		fz_drop_image_key(ctx, keyp);
-	}
-	fz_catch(ctx)
-	{
-		/* Do nothing */
-	}
-
-	return tile;
+	/* Now we try to cache the pixmap. */
+	return store_image_tile(ctx, image, l2factor, &key.rect, tile);
 }
 
 static size_t
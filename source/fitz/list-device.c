@@ -5,6 +5,13 @@ typedef struct fz_list_device_s fz_list_device;
 
 #define STACK_SIZE 96
 
+/* The spatial index covers runs of nodes at each nesting depth up to
+ * INDEX_DEPTH, in INDEX_LEVELS sizes of about INDEX_RUN, INDEX_RUN^2,
+ * ... nodes. */
+#define INDEX_DEPTH 32
+#define INDEX_LEVELS 3
+#define INDEX_RUN 16
+
 typedef enum fz_display_command_e
 {
 	FZ_CMD_FILL_PATH,
@@ -109,6 +116,21 @@ enum {
 	MAX_NODE_SIZE = (1<<9)-sizeof(fz_display_node)
 };
 
+/* The spatial index is a list of runs of nodes, sorted by where they
+ * start (longest first). Each run is balanced, in that it closes every
+ * clip, group, mask and tile that it opens, and no node in or after it
+ * depends on the state (colors, ctm and so on) set by nodes before it.
+ * So a run whose rect misses the area being drawn can be jumped over
+ * without reading it. */
+typedef struct fz_display_run_s fz_display_run;
+
+struct fz_display_run_s
+{
+	int start;
+	int end;
+	fz_rect rect;
+};
+
 struct fz_display_list_s
 {
 	fz_storable storable;
@@ -116,6 +138,16 @@ struct fz_display_list_s
 	fz_rect mediabox;
 	int max;
 	int len;
+	fz_display_run *index;
+	int index_max;
+	int index_len;
+};
+
+enum
+{
+	VALID_RECT = 1,
+	VALID_ALPHA = 2,
+	VALID_CTM = 4,
 };
 
 struct fz_list_device_s
@@ -131,6 +163,7 @@ struct fz_list_device_s
 	fz_colorspace *colorspace;
 	float color[FZ_MAX_COLORS];
 	fz_rect rect;
+	int valid; /* which of rect, alpha and ctm hold what was last written */
 
 	int top;
 	struct {
@@ -138,6 +171,15 @@ struct fz_list_device_s
 		fz_rect rect;
 	} stack[STACK_SIZE];
 	int tiled;
+
+	/* Runs being gathered for the spatial index; start is -1 for none. */
+	int depth;
+	int nodes;
+	struct {
+		int start;
+		int first;
+		fz_rect rect;
+	} run[INDEX_DEPTH][INDEX_LEVELS];
 };
 
 enum { ISOLATED = 1, KNOCKOUT = 2 };
@@ -145,6 +187,182 @@ enum { ISOLATED = 1, KNOCKOUT = 2 };
 #define SIZE_IN_NODES(t) \
 	((t + sizeof(fz_display_node) - 1) / sizeof(fz_display_node))
 
+static int
+fz_display_command_opens(fz_display_command cmd)
+{
+	switch (cmd)
+	{
+	case FZ_CMD_CLIP_PATH:
+	case FZ_CMD_CLIP_STROKE_PATH:
+	case FZ_CMD_CLIP_TEXT:
+	case FZ_CMD_CLIP_STROKE_TEXT:
+	case FZ_CMD_CLIP_IMAGE_MASK:
+	case FZ_CMD_BEGIN_MASK:
+	case FZ_CMD_BEGIN_GROUP:
+	case FZ_CMD_BEGIN_TILE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int
+fz_display_command_closes(fz_display_command cmd)
+{
+	return cmd == FZ_CMD_POP_CLIP || cmd == FZ_CMD_END_GROUP || cmd == FZ_CMD_END_TILE;
+}
+
+/* Forget the state that nodes are written relative to, so that the
+ * nodes from here on can be read without reading any before them. */
+static void
+fz_list_reset_state(fz_context *ctx, fz_list_device *writer)
+{
+	fz_drop_path(ctx, writer->path);
+	writer->path = NULL;
+	fz_drop_stroke_state(ctx, writer->stroke);
+	writer->stroke = NULL;
+	fz_drop_colorspace(ctx, writer->colorspace);
+	writer->colorspace = NULL;
+	writer->valid = 0;
+}
+
+/* Returns 0 if the run could not be added. The index is only an aid,
+ * so this is not an error. */
+static int
+fz_add_display_run(fz_context *ctx, fz_display_list *list, int start, int end, const fz_rect *rect)
+{
+	int i;
+
+	if (list->index_len == list->index_max)
+	{
+		int newsize = list->index_max * 2;
+		if (newsize < 64)
+			newsize = 64;
+		fz_try(ctx)
+			list->index = fz_resize_array(ctx, list->index, newsize, sizeof(*list->index));
+		fz_catch(ctx)
+			return 0;
+		list->index_max = newsize;
+	}
+
+	/* Runs are added as they end, so the only ones that sort after
+	 * this are those inside it. */
+	i = list->index_len;
+	while (i > 0 && (list->index[i-1].start > start || (list->index[i-1].start == start && list->index[i-1].end < end)))
+		i--;
+	memmove(&list->index[i+1], &list->index[i], (list->index_len - i) * sizeof(*list->index));
+	list->index[i].start = start;
+	list->index[i].end = end;
+	list->index[i].rect = *rect;
+	list->index_len++;
+	return 1;
+}
+
+static int
+fz_display_run_size(int level)
+{
+	int size = INDEX_RUN;
+	while (level--)
+		size *= INDEX_RUN;
+	return size;
+}
+
+/* End the runs at the given depth, up to the given level, here. Runs
+ * too short to be worth jumping over are dropped. */
+static void
+fz_end_display_runs(fz_context *ctx, fz_list_device *writer, int depth, int levels)
+{
+	fz_display_list *list = writer->list;
+	int j, added = 0;
+
+	for (j = 0; j < levels; j++)
+	{
+		if (writer->run[depth][j].start < 0)
+			continue;
+		if (writer->nodes - writer->run[depth][j].first >= fz_display_run_size(j) / 2)
+			added |= fz_add_display_run(ctx, list, writer->run[depth][j].start, list->len, &writer->run[depth][j].rect);
+		writer->run[depth][j].start = -1;
+	}
+	if (added)
+		fz_list_reset_state(ctx, writer);
+}
+
+static void
+fz_begin_display_index_node(fz_context *ctx, fz_list_device *writer, fz_display_command cmd)
+{
+	int depth, j;
+
+	if (fz_display_command_closes(cmd) && writer->depth > 0)
+	{
+		writer->depth--;
+		if (writer->depth + 1 < INDEX_DEPTH)
+			fz_end_display_runs(ctx, writer, writer->depth + 1, INDEX_LEVELS);
+	}
+	else if (cmd == FZ_CMD_END_MASK)
+	{
+		/* An end_mask belongs to a mask that is open, so it can never
+		 * be part of a run. */
+		if (writer->depth < INDEX_DEPTH)
+			fz_end_display_runs(ctx, writer, writer->depth, INDEX_LEVELS);
+		return;
+	}
+
+	depth = writer->depth;
+	if (depth >= INDEX_DEPTH)
+		return;
+	for (j = 0; j < INDEX_LEVELS; j++)
+	{
+		if (writer->run[depth][j].start < 0)
+		{
+			writer->run[depth][j].start = writer->list->len;
+			writer->run[depth][j].first = writer->nodes;
+			writer->run[depth][j].rect = fz_empty_rect;
+		}
+	}
+}
+
+static void
+fz_end_display_index_node(fz_context *ctx, fz_list_device *writer, fz_display_command cmd, const fz_rect *rect)
+{
+	int depth = writer->depth;
+	int j;
+
+	writer->nodes++;
+	if (cmd == FZ_CMD_END_MASK || depth >= INDEX_DEPTH)
+	{
+		if (fz_display_command_opens(cmd))
+			writer->depth++;
+		return;
+	}
+
+	/* What a clip, group or mask covers is only known at its end, so
+	 * it is counted then. Tiles repeat their contents anywhere. */
+	if (cmd == FZ_CMD_BEGIN_TILE || cmd == FZ_CMD_END_TILE || cmd == FZ_CMD_RENDER_FLAGS || writer->tiled)
+		rect = &fz_infinite_rect;
+	else if (fz_display_command_opens(cmd))
+		rect = NULL;
+	else if (!rect)
+		rect = (writer->valid & VALID_RECT) ? &writer->rect : &fz_infinite_rect;
+	if (rect)
+		for (j = 0; j < INDEX_LEVELS; j++)
+			fz_union_rect(&writer->run[depth][j].rect, rect);
+
+	if (fz_display_command_opens(cmd))
+	{
+		writer->depth++;
+		return;
+	}
+
+	for (j = INDEX_LEVELS - 1; j >= 0; j--)
+	{
+		if (writer->run[depth][j].start >= 0 && writer->nodes - writer->run[depth][j].first >= fz_display_run_size(j))
+		{
+			fz_end_display_runs(ctx, writer, depth, j + 1);
+			break;
+		}
+	}
+}
+
 static void
 fz_append_display_node(
 	fz_context *ctx,
@@ -194,7 +412,33 @@ fz_append_display_node(
 		}
 		writer->top++;
 		break;
+	case FZ_CMD_BEGIN_MASK:
+		/* Nothing is drawn by the mask itself, so it does not add to
+		 * the rect of whatever encloses it. An alpha mask (or a
+		 * luminosity mask on a black backdrop) is zero outside its
+		 * contents, so its rect can be shrunk to fit them. */
+		if (writer->top < STACK_SIZE)
+		{
+			float bc = 0;
+			if (flags && colorspace && color)
+				fz_convert_color(ctx, fz_device_gray(ctx), &bc, colorspace, color);
+			rect_for_updates = !flags || (colorspace && color && bc <= 0);
+			writer->stack[writer->top].update = NULL;
+			writer->stack[writer->top].rect = fz_empty_rect;
+		}
+		writer->top++;
+		break;
 	case FZ_CMD_END_MASK:
+		if (writer->top > STACK_SIZE)
+			writer->top--;
+		else if (writer->top > 0)
+		{
+			fz_rect *update;
+			writer->top--;
+			update = writer->stack[writer->top].update;
+			if (update && writer->tiled == 0)
+				fz_intersect_rect(update, &writer->stack[writer->top].rect);
+		}
 		if (writer->top < STACK_SIZE)
 		{
 			writer->stack[writer->top].update = NULL;
@@ -202,6 +446,17 @@ fz_append_display_node(
 		}
 		writer->top++;
 		break;
+	case FZ_CMD_BEGIN_GROUP:
+		/* Pixels that the contents of a group leave untouched are
+		 * left untouched by the group as a whole, whatever its
+		 * blend mode, so its rect is shrunk to fit its contents. */
+		if (writer->top < STACK_SIZE)
+		{
+			rect_for_updates = 1;
+			writer->stack[writer->top].rect = fz_empty_rect;
+		}
+		writer->top++;
+		break;
 	case FZ_CMD_BEGIN_TILE:
 		writer->tiled++;
 		if (writer->top > 0 && writer->top <= STACK_SIZE)
@@ -213,7 +468,6 @@ fz_append_display_node(
 		writer->tiled--;
 		break;
 	case FZ_CMD_END_GROUP:
-		break;
 	case FZ_CMD_POP_CLIP:
 		if (writer->top > STACK_SIZE)
 		{
@@ -246,12 +500,14 @@ fz_append_display_node(
 		break;
 	}
 
+	fz_begin_display_index_node(ctx, writer, cmd);
+
 	size = 1; /* 1 for the fz_display_node */
 	node.cmd = cmd;
 
 	/* Figure out what we need to write, and the offsets at which we will
 	 * write it. */
-	if (rect_for_updates || (rect != NULL && (writer->rect.x0 != rect->x0 || writer->rect.y0 != rect->y0 || writer->rect.x1 != rect->x1 || writer->rect.y1 != rect->y1)))
+	if (rect_for_updates || (rect != NULL && (!(writer->valid & VALID_RECT) || writer->rect.x0 != rect->x0 || writer->rect.y0 != rect->y0 || writer->rect.x1 != rect->x1 || writer->rect.y1 != rect->y1)))
 	{
 		node.rect = 1;
 		rect_off = size;
@@ -410,7 +666,7 @@ fz_append_display_node(
 			size += n * SIZE_IN_NODES(sizeof(float));
 		}
 	}
-	if (alpha && (*alpha != writer->alpha))
+	if (alpha && (!(writer->valid & VALID_ALPHA) || *alpha != writer->alpha))
 	{
 		if (*alpha >= 1.0)
 			node.alpha = ALPHA_1;
@@ -423,17 +679,19 @@ fz_append_display_node(
 			node.alpha = ALPHA_PRESENT;
 		}
 	}
-	if (ctm && (ctm->a != writer->ctm.a || ctm->b != writer->ctm.b || ctm->c != writer->ctm.c || ctm->d != writer->ctm.d || ctm->e != writer->ctm.e || ctm->f != writer->ctm.f))
+	if (ctm && (!(writer->valid & VALID_CTM) || ctm->a != writer->ctm.a || ctm->b != writer->ctm.b || ctm->c != writer->ctm.c || ctm->d != writer->ctm.d || ctm->e != writer->ctm.e || ctm->f != writer->ctm.f))
 	{
 		int flags;
 
+		int all = !(writer->valid & VALID_CTM);
+
 		ctm_off = size;
 		flags = CTM_UNCHANGED;
-		if (ctm->a != writer->ctm.a || ctm->d != writer->ctm.d)
+		if (all || ctm->a != writer->ctm.a || ctm->d != writer->ctm.d)
 			flags = CTM_CHANGE_AD, size += SIZE_IN_NODES(2*sizeof(float));
-		if (ctm->b != writer->ctm.b || ctm->c != writer->ctm.c)
+		if (all || ctm->b != writer->ctm.b || ctm->c != writer->ctm.c)
 			flags |= CTM_CHANGE_BC, size += SIZE_IN_NODES(2*sizeof(float));
-		if (ctm->e != writer->ctm.e || ctm->f != writer->ctm.f)
+		if (all || ctm->e != writer->ctm.e || ctm->f != writer->ctm.f)
 			flags |= CTM_CHANGE_EF, size += SIZE_IN_NODES(2*sizeof(float));
 		node.ctm = flags;
 	}
@@ -512,6 +770,7 @@ fz_append_display_node(
 	{
 		fz_rect *out_rect = (fz_rect *)(void *)(&node_ptr[rect_off]);
 		writer->rect = *rect;
+		writer->valid |= VALID_RECT;
 		*out_rect = *rect;
 		if (rect_for_updates)
 			writer->stack[writer->top-1].update = out_rect;
@@ -584,6 +843,7 @@ fz_append_display_node(
 	if (node.alpha)
 	{
 		writer->alpha = *alpha;
+		writer->valid |= VALID_ALPHA;
 		if (alpha_off)
 		{
 			float *out_alpha = (float *)(void *)(&node_ptr[alpha_off]);
@@ -593,6 +853,7 @@ fz_append_display_node(
 	if (ctm_off)
 	{
 		float *out_ctm = (float *)(void *)(&node_ptr[ctm_off]);
+		writer->valid |= VALID_CTM;
 		if (node.ctm & CTM_CHANGE_AD)
 		{
 			writer->ctm.a = *out_ctm++ = ctm->a;
@@ -623,6 +884,8 @@ fz_append_display_node(
 		memcpy(out_private, private_data, private_data_len);
 	}
 	list->len += size;
+
+	fz_end_display_index_node(ctx, writer, cmd, rect);
 }
 
 static void
@@ -1116,6 +1379,7 @@ struct fz_list_tile_data_s
 	float xstep;
 	float ystep;
 	fz_rect view;
+	int id;
 };
 
 static int
@@ -1126,6 +1390,7 @@ fz_list_begin_tile(fz_context *ctx, fz_device *dev, const fz_rect *area, const f
 	tile.xstep = xstep;
 	tile.ystep = ystep;
 	tile.view = *view;
+	tile.id = id;
 	fz_append_display_node(
 		ctx,
 		dev,
@@ -1194,6 +1459,17 @@ fz_list_render_flags(fz_context *ctx, fz_device *dev, int set, int clear)
 		0); /* private_data_len */
 }
 
+static void
+fz_list_close_device(fz_context *ctx, fz_device *dev)
+{
+	fz_list_device *writer = (fz_list_device *)dev;
+
+	/* Runs at shallower depths than this hold clips or groups that
+	 * were never closed, whose extent we do not know. */
+	if (writer->depth < INDEX_DEPTH)
+		fz_end_display_runs(ctx, writer, writer->depth, INDEX_LEVELS);
+}
+
 static void
 fz_list_drop_device(fz_context *ctx, fz_device *dev)
 {
@@ -1208,6 +1484,7 @@ fz_device *
 fz_new_list_device(fz_context *ctx, fz_display_list *list)
 {
 	fz_list_device *dev;
+	int i, j;
 
 	dev = fz_new_device(ctx, sizeof(fz_list_device));
 
@@ -1239,6 +1516,7 @@ fz_new_list_device(fz_context *ctx, fz_display_list *list)
 
 	dev->super.render_flags = fz_list_render_flags;
 
+	dev->super.close_device = fz_list_close_device;
 	dev->super.drop_device = fz_list_drop_device;
 
 	dev->list = list;
@@ -1248,8 +1526,14 @@ fz_new_list_device(fz_context *ctx, fz_display_list *list)
 	dev->stroke = NULL;
 	dev->colorspace = fz_device_gray(ctx);
 	memset(dev->color, 0, sizeof(float)*FZ_MAX_COLORS);
+	dev->valid = VALID_RECT | VALID_ALPHA | VALID_CTM;
 	dev->top = 0;
 	dev->tiled = 0;
+	dev->depth = 0;
+	dev->nodes = 0;
+	for (i = 0; i < INDEX_DEPTH; i++)
+		for (j = 0; j < INDEX_LEVELS; j++)
+			dev->run[i][j].start = -1;
 
 	return &dev->super;
 }
@@ -1344,6 +1628,7 @@ fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 		node = next;
 	}
 	fz_free(ctx, list->list);
+	fz_free(ctx, list->index);
 	fz_free(ctx, list);
 }
 
@@ -1356,6 +1641,9 @@ fz_new_display_list(fz_context *ctx, const fz_rect *mediabox)
 	list->mediabox = mediabox ? *mediabox : fz_empty_rect;
 	list->max = 0;
 	list->len = 0;
+	list->index = NULL;
+	list->index_max = 0;
+	list->index_len = 0;
 	return list;
 }
 
@@ -1409,6 +1697,10 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 	fz_matrix trans_ctm;
 	int tile_skip_depth = 0;
 
+	/* The next run in the spatial index */
+	fz_display_run *run = list->index;
+	fz_display_run *run_end = list->index + list->index_len;
+
 	fz_var(colorspace);
 
 	if (!scissor)
@@ -1425,8 +1717,34 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 	for (; node != node_end ; node = next_node)
 	{
 		int empty;
-		fz_display_node n = *node;
+		fz_display_node n;
+
+		/* Jump over runs of nodes that would all be skipped, either
+		 * because we are skipping everything here anyway, or because
+		 * they lie outside the scissor. */
+		while (run != run_end && run->start < node - list->list)
+			run++;
+		while (run != run_end && run->start == node - list->list)
+		{
+			fz_rect run_rect;
+			if (clipped || tile_skip_depth)
+				break;
+			if (!tiled)
+			{
+				run_rect = run->rect;
+				fz_intersect_rect(fz_transform_rect(&run_rect, top_ctm), scissor);
+				if (fz_is_empty_rect(&run_rect))
+					break;
+			}
+			run++;
+		}
+		if (run != run_end && run->start == node - list->list)
+		{
+			next_node = &list->list[run->end];
+			continue;
+		}
 
+		n = *node;
 		next_node = node + n.size;
 
 		/* Check the cookie for aborting */
@@ -1680,7 +1998,7 @@ visible:
 				fz_rect tile_rect;
 				tiled++;
 				tile_rect = data->view;
-				cached = fz_begin_tile_id(ctx, dev, &rect, &tile_rect, data->xstep, data->ystep, &trans_ctm, n.flags);
+				cached = fz_begin_tile_id(ctx, dev, &rect, &tile_rect, data->xstep, data->ystep, &trans_ctm, data->id);
 				if (cached)
 					tile_skip_depth = 1;
 				break;
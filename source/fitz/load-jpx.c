@@ -465,6 +465,22 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace *de
 	return jpx_read_image(ctx, &state, data, size, defcs, indexed, 0);
 }
 
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace *defcs, int indexed, fz_irect *subarea, int *l2factor)
+{
+	fz_pixmap *pix = fz_load_jpx(ctx, data, size, defcs, indexed);
+
+	/* We always decode the whole image at full resolution. */
+	if (subarea)
+	{
+		subarea->x0 = 0;
+		subarea->y0 = 0;
+		subarea->x1 = pix->w;
+		subarea->y1 = pix->h;
+	}
+	return pix;
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -705,7 +721,7 @@ jpx_ycc_to_rgb(fz_context *ctx, fz_pixmap *pix)
 }
 
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace *defcs, int indexed, int onlymeta)
+jpx_read_image(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace *defcs, int indexed, int onlymeta, fz_irect *subarea, int reduce)
 {
 	fz_pixmap *img;
 	opj_dparameters_t params;
@@ -735,6 +751,7 @@ jpx_read_image(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace
 	opj_set_default_decoder_parameters(&params);
 	if (indexed)
 		params.flags |= OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG;
+	params.cp_reduce = reduce;
 
 	codec = opj_create_decompress(format);
 	opj_set_info_handler(codec, fz_opj_info_callback, ctx);
@@ -765,6 +782,33 @@ jpx_read_image(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	if (subarea)
+	{
+		/* Align the area to the reduced grid, so that the decoded
+		 * pixels line up with it exactly. The grid is that of the
+		 * reference grid, on which the image need not start at 0. */
+		int f = 1 << reduce;
+		int ix0 = (int)jpx->x0;
+		int iy0 = (int)jpx->y0;
+		int x0 = fz_maxi((ix0 + subarea->x0) & ~(f - 1), ix0);
+		int y0 = fz_maxi((iy0 + subarea->y0) & ~(f - 1), iy0);
+		int x1 = fz_mini((ix0 + subarea->x1 + f - 1) & ~(f - 1), (int)jpx->x1);
+		int y1 = fz_mini((iy0 + subarea->y1 + f - 1) & ~(f - 1), (int)jpx->y1);
+
+		subarea->x0 = x0 - ix0;
+		subarea->y0 = y0 - iy0;
+		subarea->x1 = x1 - ix0;
+		subarea->y1 = y1 - iy0;
+
+		if (!opj_set_decode_area(codec, jpx, x0, y0, x1, y1))
+		{
+			opj_stream_destroy(stream);
+			opj_destroy_codec(codec);
+			opj_image_destroy(jpx);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to set JPX decode area");
+		}
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
@@ -938,13 +982,59 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace *de
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, data, size, defcs, indexed, 0);
+		pix = jpx_read_image(ctx, data, size, defcs, indexed, 0, NULL, 0);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return pix;
+}
+
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, unsigned char *data, size_t size, fz_colorspace *defcs, int indexed, fz_irect *subarea, int *l2factor)
+{
+	fz_pixmap *pix = NULL;
+	int reduce = l2factor ? *l2factor : 0;
+
+	fz_var(reduce);
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		fz_try(ctx)
+		{
+			pix = jpx_read_image(ctx, data, size, defcs, indexed, 0, subarea, reduce);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow_if(ctx, FZ_ERROR_ABORT);
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			fz_rethrow_if(ctx, FZ_ERROR_OOM);
+			if (!subarea && reduce == 0)
+				fz_rethrow(ctx);
+			/* The codestream may have fewer resolution levels than
+			 * we asked to discard; fall back to a full decode. */
+			fz_warn(ctx, "cannot decode part of JPX image, decoding all of it");
+			reduce = 0;
+			pix = jpx_read_image(ctx, data, size, defcs, indexed, 0, NULL, 0);
+			if (subarea)
+			{
+				subarea->x0 = 0;
+				subarea->y0 = 0;
+				subarea->x1 = pix->w;
+				subarea->y1 = pix->h;
+			}
+		}
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 
+	if (l2factor)
+		*l2factor -= reduce;
 	return pix;
 }
 
@@ -956,7 +1046,7 @@ fz_load_jpx_info(fz_context *ctx, unsigned char *data, size_t size, int *wp, int
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		img = jpx_read_image(ctx, data, size, NULL, 0, 1);
+		img = jpx_read_image(ctx, data, size, NULL, 0, 1, NULL, 0);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
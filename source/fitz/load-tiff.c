@@ -1,4 +1,5 @@
 #include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 /*
  * TIFF image loader. Should be enough to support TIFF files in XPS.
@@ -11,7 +12,8 @@
 struct tiff
 {
 	/* "file" */
-	unsigned char *bp, *rp, *ep;
+	fz_stream *file;
+	unsigned file_size;
 
 	/* byte order */
 	unsigned order;
@@ -58,7 +60,7 @@ struct tiff
 
 	unsigned ycbcrsubsamp[2];
 
-	unsigned char *jpegtables; /* point into "file" buffer */
+	unsigned char *jpegtables;
 	unsigned jpegtableslen;
 
 	unsigned char *profile;
@@ -70,6 +72,9 @@ struct tiff
 	unsigned char *data;
 	int tilestride;
 	int stride;
+
+	/* the band of image rows held in samples */
+	unsigned y0, y1;
 };
 
 enum
@@ -248,9 +253,9 @@ tiff_expand_colormap(fz_context *ctx, struct tiff *tiff)
 
 	stride = tiff->imagewidth * (tiff->samplesperpixel + 2);
 
-	samples = fz_malloc(ctx, stride * tiff->imagelength);
+	samples = fz_malloc(ctx, stride * (tiff->y1 - tiff->y0));
 
-	for (y = 0; y < tiff->imagelength; y++)
+	for (y = 0; y < tiff->y1 - tiff->y0; y++)
 	{
 		src = tiff->samples + (unsigned int)(tiff->stride * y);
 		dst = samples + (unsigned int)(stride * y);
@@ -284,28 +289,29 @@ tiff_expand_colormap(fz_context *ctx, struct tiff *tiff)
 }
 
 static unsigned
-tiff_decode_data(fz_context *ctx, struct tiff *tiff, unsigned char *rp, unsigned int rlen, unsigned char *wp, unsigned int wlen)
+tiff_decode_data(fz_context *ctx, struct tiff *tiff, unsigned offset, unsigned rlen, unsigned char *wp, unsigned int wlen)
 {
-	fz_stream *stm;
+	fz_stream *stm = NULL;
 	unsigned i, size;
-	unsigned char *reversed = NULL;
+	unsigned char *rp;
 	fz_stream *jpegtables = NULL;
 	int old_tiff;
 
-	if (rp + rlen > tiff->ep)
+	if (offset > tiff->file_size || rlen > tiff->file_size - offset)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "strip extends beyond the end of the file");
 
-	/* the bits are in un-natural order */
-	if (tiff->fillorder == 2)
-	{
-		reversed = fz_malloc(ctx, rlen);
-		for (i = 0; i < rlen; i++)
-			reversed[i] = bitrev[rp[i]];
-		rp = reversed;
-	}
+	rp = fz_malloc(ctx, rlen);
 
 	fz_try(ctx)
 	{
+		fz_seek(ctx, tiff->file, offset, SEEK_SET);
+		rlen = (unsigned)fz_read(ctx, tiff->file, rp, rlen);
+
+		/* the bits are in un-natural order */
+		if (tiff->fillorder == 2)
+			for (i = 0; i < rlen; i++)
+				rp[i] = bitrev[rp[i]];
+
 		/* each decoder will close this */
 		stm = fz_open_memory(ctx, rp, rlen);
 
@@ -337,7 +343,7 @@ tiff_decode_data(fz_context *ctx, struct tiff *tiff, unsigned char *rp, unsigned
 					tiff->photometric == 0);
 			break;
 		case 5:
-			old_tiff = rp[0] == 0 && (rp[1] & 1);
+			old_tiff = rlen >= 2 && rp[0] == 0 && (rp[1] & 1);
 			stm = fz_open_lzwd(ctx, stm, old_tiff ? 0 : 1, 9, old_tiff ? 1 : 0, old_tiff);
 			break;
 		case 6:
@@ -382,7 +388,7 @@ tiff_decode_data(fz_context *ctx, struct tiff *tiff, unsigned char *rp, unsigned
 	fz_always(ctx)
 	{
 		fz_drop_stream(ctx, stm);
-		fz_free(ctx, reversed);
+		fz_free(ctx, rp);
 	}
 	fz_catch(ctx)
 		fz_rethrow(ctx);
@@ -395,7 +401,7 @@ tiff_paste_tile(fz_context *ctx, struct tiff *tiff, unsigned char *tile, unsigne
 {
 	unsigned int x, y, k;
 
-	for (y = 0; y < tiff->tilelength && row + y < tiff->imagelength; y++)
+	for (y = 0; y < tiff->tilelength && row + y < tiff->y1 - tiff->y0; y++)
 	{
 		for (x = 0; x < tiff->tilewidth && col + x < tiff->imagewidth; x++)
 		{
@@ -481,7 +487,7 @@ tiff_paste_subsampled_tile(fz_context *ctx, struct tiff *tiff, unsigned char *ti
 	assert(tiff->bitspersample == 8);
 
 	w = tiff->imagewidth;
-	h = tiff->imagelength;
+	h = tiff->y1 - tiff->y0;
 
 	sx = 0;
 	sy = 0;
@@ -555,7 +561,7 @@ static void
 tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 {
 	unsigned char *data;
-	unsigned x, y, wlen, tile;
+	unsigned row, col, wlen, tile;
 	unsigned tiles, tilesacross, tilesdown;
 
 	tilesdown = (tiff->imagelength + tiff->tilelength - 1) / tiff->tilelength;
@@ -575,23 +581,22 @@ tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 
 		data = tiff->data = fz_malloc(ctx, wlen);
 
-		tile = 0;
-		for (x = 0; x < tiff->imagelength; x += tiff->tilelength)
+		tile = tiff->y0 / tiff->tilelength * tilesacross;
+		for (row = tiff->y0; row < tiff->y1; row += tiff->tilelength)
 		{
-			for (y = 0; y < tiff->imagewidth; y += tiff->tilewidth)
+			for (col = 0; col < tiff->imagewidth; col += tiff->tilewidth)
 			{
 				unsigned int offset = tiff->tileoffsets[tile];
 				unsigned int rlen = tiff->tilebytecounts[tile];
-				unsigned char *rp = tiff->bp + offset;
 				unsigned decoded;
 
-				if (offset > (unsigned)(tiff->ep - tiff->bp))
+				if (offset > tiff->file_size)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile offset %u", offset);
-				if (rlen > (unsigned)(tiff->ep - rp))
+				if (rlen > tiff->file_size - offset)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile byte count %u", rlen);
 
-				decoded = tiff_decode_data(ctx, tiff, rp, rlen, data, wlen);
-				tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->tilewidth, tiff->tilelength, x, y);
+				decoded = tiff_decode_data(ctx, tiff, offset, rlen, data, wlen);
+				tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->tilewidth, tiff->tilelength, col, row - tiff->y0);
 				tile++;
 			}
 		}
@@ -601,24 +606,23 @@ tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 		wlen = tiff->tilelength * tiff->tilestride;
 		data = tiff->data = fz_malloc(ctx, wlen);
 
-		tile = 0;
-		for (x = 0; x < tiff->imagelength; x += tiff->tilelength)
+		tile = tiff->y0 / tiff->tilelength * tilesacross;
+		for (row = tiff->y0; row < tiff->y1; row += tiff->tilelength)
 		{
-			for (y = 0; y < tiff->imagewidth; y += tiff->tilewidth)
+			for (col = 0; col < tiff->imagewidth; col += tiff->tilewidth)
 			{
 				unsigned int offset = tiff->tileoffsets[tile];
 				unsigned int rlen = tiff->tilebytecounts[tile];
-				unsigned char *rp = tiff->bp + offset;
 
-				if (offset > (unsigned)(tiff->ep - tiff->bp))
+				if (offset > tiff->file_size)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile offset %u", offset);
-				if (rlen > (unsigned)(tiff->ep - rp))
+				if (rlen > tiff->file_size - offset)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile byte count %u", rlen);
 
-				if (tiff_decode_data(ctx, tiff, rp, rlen, data, wlen) != wlen)
+				if (tiff_decode_data(ctx, tiff, offset, rlen, data, wlen) != wlen)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "decoded tile is the wrong size");
 
-				tiff_paste_tile(ctx, tiff, data, x, y);
+				tiff_paste_tile(ctx, tiff, data, row - tiff->y0, col);
 				tile++;
 			}
 		}
@@ -654,44 +658,42 @@ tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 		wlen = rowsperstrip * tiff->stride;
 		data = tiff->data = fz_malloc(ctx, wlen);
 
-		strip = 0;
-		for (y = 0; y < tiff->imagelength; y += rowsperstrip)
+		strip = tiff->y0 / rowsperstrip;
+		for (y = tiff->y0; y < tiff->y1; y += rowsperstrip)
 		{
 			unsigned offset = tiff->stripoffsets[strip];
 			unsigned rlen = tiff->stripbytecounts[strip];
-			unsigned char *rp = tiff->bp + offset;
 			int decoded;
 
-			if (offset > (unsigned)(tiff->ep - tiff->bp))
+			if (offset > tiff->file_size)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip offset %u", offset);
-			if (rlen > (unsigned)(tiff->ep - rp))
+			if (rlen > tiff->file_size - offset)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip byte count %u", rlen);
 
-			decoded = tiff_decode_data(ctx, tiff, rp, rlen, data, wlen);
-			tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->imagewidth, tiff->rowsperstrip, 0, y);
+			decoded = tiff_decode_data(ctx, tiff, offset, rlen, data, wlen);
+			tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->imagewidth, tiff->rowsperstrip, 0, y - tiff->y0);
 			strip++;
 		}
 	}
 	else
 	{
-		strip = 0;
-		for (y = 0; y < tiff->imagelength; y += tiff->rowsperstrip)
+		strip = tiff->y0 / tiff->rowsperstrip;
+		for (y = tiff->y0; y < tiff->y1; y += tiff->rowsperstrip)
 		{
 			unsigned offset = tiff->stripoffsets[strip];
 			unsigned rlen = tiff->stripbytecounts[strip];
 			unsigned wlen = tiff->stride * tiff->rowsperstrip;
-			unsigned char *rp = tiff->bp + offset;
 
-			if (offset > (unsigned)(tiff->ep - tiff->bp))
+			if (offset > tiff->file_size)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip offset %u", offset);
-			if (rlen > (unsigned)(tiff->ep - rp))
+			if (rlen > tiff->file_size - offset)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip byte count %u", rlen);
 
 			/* if imagelength is not a multiple of rowsperstrip, adjust the expectation of the size of the decoded data */
 			if (y + tiff->rowsperstrip >= tiff->imagelength)
 				wlen = tiff->stride * (tiff->imagelength - y);
 
-			if (tiff_decode_data(ctx, tiff, rp, rlen, data, wlen) < wlen)
+			if (tiff_decode_data(ctx, tiff, offset, rlen, data, wlen) < wlen)
 			{
 				fz_warn(ctx, "premature end of data in decoded strip");
 				break;
@@ -703,69 +705,71 @@ tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 	}
 }
 
-static inline int tiff_readbyte(struct tiff *tiff)
+static inline int tiff_readbyte(fz_context *ctx, struct tiff *tiff)
 {
-	if (tiff->rp < tiff->ep)
-		return *tiff->rp++;
-	return EOF;
+	return fz_read_byte(ctx, tiff->file);
 }
 
-static inline unsigned readshort(struct tiff *tiff)
+static inline unsigned readshort(fz_context *ctx, struct tiff *tiff)
 {
-	unsigned a = tiff_readbyte(tiff);
-	unsigned b = tiff_readbyte(tiff);
+	unsigned a = tiff_readbyte(ctx, tiff);
+	unsigned b = tiff_readbyte(ctx, tiff);
 	if (tiff->order == TII)
 		return (b << 8) | a;
 	return (a << 8) | b;
 }
 
-static inline unsigned tiff_readlong(struct tiff *tiff)
+static inline unsigned tiff_readlong(fz_context *ctx, struct tiff *tiff)
 {
-	unsigned a = tiff_readbyte(tiff);
-	unsigned b = tiff_readbyte(tiff);
-	unsigned c = tiff_readbyte(tiff);
-	unsigned d = tiff_readbyte(tiff);
+	unsigned a = tiff_readbyte(ctx, tiff);
+	unsigned b = tiff_readbyte(ctx, tiff);
+	unsigned c = tiff_readbyte(ctx, tiff);
+	unsigned d = tiff_readbyte(ctx, tiff);
 	if (tiff->order == TII)
 		return (d << 24) | (c << 16) | (b << 8) | a;
 	return (a << 24) | (b << 16) | (c << 8) | d;
 }
 
 static void
-tiff_read_bytes(unsigned char *p, struct tiff *tiff, unsigned ofs, unsigned n)
+tiff_seek(fz_context *ctx, struct tiff *tiff, unsigned ofs)
+{
+	if (ofs > tiff->file_size)
+		ofs = tiff->file_size;
+	fz_seek(ctx, tiff->file, ofs, SEEK_SET);
+}
+
+static void
+tiff_read_bytes(fz_context *ctx, unsigned char *p, struct tiff *tiff, unsigned ofs, unsigned n)
 {
-	if (ofs > (unsigned)(tiff->ep - tiff->bp))
-		ofs = (unsigned)(tiff->ep - tiff->bp);
-	tiff->rp = tiff->bp + ofs;
+	tiff_seek(ctx, tiff, ofs);
 
 	while (n--)
-		*p++ = tiff_readbyte(tiff);
+		*p++ = tiff_readbyte(ctx, tiff);
 }
 
 static void
-tiff_read_tag_value(unsigned *p, struct tiff *tiff, unsigned type, unsigned ofs, unsigned n)
+tiff_read_tag_value(fz_context *ctx, unsigned *p, struct tiff *tiff, unsigned type, unsigned ofs, unsigned n)
 {
 	unsigned den;
 
-	if (ofs > (unsigned)(tiff->ep - tiff->bp))
-		ofs = (unsigned)(tiff->ep - tiff->bp);
-	tiff->rp = tiff->bp + ofs;
+	tiff_seek(ctx, tiff, ofs);
 
 	while (n--)
 	{
 		switch (type)
 		{
 		case TRATIONAL:
-			*p = tiff_readlong(tiff);
-			den = tiff_readlong(tiff);
+			*p = tiff_readlong(ctx, tiff);
+			den = tiff_readlong(ctx, tiff);
 			if (den)
 				*p = *p / den;
 			else
 				*p = UINT_MAX;
 			p ++;
 			break;
-		case TBYTE: *p++ = tiff_readbyte(tiff); break;
-		case TSHORT: *p++ = readshort(tiff); break;
-		case TLONG: *p++ = tiff_readlong(tiff); break;
+		case TBYTE: *p++ = tiff_readbyte(ctx, tiff); break;
+		case TSHORT: *p++ = readshort(ctx, tiff); break;
+		case TLONG: *p++ = tiff_readlong(ctx, tiff); break;
 		default: *p++ = 0; break;
 		}
 	}
@@ -779,74 +783,74 @@ tiff_read_tag(fz_context *ctx, struct tiff *tiff, unsigned offset)
 	unsigned count;
 	unsigned value;
 
-	tiff->rp = tiff->bp + offset;
+	tiff_seek(ctx, tiff, offset);
 
-	tag = readshort(tiff);
-	type = readshort(tiff);
-	count = tiff_readlong(tiff);
+	tag = readshort(ctx, tiff);
+	type = readshort(ctx, tiff);
+	count = tiff_readlong(ctx, tiff);
 
 	if ((type == TBYTE && count <= 4) ||
 			(type == TSHORT && count <= 2) ||
 			(type == TLONG && count <= 1))
-		value = tiff->rp - tiff->bp;
+		value = (unsigned)fz_tell(ctx, tiff->file);
 	else
-		value = tiff_readlong(tiff);
+		value = tiff_readlong(ctx, tiff);
 
 	switch (tag)
 	{
 	case NewSubfileType:
-		tiff_read_tag_value(&tiff->subfiletype, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->subfiletype, tiff, type, value, 1);
 		break;
 	case ImageWidth:
-		tiff_read_tag_value(&tiff->imagewidth, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->imagewidth, tiff, type, value, 1);
 		break;
 	case ImageLength:
-		tiff_read_tag_value(&tiff->imagelength, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->imagelength, tiff, type, value, 1);
 		break;
 	case BitsPerSample:
-		tiff_read_tag_value(&tiff->bitspersample, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->bitspersample, tiff, type, value, 1);
 		break;
 	case Compression:
-		tiff_read_tag_value(&tiff->compression, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->compression, tiff, type, value, 1);
 		break;
 	case PhotometricInterpretation:
-		tiff_read_tag_value(&tiff->photometric, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->photometric, tiff, type, value, 1);
 		break;
 	case FillOrder:
-		tiff_read_tag_value(&tiff->fillorder, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->fillorder, tiff, type, value, 1);
 		break;
 	case SamplesPerPixel:
-		tiff_read_tag_value(&tiff->samplesperpixel, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->samplesperpixel, tiff, type, value, 1);
 		break;
 	case RowsPerStrip:
-		tiff_read_tag_value(&tiff->rowsperstrip, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->rowsperstrip, tiff, type, value, 1);
 		break;
 	case XResolution:
-		tiff_read_tag_value(&tiff->xresolution, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->xresolution, tiff, type, value, 1);
 		break;
 	case YResolution:
-		tiff_read_tag_value(&tiff->yresolution, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->yresolution, tiff, type, value, 1);
 		break;
 	case PlanarConfiguration:
-		tiff_read_tag_value(&tiff->planar, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->planar, tiff, type, value, 1);
 		break;
 	case T4Options:
-		tiff_read_tag_value(&tiff->g3opts, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->g3opts, tiff, type, value, 1);
 		break;
 	case T6Options:
-		tiff_read_tag_value(&tiff->g4opts, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->g4opts, tiff, type, value, 1);
 		break;
 	case Predictor:
-		tiff_read_tag_value(&tiff->predictor, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->predictor, tiff, type, value, 1);
 		break;
 	case ResolutionUnit:
-		tiff_read_tag_value(&tiff->resolutionunit, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->resolutionunit, tiff, type, value, 1);
 		break;
 	case YCbCrSubSampling:
-		tiff_read_tag_value(tiff->ycbcrsubsamp, tiff, type, value, 2);
+		tiff_read_tag_value(ctx, tiff->ycbcrsubsamp, tiff, type, value, 2);
 		break;
 	case ExtraSamples:
-		tiff_read_tag_value(&tiff->extrasamples, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->extrasamples, tiff, type, value, 1);
 		break;
 
 	case ICCProfile:
@@ -855,12 +859,17 @@ tiff_read_tag(fz_context *ctx, struct tiff *tiff, unsigned offset)
 		tiff->profile = fz_malloc(ctx, count);
 		/* ICC profile data type is set to UNDEFINED.
 		 * TBYTE reading not correct in tiff_read_tag_value */
-		tiff_read_bytes(tiff->profile, tiff, value, count);
+		tiff_read_bytes(ctx, tiff->profile, tiff, value, count);
 		tiff->profilesize = count;
 		break;
 
 	case JPEGTables:
-		tiff->jpegtables = tiff->bp + value;
+		if (tiff->jpegtables)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "at most one JPEG tables tag allowed");
+		if (value > tiff->file_size || count > tiff->file_size - value)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "JPEG tables extend beyond the end of the file");
+		tiff->jpegtables = fz_malloc(ctx, count);
+		tiff_read_bytes(ctx, tiff->jpegtables, tiff, value, count);
 		tiff->jpegtableslen = count;
 		break;
 
@@ -868,7 +877,7 @@ tiff_read_tag(fz_context *ctx, struct tiff *tiff, unsigned offset)
 		if (tiff->stripoffsets)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "at most one strip offsets tag allowed");
 		tiff->stripoffsets = fz_malloc_array(ctx, count, sizeof(unsigned));
-		tiff_read_tag_value(tiff->stripoffsets, tiff, type, value, count);
+		tiff_read_tag_value(ctx, tiff->stripoffsets, tiff, type, value, count);
 		tiff->stripoffsetslen = count;
 		break;
 
@@ -876,7 +885,7 @@ tiff_read_tag(fz_context *ctx, struct tiff *tiff, unsigned offset)
 		if (tiff->stripbytecounts)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "at most one strip byte counts tag allowed");
 		tiff->stripbytecounts = fz_malloc_array(ctx, count, sizeof(unsigned));
-		tiff_read_tag_value(tiff->stripbytecounts, tiff, type, value, count);
+		tiff_read_tag_value(ctx, tiff->stripbytecounts, tiff, type, value, count);
 		tiff->stripbytecountslen = count;
 		break;
 
@@ -884,31 +893,31 @@ tiff_read_tag(fz_context *ctx, struct tiff *tiff, unsigned offset)
 		if (tiff->colormap)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "at most one color map allowed");
 		tiff->colormap = fz_malloc_array(ctx, count, sizeof(unsigned));
-		tiff_read_tag_value(tiff->colormap, tiff, type, value, count);
+		tiff_read_tag_value(ctx, tiff->colormap, tiff, type, value, count);
 		tiff->colormaplen = count;
 		break;
 
 	case TileWidth:
-		tiff_read_tag_value(&tiff->tilewidth, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->tilewidth, tiff, type, value, 1);
 		break;
 
 	case TileLength:
-		tiff_read_tag_value(&tiff->tilelength, tiff, type, value, 1);
+		tiff_read_tag_value(ctx, &tiff->tilelength, tiff, type, value, 1);
 		break;
 
 	case TileOffsets:
 		if (tiff->tileoffsets)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "at most one tile offsets tag allowed");
 		tiff->tileoffsets = fz_malloc_array(ctx, count, sizeof(unsigned));
-		tiff_read_tag_value(tiff->tileoffsets, tiff, type, value, count);
+		tiff_read_tag_value(ctx, tiff->tileoffsets, tiff, type, value, count);
 		tiff->tileoffsetslen = count;
 		break;
 
 	case TileByteCounts:
-		if (tiff->tileoffsets)
+		if (tiff->tilebytecounts)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "at most one tile byte counts tag allowed");
 		tiff->tilebytecounts = fz_malloc_array(ctx, count, sizeof(unsigned));
-		tiff_read_tag_value(tiff->tilebytecounts, tiff, type, value, count);
+		tiff_read_tag_value(ctx, tiff->tilebytecounts, tiff, type, value, count);
 		tiff->tilebytecountslen = count;
 		break;
 
@@ -931,14 +940,18 @@ tiff_swap_byte_order(unsigned char *buf, int n)
 }
 
 static void
-tiff_read_header(fz_context *ctx, struct tiff *tiff, unsigned char *buf, size_t len)
+tiff_read_header(fz_context *ctx, struct tiff *tiff, fz_stream *file)
 {
 	unsigned version;
+	fz_off_t size;
 
 	memset(tiff, 0, sizeof(struct tiff));
-	tiff->bp = buf;
-	tiff->rp = buf;
-	tiff->ep = buf + len;
+	tiff->file = file;
+
+	fz_seek(ctx, file, 0, SEEK_END);
+	size = fz_tell(ctx, file);
+	tiff->file_size = size > UINT_MAX ? UINT_MAX : (unsigned)size;
+	fz_seek(ctx, file, 0, SEEK_SET);
 
 	/* tag defaults, where applicable */
 	tiff->bitspersample = 1;
@@ -958,17 +971,17 @@ tiff_read_header(fz_context *ctx, struct tiff *tiff, unsigned char *buf, size_t
 	 */
 
 	/* get byte order marker */
-	tiff->order = readshort(tiff);
+	tiff->order = readshort(ctx, tiff);
 	if (tiff->order != TII && tiff->order != TMM)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not a TIFF file, wrong magic marker");
 
 	/* check version */
-	version = readshort(tiff);
+	version = readshort(ctx, tiff);
 	if (version != 42)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not a TIFF file, wrong version marker");
 
 	/* get offset of IFD */
-	tiff->ifd_offset = tiff_readlong(tiff);
+	tiff->ifd_offset = tiff_readlong(ctx, tiff);
 }
 
 static unsigned
@@ -976,17 +989,17 @@ tiff_next_ifd(fz_context *ctx, struct tiff *tiff, unsigned offset)
 {
 	unsigned count;
 
-	if (offset > (unsigned)(tiff->ep - tiff->bp))
+	if (offset > tiff->file_size)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid IFD offset %u", offset);
 
-	tiff->rp = tiff->bp + offset;
-	count = readshort(tiff);
+	tiff_seek(ctx, tiff, offset);
+	count = readshort(ctx, tiff);
 
-	if (count * 12 > (unsigned)(tiff->ep - tiff->rp))
+	if (tiff->file_size - offset < 2 || count * 12 > tiff->file_size - offset - 2)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "overlarge IFD entry count %u", count);
 
-	tiff->rp += count * 12;
-	offset = tiff_readlong(tiff);
+	tiff_seek(ctx, tiff, offset + 2 + count * 12);
+	offset = tiff_readlong(ctx, tiff);
 
 	return offset;
 }
@@ -1004,10 +1017,10 @@ tiff_seek_ifd(fz_context *ctx, struct tiff *tiff, int subimage)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "subimage index %i out of range", subimage);
 	}
 
-	tiff->rp = tiff->bp + offset;
+	if (offset > tiff->file_size)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid IFD offset %u", offset);
 
-	if (tiff->rp < tiff->bp || tiff->rp > tiff->ep)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid IFD offset %u", tiff->ifd_offset);
+	tiff_seek(ctx, tiff, offset);
 }
 
 static void
@@ -1017,11 +1030,11 @@ tiff_read_ifd(fz_context *ctx, struct tiff *tiff)
 	unsigned count;
 	unsigned i;
 
-	offset = tiff->rp - tiff->bp;
+	offset = (unsigned)fz_tell(ctx, tiff->file);
 
-	count = readshort(tiff);
+	count = readshort(ctx, tiff);
 
-	if (count * 12 > (unsigned)(tiff->ep - tiff->rp))
+	if (tiff->file_size - offset < 2 || count * 12 > tiff->file_size - offset - 2)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "overlarge IFD entry count %u", count);
 
 	offset += 2;
@@ -1037,7 +1050,7 @@ tiff_ycc_to_rgb(fz_context *ctx, struct tiff *tiff)
 {
 	unsigned x, y;
 
-	for (y = 0; y < tiff->imagelength; y++)
+	for (y = 0; y < tiff->y1 - tiff->y0; y++)
 	{
 		unsigned char * row = &tiff->samples[tiff->stride * y];
 		for (x = 0; x < tiff->imagewidth; x++)
@@ -1192,23 +1205,46 @@ tiff_decode_ifd(fz_context *ctx, struct tiff *tiff)
 static void
 tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 {
-	unsigned i;
-
-	tiff->samples = fz_malloc_array(ctx, tiff->imagelength, tiff->stride);
-	memset(tiff->samples, 0x55, tiff->imagelength * tiff->stride);
+	unsigned i, rows, chunk, rem;
+	int tiled;
 
 	if (tiff->tilelength && tiff->tilewidth && tiff->tileoffsets && tiff->tilebytecounts)
-		tiff_decode_tiles(ctx, tiff);
+	{
+		tiled = 1;
+		chunk = tiff->tilelength;
+	}
 	else if (tiff->rowsperstrip && tiff->stripoffsets && tiff->stripbytecounts)
-		tiff_decode_strips(ctx, tiff);
+	{
+		tiled = 0;
+		chunk = tiff->rowsperstrip;
+		if (tiff->photometric == 6 && tiff->compression != 6 && tiff->compression != 7 && chunk < tiff->ycbcrsubsamp[1])
+			chunk = tiff->ycbcrsubsamp[1];
+	}
 	else
 		fz_throw(ctx, FZ_ERROR_GENERIC, "image is missing both strip and tile data");
 
+	/* Only whole strips and tiles are decoded, so widen the band to match */
+	tiff->y0 -= tiff->y0 % chunk;
+	rem = tiff->y1 % chunk;
+	if (rem && chunk - rem < tiff->imagelength - tiff->y1)
+		tiff->y1 += chunk - rem;
+	else if (rem)
+		tiff->y1 = tiff->imagelength;
+	rows = tiff->y1 - tiff->y0;
+
+	tiff->samples = fz_malloc_array(ctx, rows, tiff->stride);
+	memset(tiff->samples, 0x55, rows * tiff->stride);
+
+	if (tiled)
+		tiff_decode_tiles(ctx, tiff);
+	else
+		tiff_decode_strips(ctx, tiff);
+
 	/* Predictor (only for LZW and Flate) */
 	if ((tiff->compression == 5 || tiff->compression == 8 || tiff->compression == 32946) && tiff->predictor == 2)
 	{
 		unsigned char *p = tiff->samples;
-		for (i = 0; i < tiff->imagelength; i++)
+		for (i = 0; i < rows; i++)
 		{
 			tiff_unpredict_line(p, tiff->imagewidth, tiff->samplesperpixel, tiff->bitspersample);
 			p += tiff->stride;
@@ -1227,7 +1263,7 @@ tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 	if (tiff->photometric == 0)
 	{
 		unsigned char *p = tiff->samples;
-		for (i = 0; i < tiff->imagelength; i++)
+		for (i = 0; i < rows; i++)
 		{
 			tiff_invert_line(p, tiff->imagewidth, tiff->samplesperpixel, tiff->bitspersample, tiff->extrasamples);
 			p += tiff->stride;
@@ -1250,43 +1286,41 @@ tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 
 	/* Byte swap 16-bit images to big endian if necessary */
 	if (tiff->bitspersample == 16 && tiff->order == TII)
-		tiff_swap_byte_order(tiff->samples, tiff->imagewidth * tiff->imagelength * tiff->samplesperpixel);
+		tiff_swap_byte_order(tiff->samples, tiff->imagewidth * rows * tiff->samplesperpixel);
 }
 
-fz_pixmap *
-fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subimage)
+/* The colorspace of the pixmaps we make from an image */
+static fz_colorspace *
+tiff_pixmap_colorspace(fz_context *ctx, struct tiff *tiff)
 {
-	fz_pixmap *image = NULL;
-	struct tiff tiff = { 0 };
+	/* CMYK is a subtractive colorspace, we want additive for premul alpha */
+	if (tiff->extrasamples && tiff->colorspace == fz_device_cmyk(ctx))
+		return fz_device_rgb(ctx);
+	return tiff->colorspace;
+}
+
+static fz_pixmap *
+tiff_new_pixmap(fz_context *ctx, struct tiff *tiff)
+{
+	fz_pixmap *image;
 	int alpha;
 
-	fz_var(image);
+	/* Expand into fz_pixmap struct */
+	alpha = tiff->extrasamples != 0;
+	image = fz_new_pixmap(ctx, tiff->colorspace, tiff->imagewidth, tiff->y1 - tiff->y0, alpha);
+	image->xres = tiff->xresolution;
+	image->yres = tiff->yresolution;
 
 	fz_try(ctx)
 	{
-		tiff_read_header(ctx, &tiff, buf, len);
-		tiff_seek_ifd(ctx, &tiff, subimage);
-		tiff_read_ifd(ctx, &tiff);
-
-		/* Decode the image data */
-		tiff_decode_ifd(ctx, &tiff);
-		tiff_decode_samples(ctx, &tiff);
-
-		/* Expand into fz_pixmap struct */
-		alpha = tiff.extrasamples != 0;
-		image = fz_new_pixmap(ctx, tiff.colorspace, tiff.imagewidth, tiff.imagelength, alpha);
-		image->xres = tiff.xresolution;
-		image->yres = tiff.yresolution;
-
-		fz_unpack_tile(ctx, image, tiff.samples, tiff.samplesperpixel, tiff.bitspersample, tiff.stride, 0);
+		fz_unpack_tile(ctx, image, tiff->samples, tiff->samplesperpixel, tiff->bitspersample, tiff->stride, 0);
 
 		/* We should only do this on non-pre-multiplied images, but files in the wild are bad */
-		if (tiff.extrasamples /* == 2 */)
+		if (tiff->extrasamples /* == 2 */)
 		{
-			/* CMYK is a subtractive colorspace, we want additive for premul alpha */
-			if (image->n == 5)
+			if (image->colorspace != tiff_pixmap_colorspace(ctx, tiff))
 			{
-				fz_pixmap *rgb = fz_new_pixmap(ctx, fz_device_rgb(ctx), image->w, image->h, 1);
+				fz_pixmap *rgb = fz_new_pixmap(ctx, tiff_pixmap_colorspace(ctx, tiff), image->w, image->h, 1);
 
 				fz_var(rgb);
 
@@ -1308,21 +1342,60 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subim
 			fz_premultiply_pixmap(ctx, image);
 		}
 	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, image);
+		fz_rethrow(ctx);
+	}
+
+	return image;
+}
+
+static void
+tiff_free(fz_context *ctx, struct tiff *tiff)
+{
+	fz_free(ctx, tiff->colormap);
+	fz_free(ctx, tiff->stripoffsets);
+	fz_free(ctx, tiff->stripbytecounts);
+	fz_free(ctx, tiff->tileoffsets);
+	fz_free(ctx, tiff->tilebytecounts);
+	fz_free(ctx, tiff->jpegtables);
+	fz_free(ctx, tiff->data);
+	fz_free(ctx, tiff->samples);
+	fz_free(ctx, tiff->profile);
+}
+
+fz_pixmap *
+fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subimage)
+{
+	fz_pixmap *image = NULL;
+	fz_stream *file;
+	struct tiff tiff = { 0 };
+
+	file = fz_open_memory(ctx, buf, len);
+
+	fz_try(ctx)
+	{
+		tiff_read_header(ctx, &tiff, file);
+		tiff_seek_ifd(ctx, &tiff, subimage);
+		tiff_read_ifd(ctx, &tiff);
+
+		/* Decode the image data */
+		tiff_decode_ifd(ctx, &tiff);
+		tiff.y0 = 0;
+		tiff.y1 = tiff.imagelength;
+		tiff_decode_samples(ctx, &tiff);
+
+		image = tiff_new_pixmap(ctx, &tiff);
+	}
 	fz_always(ctx)
 	{
 		/* Clean up scratch memory */
-		fz_free(ctx, tiff.colormap);
-		fz_free(ctx, tiff.stripoffsets);
-		fz_free(ctx, tiff.stripbytecounts);
-		fz_free(ctx, tiff.tileoffsets);
-		fz_free(ctx, tiff.tilebytecounts);
-		fz_free(ctx, tiff.data);
-		fz_free(ctx, tiff.samples);
-		fz_free(ctx, tiff.profile);
+		tiff_free(ctx, &tiff);
+		fz_drop_stream(ctx, file);
 	}
 	fz_catch(ctx)
 	{
-		fz_drop_pixmap(ctx, image);
 		fz_rethrow(ctx);
 	}
 
@@ -1338,11 +1411,14 @@ fz_load_tiff(fz_context *ctx, unsigned char *buf, size_t len)
 void
 fz_load_tiff_info_subimage(fz_context *ctx, unsigned char *buf, size_t len, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep, int subimage)
 {
+	fz_stream *file;
 	struct tiff tiff = { 0 };
 
+	file = fz_open_memory(ctx, buf, len);
+
 	fz_try(ctx)
 	{
-		tiff_read_header(ctx, &tiff, buf, len);
+		tiff_read_header(ctx, &tiff, file);
 		tiff_seek_ifd(ctx, &tiff, subimage);
 		tiff_read_ifd(ctx, &tiff);
 
@@ -1357,11 +1433,8 @@ fz_load_tiff_info_subimage(fz_context *ctx, unsigned char *buf, size_t len, int
 	fz_always(ctx)
 	{
 		/* Clean up scratch memory */
-		fz_free(ctx, tiff.colormap);
-		fz_free(ctx, tiff.stripoffsets);
-		fz_free(ctx, tiff.stripbytecounts);
-		fz_free(ctx, tiff.samples);
-		fz_free(ctx, tiff.profile);
+		tiff_free(ctx, &tiff);
+		fz_drop_stream(ctx, file);
 	}
 	fz_catch(ctx)
 	{
@@ -1376,20 +1449,252 @@ fz_load_tiff_info(fz_context *ctx, unsigned char *buf, size_t len, int *wp, int
 }
 
 int
-fz_load_tiff_subimage_count(fz_context *ctx, unsigned char *buf, size_t len)
+fz_index_tiff_subimages(fz_context *ctx, fz_stream *file, unsigned **offsetsp)
 {
+	unsigned *offsets = NULL;
 	unsigned offset;
-	unsigned subimage_count = 0;
+	int count = 0;
+	int max = 0;
 	struct tiff tiff = { 0 };
 
-	tiff_read_header(ctx, &tiff, buf, len);
+	fz_var(offsets);
+	fz_var(count);
+	fz_var(max);
+
+	fz_try(ctx)
+	{
+		tiff_read_header(ctx, &tiff, file);
+
+		offset = tiff.ifd_offset;
+
+		do {
+			if (offsetsp)
+			{
+				if (count == max)
+				{
+					max = max ? max * 2 : 16;
+					offsets = fz_resize_array(ctx, offsets, max, sizeof *offsets);
+				}
+				offsets[count] = offset;
+			}
+			count++;
+			offset = tiff_next_ifd(ctx, &tiff, offset);
+		} while (offset != 0);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, offsets);
+		fz_rethrow(ctx);
+	}
+
+	if (offsetsp)
+		*offsetsp = offsets;
+	return count;
+}
+
+int
+fz_load_tiff_subimage_count(fz_context *ctx, unsigned char *buf, size_t len)
+{
+	fz_stream *file;
+	int count = 0;
+
+	file = fz_open_memory(ctx, buf, len);
+	fz_try(ctx)
+		count = fz_index_tiff_subimages(ctx, file, NULL);
+	fz_always(ctx)
+		fz_drop_stream(ctx, file);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return count;
+}
+
+/*
+ * A TIFF subimage that holds its compressed strips or tiles, and only
+ * decodes the ones covering the area that is asked for.
+ */
+
+typedef struct fz_tiff_image_s
+{
+	fz_image super;
+	struct tiff tiff; /* decoded tags; strip offsets are into buffer */
+	fz_buffer *buffer;
+} fz_tiff_image;
+
+static fz_pixmap *
+tiff_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
+{
+	fz_tiff_image *image = (fz_tiff_image *)image_;
+	fz_pixmap *pix = NULL;
+	struct tiff tiff = image->tiff;
+
+	/* Only the per-decode state of this copy is ours to free */
+	tiff.samples = NULL;
+	tiff.data = NULL;
+	tiff.y0 = 0;
+	tiff.y1 = tiff.imagelength;
+	if (subarea)
+	{
+		tiff.y0 = fz_clampi(subarea->y0, 0, tiff.imagelength);
+		tiff.y1 = fz_clampi(subarea->y1, tiff.y0, tiff.imagelength);
+		if (tiff.y0 == tiff.y1)
+		{
+			tiff.y0 = 0;
+			tiff.y1 = tiff.imagelength;
+		}
+	}
+
+	tiff.file = fz_open_buffer(ctx, image->buffer);
+
+	fz_try(ctx)
+	{
+		tiff_decode_samples(ctx, &tiff);
+		pix = tiff_new_pixmap(ctx, &tiff);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, tiff.data);
+		fz_free(ctx, tiff.samples);
+		fz_drop_stream(ctx, tiff.file);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	/* Whole rows are decoded; any subsampling is left to the caller */
+	if (subarea)
+	{
+		subarea->x0 = 0;
+		subarea->y0 = tiff.y0;
+		subarea->x1 = tiff.imagewidth;
+		subarea->y1 = tiff.y1;
+	}
+
+	return pix;
+}
+
+static size_t
+tiff_image_get_size(fz_context *ctx, fz_image *image_)
+{
+	fz_tiff_image *image = (fz_tiff_image *)image_;
+
+	if (image == NULL)
+		return 0;
+
+	return sizeof(fz_tiff_image) + image->buffer->len;
+}
+
+static void
+drop_tiff_image(fz_context *ctx, fz_image *image_)
+{
+	fz_tiff_image *image = (fz_tiff_image *)image_;
+
+	if (image == NULL)
+		return;
+	tiff_free(ctx, &image->tiff);
+	fz_drop_buffer(ctx, image->buffer);
+	fz_drop_image_base(ctx, &image->super);
+}
+
+/* Read the byte range covering all the strips or tiles into a buffer,
+ * and rebase their offsets to point into it. */
+static fz_buffer *
+tiff_read_chunks(fz_context *ctx, struct tiff *tiff)
+{
+	unsigned *offsets, *counts;
+	unsigned i, n, lo, hi;
+	fz_buffer *buf;
+
+	if (tiff->tilelength && tiff->tilewidth && tiff->tileoffsets && tiff->tilebytecounts)
+	{
+		offsets = tiff->tileoffsets;
+		counts = tiff->tilebytecounts;
+		n = fz_mini(tiff->tileoffsetslen, tiff->tilebytecountslen);
+	}
+	else if (tiff->stripoffsets && tiff->stripbytecounts)
+	{
+		offsets = tiff->stripoffsets;
+		counts = tiff->stripbytecounts;
+		n = fz_mini(tiff->stripoffsetslen, tiff->stripbytecountslen);
+	}
+	else
+		n = 0;
+
+	lo = tiff->file_size;
+	hi = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (offsets[i] > tiff->file_size || counts[i] > tiff->file_size - offsets[i])
+			continue;
+		if (offsets[i] < lo)
+			lo = offsets[i];
+		if (offsets[i] + counts[i] > hi)
+			hi = offsets[i] + counts[i];
+	}
+	if (hi < lo)
+		hi = lo;
+
+	buf = fz_new_buffer(ctx, hi - lo);
+	fz_try(ctx)
+	{
+		fz_seek(ctx, tiff->file, lo, SEEK_SET);
+		buf->len = fz_read(ctx, tiff->file, buf->data, hi - lo);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	/* Chunks we could not read are left pointing out of range, so
+	 * that decoding them reports the error as before. */
+	for (i = 0; i < n; i++)
+	{
+		if (offsets[i] >= lo && offsets[i] <= tiff->file_size && counts[i] <= tiff->file_size - offsets[i])
+			offsets[i] -= lo;
+		else
+			offsets[i] = UINT_MAX;
+	}
+	tiff->file_size = (unsigned)buf->len;
 
-	offset = tiff.ifd_offset;
+	return buf;
+}
 
-	do {
-		subimage_count++;
-		offset = tiff_next_ifd(ctx, &tiff, offset);
-	} while (offset != 0);
+fz_image *
+fz_new_image_from_tiff_subimage(fz_context *ctx, fz_stream *file, unsigned ifd_offset)
+{
+	fz_tiff_image *image;
+	fz_buffer *buffer = NULL;
+	struct tiff tiff = { 0 };
+
+	fz_var(buffer);
+
+	fz_try(ctx)
+	{
+		tiff_read_header(ctx, &tiff, file);
+		tiff.ifd_offset = ifd_offset;
+		tiff_seek_ifd(ctx, &tiff, 0);
+		tiff_read_ifd(ctx, &tiff);
+		tiff_decode_ifd(ctx, &tiff);
+		buffer = tiff_read_chunks(ctx, &tiff);
+		tiff.file = NULL;
+
+		image = (fz_tiff_image *)
+			fz_new_image(ctx, tiff.imagewidth, tiff.imagelength, 8,
+					tiff_pixmap_colorspace(ctx, &tiff),
+					tiff.xresolution, tiff.yresolution, 0, 0,
+					NULL, NULL, NULL, sizeof(fz_tiff_image),
+					tiff_image_get_pixmap,
+					tiff_image_get_size,
+					drop_tiff_image);
+		image->tiff = tiff;
+		image->buffer = buffer;
+	}
+	fz_catch(ctx)
+	{
+		tiff_free(ctx, &tiff);
+		fz_drop_buffer(ctx, buffer);
+		fz_rethrow(ctx);
+	}
 
-	return subimage_count;
+	return &image->super;
 }
@@ -1,4 +1,234 @@
-#include "mupdf/fitz.h"
+#include "fitz-imp.h"
+
+/*
+	The pixmap pool keeps unused sample buffers by size class, four
+	classes to each power of two, so a buffer is at most 25% bigger
+	than it needs to be. Each buffer has a header just before its
+	(aligned) samples that links it into its class, most recently
+	used first, and into a list of the whole pool in the order the
+	buffers came back, so that the longest unused are freed first.
+	Everything is protected by the alloc lock.
+*/
+
+#define POOL_MIN_SHIFT 16 /* smaller buffers are left to malloc */
+#define POOL_MAX_SHIFT 31
+#define POOL_CLASSES ((POOL_MAX_SHIFT - POOL_MIN_SHIFT) * 4)
+#define POOL_ALIGN 64
+
+typedef struct fz_pool_buffer_s fz_pool_buffer;
+
+struct fz_pool_buffer_s
+{
+	fz_pool_buffer *prev, *next;
+	fz_pool_buffer *older, *newer;
+	void *block;
+	int size_class;
+};
+
+struct fz_pixmap_pool_s
+{
+	int refs;
+	fz_pixmap_pool_stats stats;
+	fz_pool_buffer *head[POOL_CLASSES];
+	fz_pool_buffer *oldest, *newest;
+};
+
+static size_t
+pool_class_size(int c)
+{
+	return (size_t)(4 + (c & 3)) << ((c >> 2) + POOL_MIN_SHIFT - 2);
+}
+
+static int
+pool_class(size_t size)
+{
+	int c = 0;
+	while (c < POOL_CLASSES && pool_class_size(c) < size)
+		c++;
+	return c;
+}
+
+/* The alloc lock must be held. */
+static void
+pool_unlink(fz_pixmap_pool *pool, fz_pool_buffer *buf)
+{
+	if (buf->prev)
+		buf->prev->next = buf->next;
+	else
+		pool->head[buf->size_class] = buf->next;
+	if (buf->next)
+		buf->next->prev = buf->prev;
+	if (buf->older)
+		buf->older->newer = buf->newer;
+	else
+		pool->oldest = buf->newer;
+	if (buf->newer)
+		buf->newer->older = buf->older;
+	else
+		pool->newest = buf->older;
+	pool->stats.size -= pool_class_size(buf->size_class);
+	pool->stats.count--;
+}
+
+/* Free buffers, longest unused first, until the pool holds at most max
+ * bytes. Returns how many were freed. The alloc lock must be held. */
+static int
+pool_free_oldest(fz_context *ctx, fz_pixmap_pool *pool, size_t max)
+{
+	int n = 0;
+	while (pool->oldest && pool->stats.size > max)
+	{
+		fz_pool_buffer *buf = pool->oldest;
+		pool_unlink(pool, buf);
+		ctx->alloc->free(ctx->alloc->user, buf->block);
+		n++;
+	}
+	return n;
+}
+
+void
+fz_new_pixmap_pool_context(fz_context *ctx)
+{
+	ctx->pixmap_pool = fz_malloc_struct(ctx, fz_pixmap_pool);
+	ctx->pixmap_pool->refs = 1;
+	ctx->pixmap_pool->stats.max = FZ_PIXMAP_POOL_DEFAULT;
+}
+
+fz_pixmap_pool *
+fz_keep_pixmap_pool_context(fz_context *ctx)
+{
+	if (!ctx || !ctx->pixmap_pool)
+		return NULL;
+	return fz_keep_imp(ctx, ctx->pixmap_pool, &ctx->pixmap_pool->refs);
+}
+
+void
+fz_drop_pixmap_pool_context(fz_context *ctx)
+{
+	if (!ctx || !ctx->pixmap_pool)
+		return;
+	if (fz_drop_imp(ctx, ctx->pixmap_pool, &ctx->pixmap_pool->refs))
+	{
+		fz_empty_pixmap_pool(ctx);
+		fz_free(ctx, ctx->pixmap_pool);
+		ctx->pixmap_pool = NULL;
+	}
+}
+
+int
+fz_scavenge_pixmap_pool(fz_context *ctx)
+{
+	fz_pixmap_pool *pool = ctx->pixmap_pool;
+	if (!pool || !pool->oldest)
+		return 0;
+	pool_free_oldest(ctx, pool, 0);
+	return 1;
+}
+
+void
+fz_empty_pixmap_pool(fz_context *ctx)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	fz_scavenge_pixmap_pool(ctx);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_set_pixmap_pool_max(fz_context *ctx, size_t max)
+{
+	fz_pixmap_pool *pool = ctx->pixmap_pool;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	pool->stats.max = max;
+	pool->stats.discards += pool_free_oldest(ctx, pool, max);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_get_pixmap_pool_stats(fz_context *ctx, fz_pixmap_pool_stats *stats)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*stats = ctx->pixmap_pool->stats;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+/* Returns NULL if a buffer of this size should not come from the pool. */
+static unsigned char *
+fz_new_pooled_samples(fz_context *ctx, size_t size)
+{
+	fz_pixmap_pool *pool = ctx->pixmap_pool;
+	fz_pool_buffer *buf;
+	unsigned char *block, *samples;
+	size_t class_size;
+	int c;
+
+	if (size < ((size_t)1 << POOL_MIN_SHIFT))
+		return NULL;
+	c = pool_class(size);
+	if (c == POOL_CLASSES)
+		return NULL;
+	class_size = pool_class_size(c);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (class_size > pool->stats.max)
+	{
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return NULL;
+	}
+	buf = pool->head[c];
+	if (buf)
+	{
+		pool_unlink(pool, buf);
+		pool->stats.hits++;
+	}
+	else
+		pool->stats.misses++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (buf)
+		return (unsigned char *)(buf + 1);
+
+	block = Memento_label(fz_malloc(ctx, sizeof(fz_pool_buffer) + POOL_ALIGN - 1 + class_size), "pixmap_pool");
+	samples = block + sizeof(fz_pool_buffer);
+	samples += (POOL_ALIGN - ((uintptr_t)samples & (POOL_ALIGN - 1))) & (POOL_ALIGN - 1);
+	buf = (fz_pool_buffer *)samples - 1;
+	buf->block = block;
+	buf->size_class = c;
+	return samples;
+}
+
+static void
+fz_drop_pooled_samples(fz_context *ctx, unsigned char *samples)
+{
+	fz_pixmap_pool *pool = ctx->pixmap_pool;
+	fz_pool_buffer *buf = (fz_pool_buffer *)samples - 1;
+	size_t class_size = pool_class_size(buf->size_class);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (class_size > pool->stats.max)
+	{
+		ctx->alloc->free(ctx->alloc->user, buf->block);
+		pool->stats.discards++;
+	}
+	else
+	{
+		pool->stats.discards += pool_free_oldest(ctx, pool, pool->stats.max - class_size);
+		buf->prev = NULL;
+		buf->next = pool->head[buf->size_class];
+		if (buf->next)
+			buf->next->prev = buf;
+		pool->head[buf->size_class] = buf;
+		buf->newer = NULL;
+		buf->older = pool->newest;
+		if (buf->older)
+			buf->older->newer = buf;
+		else
+			pool->oldest = buf;
+		pool->newest = buf;
+		pool->stats.size += class_size;
+		pool->stats.count++;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
 
 fz_pixmap *
 fz_keep_pixmap(fz_context *ctx, fz_pixmap *pix)
@@ -18,7 +248,9 @@ fz_drop_pixmap_imp(fz_context *ctx, fz_storable *pix_)
 	fz_pixmap *pix = (fz_pixmap *)pix_;
 
 	fz_drop_colorspace(ctx, pix->colorspace);
-	if (pix->free_samples)
+	if (pix->free_samples == 2)
+		fz_drop_pooled_samples(ctx, pix->samples);
+	else if (pix->free_samples)
 		fz_free(ctx, pix->samples);
 	fz_free(ctx, pix);
 }
@@ -72,7 +304,15 @@ fz_new_pixmap_with_data(fz_context *ctx, fz_colorspace *colorspace, int w, int h
 		{
 			if (pix->stride - 1 > INT_MAX / pix->n)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "overly wide image");
-			pix->samples = fz_malloc_array(ctx, pix->h, pix->stride);
+			if (pix->h > 0 && (size_t)pix->stride <= SIZE_MAX / pix->h)
+				pix->samples = fz_new_pooled_samples(ctx, (size_t)pix->h * pix->stride);
+			if (pix->samples)
+				pix->free_samples = 2;
+			else
+			{
+				pix->samples = fz_malloc_array(ctx, pix->h, pix->stride);
+				pix->free_samples = 1;
+			}
 		}
 		fz_catch(ctx)
 		{
@@ -80,7 +320,6 @@ fz_new_pixmap_with_data(fz_context *ctx, fz_colorspace *colorspace, int w, int h
 			fz_free(ctx, pix);
 			fz_rethrow(ctx);
 		}
-		pix->free_samples = 1;
 	}
 
 	return pix;
@@ -1221,7 +1460,9 @@ fz_subsample_pixmap(fz_context *ctx, fz_pixmap *tile, int factor)
 	tile->w = dst_w;
 	tile->h = dst_h;
 	tile->stride = dst_w * n;
-	tile->samples = fz_resize_array(ctx, tile->samples, dst_w * n, dst_h);
+	/* A pooled buffer goes back to the pool at its full size anyway. */
+	if (tile->free_samples != 2)
+		tile->samples = fz_resize_array(ctx, tile->samples, dst_w * n, dst_h);
 }
 
 void
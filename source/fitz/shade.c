@@ -535,29 +535,6 @@ split_stripe(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 	memcpy(s1->color[3], p->color[3], n * sizeof(s1->color[3][0]));
 }
 
-static void
-draw_stripe(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth)
-{
-	tensor_patch s0, s1;
-
-	/* split patch into two half-height patches */
-	split_stripe(p, &s0, &s1, painter->ncomp);
-
-	depth--;
-	if (depth == 0)
-	{
-		/* if no more subdividing, draw two new patches... */
-		triangulate_patch(ctx, painter, s1);
-		triangulate_patch(ctx, painter, s0);
-	}
-	else
-	{
-		/* ...otherwise, continue subdividing. */
-		draw_stripe(ctx, painter, &s1, depth);
-		draw_stripe(ctx, painter, &s0, depth);
-	}
-}
-
 static void
 split_patch(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 {
@@ -582,27 +559,150 @@ split_patch(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 	memcpy(s1->color[3], s0->color[2], n * sizeof(s1->color[3][0]));
 }
 
+static void
+draw_stripe(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth)
+{
+	tensor_patch s0, s1;
+
+	/* if no more subdividing, draw the patch... */
+	if (depth == 0)
+	{
+		triangulate_patch(ctx, painter, *p);
+		return;
+	}
+
+	/* ...otherwise, split patch into two half-height patches and
+	 * continue subdividing. */
+	split_stripe(p, &s0, &s1, painter->ncomp);
+
+	depth--;
+	draw_stripe(ctx, painter, &s1, depth);
+	draw_stripe(ctx, painter, &s0, depth);
+}
+
 static void
 draw_patch(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth, int origdepth)
 {
 	tensor_patch s0, s1;
 
-	/* split patch into two half-width patches */
+	/* if no more subdividing, go on to split the other way... */
+	if (depth == 0)
+	{
+		draw_stripe(ctx, painter, p, origdepth);
+		return;
+	}
+
+	/* ...otherwise, split patch into two half-width patches and
+	 * continue subdividing. */
 	split_patch(p, &s0, &s1, painter->ncomp);
 
 	depth--;
-	if (depth == 0)
+	draw_patch(ctx, painter, &s0, depth, origdepth);
+	draw_patch(ctx, painter, &s1, depth, origdepth);
+}
+
+/*
+	How far to subdivide patches depends on their size on the device,
+	rather than being fixed: small patches are drawn as a few flat
+	quads, while large ones are split finely enough to stay smooth.
+
+	Each level of subdivision reduces both the errors we measure by
+	about a factor of 4:
+
+	The shape error is how far the curves of the patch stray from
+	evenly spaced straight lines, in the units of the ctm (normally
+	device pixels), and is kept under PATCH_FLATNESS.
+
+	The color error comes from the patch being distorted (in proportion
+	to how much the color changes across it), and from the corner
+	colors not being planar, so that the quads cannot be shaded exactly
+	as two triangles. It is kept under PATCH_COLOR_TOLERANCE, but there
+	is no point in splitting for it below a pixel.
+
+	All the patches of a shading use the same depth, so that the edges
+	they share are split at the same points and no cracks open up
+	between them. The price is that one strongly curved or large patch
+	makes every other patch of the mesh be split as finely. Working the
+	depth out means reading the mesh data twice, once to measure the
+	patches and once to draw them.
+*/
+#define PATCH_FLATNESS 0.3f
+#define PATCH_COLOR_TOLERANCE 0.005f /* as a fraction of the Decode range */
+#define MAX_SUBDIV 6 /* how many levels to subdivide patches at most */
+
+/* How far the middle poles of a curve are from splitting the chord in
+ * thirds, and the length of the chord (both in the max norm). */
+static inline float
+curve_deviation(const fz_point *pole, int polestep, float *extent)
+{
+	fz_point a = pole[0];
+	fz_point b = pole[3 * polestep];
+	float dx = b.x - a.x;
+	float dy = b.y - a.y;
+	float d1 = fz_max(fz_abs(pole[polestep].x - a.x - dx / 3), fz_abs(pole[polestep].y - a.y - dy / 3));
+	float d2 = fz_max(fz_abs(b.x - pole[2 * polestep].x - dx / 3), fz_abs(b.y - pole[2 * polestep].y - dy / 3));
+	*extent = fz_max(fz_abs(dx), fz_abs(dy));
+	return fz_max(d1, d2);
+}
+
+static int
+patch_depth(fz_mesh_processor *painter, tensor_patch *p)
+{
+	const float *c0 = painter->shade->u.m.c0;
+	const float *c1 = painter->shade->u.m.c1;
+	float deviation = 0, extent = 0, d, e;
+	float ru = 0, rv = 0;
+	float shape, color = 0;
+	int i, k, depth, size_depth;
+
+	/* Along the rows of poles (as split by split_patch) and along the
+	 * columns (as split by split_stripe). */
+	for (i = 0; i < 4; i++)
 	{
-		/* if no more subdividing, draw two new patches... */
-		draw_stripe(ctx, painter, &s0, origdepth);
-		draw_stripe(ctx, painter, &s1, origdepth);
+		d = curve_deviation(p->pole[i], 1, &e);
+		deviation = fz_max(deviation, d);
+		extent = fz_max(extent, e);
+		if (e > 0)
+			ru = fz_max(ru, d / e);
+		d = curve_deviation(&p->pole[0][i], 4, &e);
+		deviation = fz_max(deviation, d);
+		extent = fz_max(extent, e);
+		if (e > 0)
+			rv = fz_max(rv, d / e);
 	}
-	else
+
+	for (k = 0; k < painter->ncomp; k++)
+	{
+		float range = fz_abs(c1[k] - c0[k]);
+		float twist = fz_abs(p->color[0][k] - p->color[1][k] + p->color[2][k] - p->color[3][k]);
+		float du = fz_max(fz_abs(p->color[1][k] - p->color[0][k]), fz_abs(p->color[2][k] - p->color[3][k]));
+		float dv = fz_max(fz_abs(p->color[3][k] - p->color[0][k]), fz_abs(p->color[2][k] - p->color[1][k]));
+		e = du * ru + dv * rv + twist / 4;
+		if (range > 0)
+			e /= range;
+		color = fz_max(color, e);
+	}
+
+	shape = deviation / PATCH_FLATNESS;
+	color /= PATCH_COLOR_TOLERANCE;
+
+	/* Written so that NaNs do not subdivide at all. */
+	depth = 0;
+	while (depth < MAX_SUBDIV && shape > 1)
+	{
+		shape /= 4;
+		depth++;
+	}
+
+	size_depth = 0;
+	while (size_depth < MAX_SUBDIV && extent > 1 && color > 1)
 	{
-		/* ...otherwise, continue subdividing. */
-		draw_patch(ctx, painter, &s0, depth, origdepth);
-		draw_patch(ctx, painter, &s1, depth, origdepth);
+		extent /= 2;
+		color /= 4;
+		size_depth++;
 	}
+
+	return fz_maxi(depth, size_depth);
 }
 
 static fz_point
@@ -692,15 +792,15 @@ make_tensor_patch(tensor_patch *p, int type, fz_point *pt)
 	}
 }
 
-/* FIXME: Nasty */
-#define SUBDIV 3 /* how many levels to subdivide patches */
-
-static void
-fz_process_shade_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter)
+/* With depth < 0, work out and return how far to subdivide the
+ * patches rather than drawing them. */
+static int
+fz_process_shade_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter, int depth)
 {
 	fz_stream *stream = fz_open_compressed_buffer(ctx, shade->buffer);
 	float color_storage[2][4][FZ_MAX_COLORS];
 	fz_point point_storage[2][12];
+	int maxdepth = 0;
 	int store = 0;
 	int ncomp = painter->ncomp;
 	int i, k;
@@ -714,6 +814,8 @@ fz_process_shade_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 	const float *c0 = shade->u.m.c0;
 	const float *c1 = shade->u.m.c1;
 
+	fz_var(maxdepth);
+
 	fz_try(ctx)
 	{
 		float (*prevc)[FZ_MAX_COLORS] = NULL;
@@ -791,7 +893,14 @@ fz_process_shade_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 			for (i = 0; i < 4; i++)
 				memcpy(patch.color[i], c[i], ncomp * sizeof(float));
 
-			draw_patch(ctx, painter, &patch, SUBDIV, SUBDIV);
+			if (depth >= 0)
+				draw_patch(ctx, painter, &patch, depth, depth);
+			else
+			{
+				maxdepth = fz_maxi(maxdepth, patch_depth(painter, &patch));
+				if (maxdepth == MAX_SUBDIV)
+					break;
+			}
 
 			prevp = v;
 			prevc = c;
@@ -804,12 +913,22 @@ fz_process_shade_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 	}
 	fz_catch(ctx)
 	{
-		fz_rethrow(ctx);
+		/* Draw what we can of a broken mesh; the drawing pass
+		 * reports the error once it gets there. */
+		fz_rethrow_if(ctx, FZ_ERROR_OOM);
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_rethrow_if(ctx, FZ_ERROR_ABORT);
+		if (depth >= 0)
+			fz_rethrow(ctx);
 	}
+
+	return maxdepth;
 }
 
-static void
-fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter)
+/* With depth < 0, work out and return how far to subdivide the
+ * patches rather than drawing them. */
+static int
+fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter, int depth)
 {
 	fz_stream *stream = fz_open_compressed_buffer(ctx, shade->buffer);
 	int bpflag = shade->u.m.bpflag;
@@ -823,12 +942,15 @@ fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 	const float *c1 = shade->u.m.c1;
 	float color_storage[2][4][FZ_MAX_COLORS];
 	fz_point point_storage[2][16];
+	int maxdepth = 0;
 	int store = 0;
 	int ncomp = painter->ncomp;
 	int i, k;
 	float (*prevc)[FZ_MAX_COLORS] = NULL;
 	fz_point (*prevp) = NULL;
 
+	fz_var(maxdepth);
+
 	fz_try(ctx)
 	{
 		while (!fz_is_eof_bits(ctx, stream))
@@ -904,7 +1026,14 @@ fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 			for (i = 0; i < 4; i++)
 				memcpy(patch.color[i], c[i], ncomp * sizeof(float));
 
-			draw_patch(ctx, painter, &patch, SUBDIV, SUBDIV);
+			if (depth >= 0)
+				draw_patch(ctx, painter, &patch, depth, depth);
+			else
+			{
+				maxdepth = fz_maxi(maxdepth, patch_depth(painter, &patch));
+				if (maxdepth == MAX_SUBDIV)
+					break;
+			}
 
 			prevp = v;
 			prevc = c;
@@ -917,8 +1046,16 @@ fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 	}
 	fz_catch(ctx)
 	{
-		fz_rethrow(ctx);
+		/* Draw what we can of a broken mesh; the drawing pass
+		 * reports the error once it gets there. */
+		fz_rethrow_if(ctx, FZ_ERROR_OOM);
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_rethrow_if(ctx, FZ_ERROR_ABORT);
+		if (depth >= 0)
+			fz_rethrow(ctx);
 	}
+
+	return maxdepth;
 }
 
 void
@@ -944,9 +1081,15 @@ fz_process_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm,
 	else if (shade->type == FZ_MESH_TYPE5)
 		fz_process_shade_type5(ctx, shade, ctm, &painter);
 	else if (shade->type == FZ_MESH_TYPE6)
-		fz_process_shade_type6(ctx, shade, ctm, &painter);
+	{
+		int depth = fz_process_shade_type6(ctx, shade, ctm, &painter, -1);
+		fz_process_shade_type6(ctx, shade, ctm, &painter, depth);
+	}
 	else if (shade->type == FZ_MESH_TYPE7)
-		fz_process_shade_type7(ctx, shade, ctm, &painter);
+	{
+		int depth = fz_process_shade_type7(ctx, shade, ctm, &painter, -1);
+		fz_process_shade_type7(ctx, shade, ctm, &painter, depth);
+	}
 	else
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Unexpected mesh type %d\n", shade->type);
 }
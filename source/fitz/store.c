@@ -1,4 +1,4 @@
-#include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 typedef struct fz_item_s fz_item;
 
@@ -749,6 +749,10 @@ int fz_store_scavenge(fz_context *ctx, size_t size, int *phase)
 	fz_store *store;
 	size_t max;
 
+	/* Unused pixmap buffers are the cheapest memory to give back. */
+	if (fz_scavenge_pixmap_pool(ctx))
+		return 1;
+
 	store = ctx->store;
 	if (store == NULL)
 		return 0;
@@ -809,6 +813,9 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 	if (percent >= 100)
 		return 1;
 
+	/* Unused pixmap buffers are the cheapest memory to give back. */
+	fz_empty_pixmap_pool(ctx);
+
 	store = ctx->store;
 	if (store == NULL)
 		return 0;
@@ -621,6 +621,231 @@ sort_properties(fz_css_match *match)
 	}
 }
 
+/*
+ * Rule index.
+ *
+ * Every selector is filed under the most selective part of its subject
+ * (the rightmost simple selector): its id, else its first class, else
+ * its tag name. Selectors with none of these go on the universal list.
+ * Only rules found through the node's own tag, id and classes (plus the
+ * universal ones) can possibly match, so only those are tested.
+ */
+
+enum { INDEX_TAG, INDEX_CLASS, INDEX_ID };
+
+typedef struct
+{
+	int kind;
+	const char *key;
+	int rule;
+} fz_css_index_entry;
+
+struct fz_css_index_s
+{
+	int rule_count;
+	fz_css_rule **rules; /* in document order */
+	int entry_count;
+	fz_css_index_entry *entries; /* sorted by kind, key and rule */
+	int universal_count;
+	int *universal; /* rule numbers, ascending */
+	int *candidates; /* scratch space for fz_match_css */
+};
+
+static int
+cmp_index_entry(const void *a_, const void *b_)
+{
+	const fz_css_index_entry *a = a_;
+	const fz_css_index_entry *b = b_;
+	int c;
+	if (a->kind != b->kind)
+		return a->kind - b->kind;
+	c = strcmp(a->key, b->key);
+	if (c)
+		return c;
+	return a->rule - b->rule;
+}
+
+static int
+cmp_int(const void *a_, const void *b_)
+{
+	return *(const int *)a_ - *(const int *)b_;
+}
+
+static void
+index_selector(fz_css_selector *sel, fz_css_index_entry *entry)
+{
+	fz_css_condition *cond;
+
+	if (sel->combine)
+		sel = sel->right;
+
+	for (cond = sel->cond; cond; cond = cond->next)
+	{
+		if (cond->type == '#')
+		{
+			entry->kind = INDEX_ID;
+			entry->key = cond->val;
+			return;
+		}
+	}
+	for (cond = sel->cond; cond; cond = cond->next)
+	{
+		if (cond->type == '.')
+		{
+			entry->kind = INDEX_CLASS;
+			entry->key = cond->val;
+			return;
+		}
+	}
+	if (sel->name)
+	{
+		entry->kind = INDEX_TAG;
+		entry->key = sel->name;
+		return;
+	}
+	entry->key = NULL;
+}
+
+static fz_css_index *
+build_css_index(fz_context *ctx, fz_css *css)
+{
+	fz_css_index *index;
+	fz_css_rule *rule;
+	fz_css_selector *sel;
+	int i, n, nsel;
+
+	n = nsel = 0;
+	for (rule = css->rule; rule; rule = rule->next)
+	{
+		for (sel = rule->selector; sel; sel = sel->next)
+			++nsel;
+		++n;
+	}
+
+	index = fz_pool_alloc(ctx, css->pool, sizeof *index);
+	index->rule_count = n;
+	index->rules = fz_pool_alloc(ctx, css->pool, n * sizeof *index->rules);
+	index->entries = fz_pool_alloc(ctx, css->pool, nsel * sizeof *index->entries);
+	index->universal = fz_pool_alloc(ctx, css->pool, nsel * sizeof *index->universal);
+	index->candidates = fz_pool_alloc(ctx, css->pool, 2 * nsel * sizeof *index->candidates);
+	index->entry_count = 0;
+	index->universal_count = 0;
+
+	for (i = 0, rule = css->rule; rule; rule = rule->next, ++i)
+	{
+		index->rules[i] = rule;
+		for (sel = rule->selector; sel; sel = sel->next)
+		{
+			fz_css_index_entry *entry = &index->entries[index->entry_count];
+			index_selector(sel, entry);
+			if (entry->key)
+			{
+				entry->rule = i;
+				++index->entry_count;
+			}
+			else if (index->universal_count == 0 || index->universal[index->universal_count-1] != i)
+				index->universal[index->universal_count++] = i;
+		}
+	}
+
+	qsort(index->entries, index->entry_count, sizeof *index->entries, cmp_index_entry);
+
+	return index;
+}
+
+static int
+cmp_index_key(const fz_css_index_entry *entry, int kind, const char *key, size_t n)
+{
+	int c;
+	if (entry->kind != kind)
+		return entry->kind - kind;
+	c = strncmp(entry->key, key, n);
+	if (c)
+		return c;
+	return entry->key[n] != 0;
+}
+
+static int
+add_index_candidates(fz_css_index *index, int count, int kind, const char *key, size_t n)
+{
+	int l = 0;
+	int r = index->entry_count;
+
+	/* Find the first entry not less than key. */
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (cmp_index_key(&index->entries[m], kind, key, n) < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	while (l < index->entry_count && cmp_index_key(&index->entries[l], kind, key, n) == 0)
+		index->candidates[count++] = index->entries[l++].rule;
+
+	return count;
+}
+
+static int
+is_repeated_class(const char *cls, const char *word, size_t n)
+{
+	while (cls < word)
+	{
+		size_t k = 0;
+		while (*cls == ' ')
+			++cls;
+		while (cls[k] && cls[k] != ' ')
+			++k;
+		if (cls < word && k == n && !memcmp(cls, word, n))
+			return 1;
+		cls += k;
+	}
+	return 0;
+}
+
+static int
+find_css_candidates(fz_css_index *index, fz_xml *node)
+{
+	const char *tag, *id, *cls, *p;
+	int i, k, count;
+
+	memcpy(index->candidates, index->universal, index->universal_count * sizeof *index->candidates);
+	count = index->universal_count;
+
+	tag = fz_xml_tag(node);
+	if (tag)
+		count = add_index_candidates(index, count, INDEX_TAG, tag, strlen(tag));
+
+	id = fz_xml_att(node, "id");
+	if (id)
+		count = add_index_candidates(index, count, INDEX_ID, id, strlen(id));
+
+	/* Each entry is added at most once as long as repeated class names
+	 * are skipped, which bounds the size of the candidates array. */
+	cls = p = fz_xml_att(node, "class");
+	while (p && *p)
+	{
+		size_t n = 0;
+		while (*p == ' ')
+			++p;
+		while (p[n] && p[n] != ' ')
+			++n;
+		if (n > 0 && !is_repeated_class(cls, p, n))
+			count = add_index_candidates(index, count, INDEX_CLASS, p, n);
+		p += n;
+	}
+
+	/* A rule may have been found through several of its selectors.
+	 * Put them back in document order and remove the duplicates. */
+	qsort(index->candidates, count, sizeof *index->candidates, cmp_int);
+	for (i = k = 0; i < count; ++i)
+		if (k == 0 || index->candidates[k-1] != index->candidates[i])
+			index->candidates[k++] = index->candidates[i];
+
+	return k;
+}
+
 void
 fz_match_css(fz_context *ctx, fz_css_match *match, fz_css *css, fz_xml *node)
 {
@@ -628,9 +853,15 @@ fz_match_css(fz_context *ctx, fz_css_match *match, fz_css *css, fz_xml *node)
 	fz_css_selector *sel;
 	fz_css_property *prop;
 	const char *s;
+	int i, n;
 
-	for (rule = css->rule; rule; rule = rule->next)
+	if (!css->index)
+		css->index = build_css_index(ctx, css);
+
+	n = find_css_candidates(css->index, node);
+	for (i = 0; i < n; ++i)
 	{
+		rule = css->index->rules[css->index->candidates[i]];
 		sel = rule->selector;
 		while (sel)
 		{
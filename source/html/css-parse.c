@@ -29,8 +29,11 @@ fz_css *fz_new_css(fz_context *ctx)
 	fz_try(ctx)
 	{
 		css = fz_pool_alloc(ctx, pool, sizeof *css);
+		css->refs = 1;
 		css->pool = pool;
 		css->rule = NULL;
+		css->import = NULL;
+		css->index = NULL;
 	}
 	fz_catch(ctx)
 	{
@@ -41,10 +44,20 @@ fz_css *fz_new_css(fz_context *ctx)
 	return css;
 }
 
+fz_css *fz_keep_css(fz_context *ctx, fz_css *css)
+{
+	return fz_keep_imp(ctx, css, &css->refs);
+}
+
 void fz_drop_css(fz_context *ctx, fz_css *css)
 {
-	if (css)
+	if (fz_drop_imp(ctx, css, &css->refs))
+	{
+		fz_css_import *imp;
+		for (imp = css->import; imp; imp = imp->next)
+			fz_drop_css(ctx, imp->css);
 		fz_drop_pool(ctx, css->pool);
+	}
 }
 
 static fz_css_rule *fz_new_css_rule(fz_context *ctx, fz_pool *pool, fz_css_selector *selector, fz_css_property *declaration)
@@ -957,4 +970,75 @@ void fz_parse_css(fz_context *ctx, fz_css *css, const char *source, const char *
 	css_lex_init(ctx, &buf, css->pool, source, file);
 	next(&buf);
 	css->rule = parse_stylesheet(&buf, css->rule);
+	css->index = NULL;
+}
+
+/*
+ * Append the rules of an already parsed style sheet. The selectors
+ * and declarations are shared, not copied, so the sheet is kept alive
+ * for as long as css is.
+ */
+void fz_add_css(fz_context *ctx, fz_css *css, fz_css *sheet)
+{
+	fz_css_import *imp;
+	fz_css_rule *rule, **tailp;
+
+	imp = fz_pool_alloc(ctx, css->pool, sizeof *imp);
+	imp->css = fz_keep_css(ctx, sheet);
+	imp->next = css->import;
+	css->import = imp;
+
+	tailp = &css->rule;
+	while (*tailp)
+		tailp = &(*tailp)->next;
+	for (rule = sheet->rule; rule; rule = rule->next)
+	{
+		*tailp = fz_new_css_rule(ctx, css->pool, rule->selector, rule->declaration);
+		tailp = &(*tailp)->next;
+	}
+	css->index = NULL;
+}
+
+/*
+ * Parsed style sheets, by archive path, shared between all the
+ * chapters of a document.
+ */
+
+struct fz_css_cache_s
+{
+	fz_tree *sheets;
+};
+
+fz_css_cache *fz_new_css_cache(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_css_cache);
+}
+
+fz_css *fz_find_cached_css(fz_context *ctx, fz_css_cache *cache, const char *name)
+{
+	if (!cache)
+		return NULL;
+	return fz_keep_css(ctx, fz_tree_lookup(ctx, cache->sheets, name));
+}
+
+void fz_cache_css(fz_context *ctx, fz_css_cache *cache, const char *name, fz_css *css)
+{
+	if (!cache || fz_tree_lookup(ctx, cache->sheets, name))
+		return;
+	cache->sheets = fz_tree_insert(ctx, cache->sheets, name, css);
+	fz_keep_css(ctx, css);
+}
+
+static void drop_cached_css(fz_context *ctx, void *css)
+{
+	fz_drop_css(ctx, css);
+}
+
+void fz_drop_css_cache(fz_context *ctx, fz_css_cache *cache)
+{
+	if (cache)
+	{
+		fz_drop_tree(ctx, cache->sheets, drop_cached_css);
+		fz_free(ctx, cache);
+	}
 }
@@ -11,6 +11,7 @@ struct epub_document_s
 	fz_document super;
 	fz_archive *zip;
 	fz_html_font_set *set;
+	fz_css_cache *css_cache;
 	int count;
 	epub_chapter *spine;
 	fz_outline *outline;
@@ -78,16 +79,24 @@ epub_update_outline(fz_context *ctx, fz_document *doc, fz_outline *node)
 	}
 }
 
+static void
+epub_layout_chapter(fz_context *ctx, void *arg, int i)
+{
+	epub_chapter *ch = ((epub_chapter **)arg)[i];
+	fz_layout_html(ctx, ch->html, ch->page_w, ch->page_h, ch->em);
+}
+
 static void
 epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
 {
 	epub_document *doc = (epub_document*)doc_;
+	epub_chapter **chapters;
 	epub_chapter *ch;
+	int i, n = 0;
 	int count = 0;
 
 	for (ch = doc->spine; ch; ch = ch->next)
 	{
-		ch->start = count;
 		ch->em = em;
 		ch->page_margin[T] = fz_from_css_number(ch->html->root->style.margin[T], em, em);
 		ch->page_margin[B] = fz_from_css_number(ch->html->root->style.margin[B], em, em);
@@ -95,7 +104,25 @@ epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
 		ch->page_margin[R] = fz_from_css_number(ch->html->root->style.margin[R], em, em);
 		ch->page_w = w - ch->page_margin[L] - ch->page_margin[R];
 		ch->page_h = h - ch->page_margin[T] - ch->page_margin[B];
-		fz_layout_html(ctx, ch->html, ch->page_w, ch->page_h, ch->em);
+		++n;
+	}
+
+	/* Chapters lay out independently of each other, so hand them
+	 * out as separate jobs; page numbers are assigned afterwards
+	 * in spine order. */
+	chapters = fz_malloc_array(ctx, n, sizeof *chapters);
+	for (i = 0, ch = doc->spine; ch; ch = ch->next)
+		chapters[i++] = ch;
+	fz_try(ctx)
+		fz_run_jobs(ctx, n, epub_layout_chapter, chapters);
+	fz_always(ctx)
+		fz_free(ctx, chapters);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	for (ch = doc->spine; ch; ch = ch->next)
+	{
+		ch->start = count;
 		count += ceilf(ch->html->root->h / ch->page_h);
 	}
 
@@ -232,6 +259,7 @@ epub_drop_document(fz_context *ctx, fz_document *doc_)
 	}
 	fz_drop_archive(ctx, doc->zip);
 	fz_drop_html_font_set(ctx, doc->set);
+	fz_drop_css_cache(ctx, doc->css_cache);
 	fz_drop_outline(ctx, doc->outline);
 	fz_free(ctx, doc->dc_title);
 	fz_free(ctx, doc->dc_creator);
@@ -284,7 +312,7 @@ epub_parse_chapter(fz_context *ctx, epub_document *doc, const char *path)
 
 	ch = fz_malloc_struct(ctx, epub_chapter);
 	ch->path = fz_strdup(ctx, path);
-	ch->html = fz_parse_html(ctx, doc->set, zip, base_uri, buf, fz_user_css(ctx));
+	ch->html = fz_parse_html(ctx, doc->set, doc->css_cache, zip, base_uri, buf, fz_user_css(ctx));
 	ch->next = NULL;
 
 	fz_drop_buffer(ctx, buf);
@@ -482,6 +510,7 @@ epub_init(fz_context *ctx, fz_archive *zip)
 
 	fz_try(ctx)
 	{
+		doc->css_cache = fz_new_css_cache(ctx);
 		epub_parse_header(ctx, doc);
 	}
 	fz_catch(ctx)
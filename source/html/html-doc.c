@@ -175,7 +175,7 @@ htdoc_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	fz_try(ctx)
 	{
 		fz_write_buffer_byte(ctx, buf, 0);
-		doc->html = fz_parse_html(ctx, doc->set, doc->zip, ".", buf, fz_user_css(ctx));
+		doc->html = fz_parse_html(ctx, doc->set, NULL, doc->zip, ".", buf, fz_user_css(ctx));
 	}
 	fz_always(ctx)
 		fz_drop_buffer(ctx, buf);
@@ -211,7 +211,7 @@ htdoc_open_document(fz_context *ctx, const char *filename)
 	fz_try(ctx)
 	{
 		fz_write_buffer_byte(ctx, buf, 0);
-		doc->html = fz_parse_html(ctx, doc->set, doc->zip, ".", buf, fz_user_css(ctx));
+		doc->html = fz_parse_html(ctx, doc->set, NULL, doc->zip, ".", buf, fz_user_css(ctx));
 	}
 	fz_always(ctx)
 		fz_drop_buffer(ctx, buf);
@@ -799,6 +799,118 @@ static void measure_image(fz_context *ctx, fz_html_flow *node, float max_w, floa
 	node->h = image_h * s;
 }
 
+/*
+ * Shaped runs of text are kept in the store, so that the same word in
+ * the same font is only shaped once no matter how many times it occurs,
+ * and is not shaped again when the page is laid out anew or drawn.
+ * Shaping is always done in font units, so the result does not depend
+ * on the font size.
+ */
+
+typedef struct
+{
+	int gid;
+	int cluster; /* byte offset in the run's text */
+	int x, y; /* offset plus the advance of all preceding glyphs */
+} shaped_glyph;
+
+typedef struct
+{
+	fz_storable storable;
+	int scale; /* units per em */
+	int x_advance, y_advance;
+	unsigned int glyph_count;
+	shaped_glyph glyph[1];
+} shaped_run;
+
+typedef struct
+{
+	int refs;
+	fz_font *font;
+	int rtl;
+	int script;
+	int language;
+	size_t len;
+	char *text;
+} shape_key;
+
+static int
+make_hash_shape_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	int params[3];
+	fz_md5 md5;
+
+	params[0] = key->rtl;
+	params[1] = key->script;
+	params[2] = key->language;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (unsigned char *)params, sizeof params);
+	fz_md5_update(&md5, (unsigned char *)key->text, key->len);
+	fz_md5_final(&md5, hash->u.pd.digest);
+	hash->u.pd.ptr = key->font;
+	return 1;
+}
+
+static void *
+keep_shape_key(fz_context *ctx, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+drop_shape_key(fz_context *ctx, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_font(ctx, key->font);
+		fz_free(ctx, key->text);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+cmp_shape_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	shape_key *k0 = (shape_key *)k0_;
+	shape_key *k1 = (shape_key *)k1_;
+	return k0->font == k1->font && k0->rtl == k1->rtl &&
+		k0->script == k1->script && k0->language == k1->language &&
+		k0->len == k1->len && !memcmp(k0->text, k1->text, k0->len);
+}
+
+static void
+print_shape_key(fz_context *ctx, fz_output *out, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	fz_printf(ctx, out, "(shaped text %s '%.*s') ", fz_font_name(ctx, key->font), (int)key->len, key->text);
+}
+
+static fz_store_type shape_store_type =
+{
+	make_hash_shape_key,
+	keep_shape_key,
+	drop_shape_key,
+	cmp_shape_key,
+	print_shape_key
+};
+
+static void
+drop_shaped_run_imp(fz_context *ctx, fz_storable *run)
+{
+	fz_free(ctx, run);
+}
+
+static void
+drop_shaped_run(fz_context *ctx, shaped_run *run)
+{
+	if (run)
+		fz_drop_storable(ctx, &run->storable);
+}
+
 typedef struct string_walker
 {
 	fz_context *ctx;
@@ -816,6 +928,7 @@ typedef struct string_walker
 	hb_glyph_info_t *glyph_info;
 	unsigned int glyph_count;
 	int scale;
+	shaped_run *run;
 } string_walker;
 
 static int quick_ligature_mov(fz_context *ctx, string_walker *walker, unsigned int i, unsigned int n, int unicode)
@@ -876,6 +989,13 @@ static void init_string_walker(fz_context *ctx, string_walker *walker, hb_buffer
 	walker->language = language;
 	walker->font = NULL;
 	walker->next_font = NULL;
+	walker->run = NULL;
+}
+
+static void drop_string_walker(fz_context *ctx, string_walker *walker)
+{
+	drop_shaped_run(ctx, walker->run);
+	walker->run = NULL;
 }
 
 static void
@@ -886,37 +1006,17 @@ destroy_hb_shaper_data(fz_context *ctx, void *handle)
 	hb_unlock(ctx);
 }
 
-static int walk_string(string_walker *walker)
+static shaped_run *shape_string(string_walker *walker)
 {
 	fz_context *ctx = walker->ctx;
 	FT_Face face;
 	int fterr;
 	int quickshape;
 	char lang[8];
-
-	walker->start = walker->end;
-	walker->end = walker->s;
-	walker->font = walker->next_font;
-
-	if (*walker->start == 0)
-		return 0;
-
-	/* Run through the string, encoding chars until we find one
-	 * that requires a different fallback font. */
-	while (*walker->s)
-	{
-		int c;
-
-		walker->s += fz_chartorune(&c, walker->s);
-		(void)fz_encode_character_with_fallback(ctx, walker->base_font, c, walker->script, walker->language, &walker->next_font);
-		if (walker->next_font != walker->font)
-		{
-			if (walker->font != NULL)
-				break;
-			walker->font = walker->next_font;
-		}
-		walker->end = walker->s;
-	}
+	shaped_run *run, *existing;
+	shape_key *key = NULL;
+	int x, y;
+	unsigned int i;
 
 	/* Disable harfbuzz shaping if script is common or LGC and there are no opentype tables. */
 	quickshape = 0;
@@ -976,7 +1076,6 @@ static int walk_string(string_walker *walker)
 
 	if (quickshape)
 	{
-		unsigned int i;
 		for (i = 0; i < walker->glyph_count; ++i)
 		{
 			int unicode = quick_ligature(ctx, walker, i);
@@ -989,6 +1088,102 @@ static int walk_string(string_walker *walker)
 		}
 	}
 
+	/* Flatten advance and offset into a position for each glyph. */
+	run = fz_malloc(ctx, sizeof *run + walker->glyph_count * sizeof *run->glyph);
+	FZ_INIT_STORABLE(run, 1, drop_shaped_run_imp);
+	run->scale = walker->scale;
+	run->glyph_count = walker->glyph_count;
+	x = y = 0;
+	for (i = 0; i < walker->glyph_count; ++i)
+	{
+		run->glyph[i].gid = walker->glyph_info[i].codepoint;
+		run->glyph[i].cluster = walker->glyph_info[i].cluster;
+		run->glyph[i].x = x + walker->glyph_pos[i].x_offset;
+		run->glyph[i].y = y + walker->glyph_pos[i].y_offset;
+		x += walker->glyph_pos[i].x_advance;
+		y += walker->glyph_pos[i].y_advance;
+	}
+	run->x_advance = x;
+	run->y_advance = y;
+
+	fz_var(key);
+
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, shape_key);
+		key->refs = 1;
+		key->rtl = walker->rtl;
+		key->script = walker->script;
+		key->language = walker->language;
+		key->len = walker->end - walker->start;
+		key->text = fz_malloc(ctx, key->len);
+		memcpy(key->text, walker->start, key->len);
+		key->font = fz_keep_font(ctx, walker->font);
+
+		existing = fz_store_item(ctx, key, run, sizeof *run + run->glyph_count * sizeof *run->glyph, &shape_store_type);
+		if (existing)
+		{
+			/* Someone else shaped the same text at the same time. */
+			drop_shaped_run(ctx, run);
+			run = existing;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (key)
+			drop_shape_key(ctx, key);
+	}
+	fz_catch(ctx)
+	{
+		/* Failing to cache the result is not fatal. */
+	}
+
+	return run;
+}
+
+static int walk_string(string_walker *walker)
+{
+	fz_context *ctx = walker->ctx;
+	shape_key key;
+
+	drop_string_walker(ctx, walker);
+
+	walker->start = walker->end;
+	walker->end = walker->s;
+	walker->font = walker->next_font;
+
+	if (*walker->start == 0)
+		return 0;
+
+	/* Run through the string, encoding chars until we find one
+	 * that requires a different fallback font. */
+	while (*walker->s)
+	{
+		int c;
+
+		walker->s += fz_chartorune(&c, walker->s);
+		(void)fz_encode_character_with_fallback(ctx, walker->base_font, c, walker->script, walker->language, &walker->next_font);
+		if (walker->next_font != walker->font)
+		{
+			if (walker->font != NULL)
+				break;
+			walker->font = walker->next_font;
+		}
+		walker->end = walker->s;
+	}
+
+	key.refs = 0;
+	key.font = walker->font;
+	key.rtl = walker->rtl;
+	key.script = walker->script;
+	key.language = walker->language;
+	key.len = walker->end - walker->start;
+	key.text = (char *)walker->start;
+
+	walker->run = fz_find_item(ctx, drop_shaped_run_imp, &key, &shape_store_type);
+	if (!walker->run)
+		walker->run = shape_string(walker);
+
 	return 1;
 }
 
@@ -1007,7 +1202,6 @@ static const char *get_node_text(fz_context *ctx, fz_html_flow *node)
 static void measure_string(fz_context *ctx, fz_html_flow *node, hb_buffer_t *hb_buf)
 {
 	string_walker walker;
-	unsigned int i;
 	const char *s;
 	float em;
 
@@ -1020,12 +1214,7 @@ static void measure_string(fz_context *ctx, fz_html_flow *node, hb_buffer_t *hb_
 	s = get_node_text(ctx, node);
 	init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, node->box->style.font, node->script, node->markup_lang, s);
 	while (walk_string(&walker))
-	{
-		int x = 0;
-		for (i = 0; i < walker.glyph_count; i++)
-			x += walker.glyph_pos[i].x_advance;
-		node->w += x * em / walker.scale;
-	}
+		node->w += walker.run->x_advance * em / walker.run->scale;
 }
 
 static float measure_line(fz_html_flow *node, fz_html_flow *end, float *baseline)
@@ -1556,61 +1745,58 @@ static void draw_flow_box(fz_context *ctx, fz_html_box *box, float page_top, flo
 
 			s = get_node_text(ctx, node);
 			init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, style->font, node->script, node->markup_lang, s);
-			while (walk_string(&walker))
+			fz_try(ctx)
 			{
-				float node_scale = node->box->em / walker.scale;
-				unsigned int i;
-				int c, k, n;
-
-				/* Flatten advance and offset into offset array. */
-				int x_advance = 0;
-				int y_advance = 0;
-				for (i = 0; i < walker.glyph_count; ++i)
+				while (walk_string(&walker))
 				{
-					walker.glyph_pos[i].x_offset += x_advance;
-					walker.glyph_pos[i].y_offset += y_advance;
-					x_advance += walker.glyph_pos[i].x_advance;
-					y_advance += walker.glyph_pos[i].y_advance;
-				}
+					shaped_run *run = walker.run;
+					float node_scale = node->box->em / run->scale;
+					unsigned int i;
+					int c, k, n;
 
-				if (node->bidi_level & 1)
-					x -= x_advance * node_scale;
+					if (node->bidi_level & 1)
+						x -= run->x_advance * node_scale;
 
-				/* Walk characters to find glyph clusters */
-				k = 0;
-				while (walker.start + k < walker.end)
-				{
-					n = fz_chartorune(&c, walker.start + k);
-
-					for (i = 0; i < walker.glyph_count; ++i)
+					/* Walk characters to find glyph clusters */
+					k = 0;
+					while (walker.start + k < walker.end)
 					{
-						if (walker.glyph_info[i].cluster == k)
+						n = fz_chartorune(&c, walker.start + k);
+
+						for (i = 0; i < run->glyph_count; ++i)
+						{
+							if (run->glyph[i].cluster == k)
+							{
+								trm.e = x + run->glyph[i].x * node_scale;
+								trm.f = y - run->glyph[i].y * node_scale;
+								fz_show_glyph(ctx, text, walker.font, &trm,
+										run->glyph[i].gid, c,
+										0, node->bidi_level, box->markup_dir, node->markup_lang);
+								c = -1; /* for subsequent glyphs in x-to-many mappings */
+							}
+						}
+
+						/* no glyph found (many-to-many or many-to-one mapping) */
+						if (c != -1)
 						{
-							trm.e = x + walker.glyph_pos[i].x_offset * node_scale;
-							trm.f = y - walker.glyph_pos[i].y_offset * node_scale;
 							fz_show_glyph(ctx, text, walker.font, &trm,
-									walker.glyph_info[i].codepoint, c,
+									-1, c,
 									0, node->bidi_level, box->markup_dir, node->markup_lang);
-							c = -1; /* for subsequent glyphs in x-to-many mappings */
 						}
-					}
 
-					/* no glyph found (many-to-many or many-to-one mapping) */
-					if (c != -1)
-					{
-						fz_show_glyph(ctx, text, walker.font, &trm,
-								-1, c,
-								0, node->bidi_level, box->markup_dir, node->markup_lang);
+						k += n;
 					}
 
-					k += n;
-				}
-
-				if ((node->bidi_level & 1) == 0)
-					x += x_advance * node_scale;
+					if ((node->bidi_level & 1) == 0)
+						x += run->x_advance * node_scale;
 
-				y += y_advance * node_scale;
+					y += run->y_advance * node_scale;
+				}
 			}
+			fz_always(ctx)
+				drop_string_walker(ctx, &walker);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
 		}
 		else if (node->type == FLOW_IMAGE)
 		{
@@ -2107,13 +2293,65 @@ static char *concat_text(fz_context *ctx, fz_xml *root)
 }
 
 static void
-html_load_css(fz_context *ctx, fz_archive *zip, const char *base_uri, fz_css *css, fz_xml *root)
+add_cached_css(fz_context *ctx, fz_css_cache *cache, fz_css *css, const char *source, const char *name)
 {
-	fz_xml *html, *head, *node;
-	fz_buffer *buf;
-	char path[2048];
+	fz_css *sheet = fz_find_cached_css(ctx, cache, name);
+
+	fz_var(sheet);
+
+	fz_try(ctx)
+	{
+		if (!sheet)
+		{
+			sheet = fz_new_css(ctx);
+			fz_parse_css(ctx, sheet, source, name);
+			fz_cache_css(ctx, cache, name, sheet);
+		}
+		fz_add_css(ctx, css, sheet);
+	}
+	fz_always(ctx)
+		fz_drop_css(ctx, sheet);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+add_linked_css(fz_context *ctx, fz_css_cache *cache, fz_archive *zip, fz_css *css, const char *path)
+{
+	fz_buffer *buf = NULL;
+	fz_css *sheet;
+
+	/* Most books link the same style sheets from every chapter. */
+	sheet = fz_find_cached_css(ctx, cache, path);
 
 	fz_var(buf);
+	fz_var(sheet);
+
+	fz_try(ctx)
+	{
+		if (!sheet)
+		{
+			buf = fz_read_archive_entry(ctx, zip, path);
+			sheet = fz_new_css(ctx);
+			fz_parse_css(ctx, sheet, fz_string_from_buffer(ctx, buf), path);
+			fz_cache_css(ctx, cache, path, sheet);
+		}
+		fz_add_css(ctx, css, sheet);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_css(ctx, sheet);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+html_load_css(fz_context *ctx, fz_css_cache *cache, fz_archive *zip, const char *base_uri, fz_css *css, fz_xml *root)
+{
+	fz_xml *html, *head, *node;
+	char path[2048];
 
 	html = fz_xml_find(root, "html");
 	head = fz_xml_find_down(html, "head");
@@ -2136,14 +2374,8 @@ html_load_css(fz_context *ctx, fz_archive *zip, const char *base_uri, fz_css *cs
 						fz_urldecode(path);
 						fz_cleanname(path);
 
-						buf = NULL;
 						fz_try(ctx)
-						{
-							buf = fz_read_archive_entry(ctx, zip, path);
-							fz_parse_css(ctx, css, fz_string_from_buffer(ctx, buf), path);
-						}
-						fz_always(ctx)
-							fz_drop_buffer(ctx, buf);
+							add_linked_css(ctx, cache, zip, css, path);
 						fz_catch(ctx)
 							fz_warn(ctx, "ignoring stylesheet %s", path);
 					}
@@ -2518,7 +2750,7 @@ detect_directionality(fz_context *ctx, fz_pool *pool, fz_html_box *box)
 }
 
 fz_html *
-fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const char *base_uri, fz_buffer *buf, const char *user_css)
+fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_css_cache *cache, fz_archive *zip, const char *base_uri, fz_buffer *buf, const char *user_css)
 {
 	fz_xml *xml;
 	fz_html *html;
@@ -2544,15 +2776,15 @@ fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const cha
 		if (fz_xml_find(xml, "FictionBook"))
 		{
 			g.is_fb2 = 1;
-			fz_parse_css(ctx, g.css, fb2_default_css, "<default:fb2>");
+			add_cached_css(ctx, cache, g.css, fb2_default_css, "<default:fb2>");
 			fb2_load_css(ctx, g.zip, g.base_uri, g.css, xml);
 			g.images = load_fb2_images(ctx, xml);
 		}
 		else
 		{
 			g.is_fb2 = 0;
-			fz_parse_css(ctx, g.css, html_default_css, "<default:html>");
-			html_load_css(ctx, g.zip, g.base_uri, g.css, xml);
+			add_cached_css(ctx, cache, g.css, html_default_css, "<default:html>");
+			html_load_css(ctx, cache, g.zip, g.base_uri, g.css, xml);
 			g.images = NULL;
 		}
 
@@ -291,7 +291,9 @@ static int ft_width(fz_context *ctx, pdf_font_desc *fontdesc, int cid)
 	FT_Fixed adv;
 	int fterr;
 
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
 	fterr = FT_Get_Advance(fontdesc->font->ft_face, gid, mask, &adv);
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
 	if (fterr)
 	{
 		fz_warn(ctx, "freetype advance glyph (gid %d): %s", gid, ft_error_string(fterr));
@@ -444,7 +446,7 @@ pdf_load_embedded_font(fz_context *ctx, pdf_document *doc, pdf_font_desc *fontde
 
 	buf = pdf_load_stream(ctx, stmref);
 	fz_try(ctx)
-		fontdesc->font = fz_new_font_from_buffer(ctx, fontname, buf, 0, 1);
+		fontdesc->font = fz_new_shared_font_from_buffer(ctx, fontname, buf, 0, 1);
 	fz_always(ctx)
 		fz_drop_buffer(ctx, buf);
 	fz_catch(ctx)
@@ -643,15 +645,6 @@ pdf_load_simple_font_by_name(fz_context *ctx, pdf_document *doc, pdf_obj *dict,
 			}
 		}
 
-		if (cmap)
-		{
-			fterr = FT_Set_Charmap(face, cmap);
-			if (fterr)
-				fz_warn(ctx, "freetype could not set cmap: %s", ft_error_string(fterr));
-		}
-		else
-			fz_warn(ctx, "freetype could not find any cmaps");
-
 		etable = fz_malloc_array(ctx, 256, sizeof(unsigned short));
 		fontdesc->size += 256 * sizeof(unsigned short);
 		for (i = 0; i < 256; i++)
@@ -695,13 +688,25 @@ pdf_load_simple_font_by_name(fz_context *ctx, pdf_document *doc, pdf_obj *dict,
 		else if (!fontdesc->is_embedded && !symbolic)
 			pdf_load_encoding(estrings, "StandardEncoding");
 
+		/* Embedded fonts may be shared with other documents, so only
+		 * select the cmap once we hold the lock, and keep the lock
+		 * until we are done looking things up through it. */
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		has_lock = 1;
+
+		if (cmap)
+		{
+			fterr = FT_Set_Charmap(face, cmap);
+			if (fterr)
+				fz_warn(ctx, "freetype could not set cmap: %s", ft_error_string(fterr));
+		}
+		else
+			fz_warn(ctx, "freetype could not find any cmaps");
+
 		/* start with the builtin encoding */
 		for (i = 0; i < 256; i++)
 			etable[i] = ft_char_index(face, i);
 
-		fz_lock(ctx, FZ_LOCK_FREETYPE);
-		has_lock = 1;
-
 		/* built-in and substitute fonts may be a different type than what the document expects */
 		subtype = pdf_dict_get(ctx, dict, PDF_NAME_Subtype);
 		if (pdf_name_eq(ctx, subtype, PDF_NAME_Type1))
@@ -1266,7 +1271,9 @@ pdf_load_font_descriptor(fz_context *ctx, pdf_document *doc, pdf_font_desc *font
 	face = fontdesc->font->ft_face;
 	if (ft_kind(face) == TRUETYPE)
 	{
-		if (FT_IS_TRICKY(face) || is_dynalab(fontdesc->font->name))
+		/* Embedded fonts may be shared, so only write to them when
+		 * something changes. */
+		if (!fontdesc->font->flags.force_hinting && (FT_IS_TRICKY(face) || is_dynalab(fontdesc->font->name)))
 			fontdesc->font->flags.force_hinting = 1;
 
 		if (fontdesc->ascent == 0.0f)
@@ -1282,6 +1289,9 @@ pdf_make_width_table(fz_context *ctx, pdf_font_desc *fontdesc)
 {
 	fz_font *font = fontdesc->font;
 	int i, k, n, cid, gid;
+	int width_count, width_default;
+	short *width_table;
+	int same;
 
 	n = 0;
 	for (i = 0; i < fontdesc->hmtx_len; i++)
@@ -1295,14 +1305,13 @@ pdf_make_width_table(fz_context *ctx, pdf_font_desc *fontdesc)
 		}
 	}
 
-	font->width_count = n + 1;
-	font->width_table = fz_malloc_array(ctx, font->width_count, sizeof(int));
-	memset(font->width_table, 0, font->width_count * sizeof(int));
-	fontdesc->size += font->width_count * sizeof(int);
+	width_count = n + 1;
+	width_table = fz_malloc_array(ctx, width_count, sizeof(short));
+	fontdesc->size += width_count * sizeof(short);
 
-	font->width_default = fontdesc->dhmtx.w;
-	for (i = 0; i < font->width_count; i++)
-		font->width_table[i] = -1;
+	width_default = fontdesc->dhmtx.w;
+	for (i = 0; i < width_count; i++)
+		width_table[i] = -1;
 
 	for (i = 0; i < fontdesc->hmtx_len; i++)
 	{
@@ -1310,14 +1319,60 @@ pdf_make_width_table(fz_context *ctx, pdf_font_desc *fontdesc)
 		{
 			cid = pdf_lookup_cmap(fontdesc->encoding, k);
 			gid = pdf_font_cid_to_gid(ctx, fontdesc, cid);
-			if (gid >= 0 && gid < font->width_count)
-				font->width_table[gid] = fz_maxi(fontdesc->hmtx[i].w, font->width_table[gid]);
+			if (gid >= 0 && gid < width_count)
+				width_table[gid] = fz_maxi(fontdesc->hmtx[i].w, width_table[gid]);
 		}
 	}
 
-	for (i = 0; i < font->width_count; i++)
-		if (font->width_table[i] == -1)
-			font->width_table[i] = font->width_default;
+	for (i = 0; i < width_count; i++)
+		if (width_table[i] == -1)
+			width_table[i] = width_default;
+
+	/* Embedded fonts may be shared with other documents. The first
+	 * document to get here sets the widths of a shared font, and the
+	 * others can go on sharing it if their widths are the same. */
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	if (!font->width_table)
+	{
+		font->width_count = width_count;
+		font->width_default = width_default;
+		font->width_table = width_table;
+		width_table = NULL;
+		same = 1;
+	}
+	else
+	{
+		same = font->width_count == width_count && font->width_default == width_default &&
+			!memcmp(font->width_table, width_table, width_count * sizeof(short));
+	}
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+
+	if (same)
+	{
+		fz_free(ctx, width_table);
+		return;
+	}
+
+	/* Our widths are different, so we need a font of our own. */
+	if (font->buffer)
+	{
+		fz_try(ctx)
+			font = fz_new_font_from_buffer(ctx, font->name, font->buffer, ((FT_Face)font->ft_face)->face_index, font->flags.use_glyph_bbox);
+		fz_catch(ctx)
+		{
+			fz_free(ctx, width_table);
+			fz_rethrow(ctx);
+		}
+		font->flags = fontdesc->font->flags;
+		fz_drop_font(ctx, fontdesc->font);
+		fontdesc->font = font;
+	}
+	else
+		fz_free(ctx, font->width_table);
+
+	font->width_count = width_count;
+	font->width_default = width_default;
+	font->width_table = width_table;
 }
 
 pdf_font_desc *
@@ -8,4 +8,6 @@ void pdf_drop_ocg(fz_context *ctx, pdf_document *doc);
 
 int pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const char *usage, pdf_obj *ocg);
 
+void pdf_drop_xobject_tiles(fz_context *ctx, pdf_xobject *xobj);
+
 #endif
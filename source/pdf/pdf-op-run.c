@@ -1,4 +1,4 @@
-#include "mupdf/pdf.h"
+#include "pdf-imp.h"
 
 #define TILE
 
@@ -432,21 +432,29 @@ pdf_show_pattern(fz_context *ctx, pdf_run_processor *pr, pdf_pattern *pat, pdf_g
 		if (0)
 #endif
 		{
-			fz_begin_tile(ctx, pr->dev, &local_area, &pat->bbox, pat->xstep, pat->ystep, &ptm);
-			gstate->ctm = ptm;
-			pdf_gsave(ctx, pr);
-			fz_try(ctx)
+			/* If the device has the tile already, we need not run
+			 * the pattern contents again. */
+			if (fz_begin_tile_id(ctx, pr->dev, &local_area, &pat->bbox, pat->xstep, pat->ystep, &ptm, pat->id))
 			{
-				pdf_process_contents(ctx, (pdf_processor*)pr, pat->document, pat->resources, pat->contents, NULL);
-			}
-			fz_always(ctx)
-			{
-				pdf_grestore(ctx, pr);
 				fz_end_tile(ctx, pr->dev);
 			}
-			fz_catch(ctx)
+			else
 			{
-				fz_rethrow(ctx);
+				gstate->ctm = ptm;
+				pdf_gsave(ctx, pr);
+				fz_try(ctx)
+				{
+					pdf_process_contents(ctx, (pdf_processor*)pr, pat->document, pat->resources, pat->contents, NULL);
+				}
+				fz_always(ctx)
+				{
+					pdf_grestore(ctx, pr);
+					fz_end_tile(ctx, pr->dev);
+				}
+				fz_catch(ctx)
+				{
+					fz_rethrow(ctx);
+				}
 			}
 		}
 		else
@@ -1208,6 +1216,194 @@ pdf_set_pattern(fz_context *ctx, pdf_run_processor *pr, int what, pdf_pattern *p
 	mat->gstate_num = pr->gparent;
 }
 
+/*
+ * Forms can be drawn once as a tile and reused (see FZ_CACHE_FORMS) if
+ * their contents only ever paint over what is behind them: nothing in
+ * them may blend with or be masked by the backdrop, nor depend on the
+ * optional content configuration.
+ */
+
+static int pdf_resources_can_cache(fz_context *ctx, pdf_obj *rdb);
+
+static int
+pdf_extgstate_can_cache(fz_context *ctx, pdf_obj *dict)
+{
+	pdf_obj *obj = pdf_dict_get(ctx, dict, PDF_NAME_BM);
+	if (obj && !pdf_name_eq(ctx, obj, PDF_NAME_Normal))
+		return 0;
+	obj = pdf_dict_get(ctx, dict, PDF_NAME_SMask);
+	if (obj && !pdf_name_eq(ctx, obj, PDF_NAME_None))
+		return 0;
+	return 1;
+}
+
+static int
+pdf_pattern_can_cache(fz_context *ctx, pdf_obj *dict)
+{
+	if (!pdf_resources_can_cache(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Resources)))
+		return 0;
+	return pdf_extgstate_can_cache(ctx, pdf_dict_get(ctx, dict, PDF_NAME_ExtGState));
+}
+
+static int
+pdf_xobject_can_cache(fz_context *ctx, pdf_obj *dict)
+{
+	if (pdf_dict_get(ctx, dict, PDF_NAME_OC))
+		return 0;
+	if (pdf_to_bool(ctx, pdf_dict_getp(ctx, dict, "Group/K")))
+		return 0;
+	return pdf_resources_can_cache(ctx, pdf_dict_get(ctx, dict, PDF_NAME_Resources));
+}
+
+static int
+pdf_resources_can_cache(fz_context *ctx, pdf_obj *rdb)
+{
+	pdf_obj *obj;
+	int i, n, ok = 1;
+
+	if (!rdb)
+		return 1;
+
+	/* stop on cyclic resource dependencies */
+	if (pdf_mark_obj(ctx, rdb))
+		return 1;
+
+	fz_try(ctx)
+	{
+		if (pdf_dict_len(ctx, pdf_dict_get(ctx, rdb, PDF_NAME_Properties)) > 0)
+			ok = 0;
+
+		obj = pdf_dict_get(ctx, rdb, PDF_NAME_ExtGState);
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; ok && i < n; i++)
+			ok = pdf_extgstate_can_cache(ctx, pdf_dict_get_val(ctx, obj, i));
+
+		obj = pdf_dict_get(ctx, rdb, PDF_NAME_Pattern);
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; ok && i < n; i++)
+			ok = pdf_pattern_can_cache(ctx, pdf_dict_get_val(ctx, obj, i));
+
+		obj = pdf_dict_get(ctx, rdb, PDF_NAME_XObject);
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; ok && i < n; i++)
+			ok = pdf_xobject_can_cache(ctx, pdf_dict_get_val(ctx, obj, i));
+
+		/* Type 3 glyphs */
+		obj = pdf_dict_get(ctx, rdb, PDF_NAME_Font);
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; ok && i < n; i++)
+			ok = pdf_resources_can_cache(ctx, pdf_dict_get(ctx, pdf_dict_get_val(ctx, obj, i), PDF_NAME_Resources));
+	}
+	fz_always(ctx)
+	{
+		pdf_unmark_obj(ctx, rdb);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return ok;
+}
+
+static void
+pdf_digest_material(fz_context *ctx, fz_md5 *md5, const pdf_material *mat)
+{
+	fz_md5_update(md5, (const unsigned char *)&mat->kind, sizeof mat->kind);
+	fz_md5_update(md5, (const unsigned char *)&mat->colorspace, sizeof mat->colorspace);
+	fz_md5_update(md5, (const unsigned char *)&mat->alpha, sizeof mat->alpha);
+	if (mat->colorspace)
+		fz_md5_update(md5, (const unsigned char *)mat->v, fz_colorspace_n(ctx, mat->colorspace) * sizeof(float));
+}
+
+/* Don't cache forms that would make tiles larger than this (in pixels
+ * at the current ctm). */
+#define MAX_FORM_TILE_AREA (2048 * 2048)
+
+/*
+	Find the id to cache a form under, or 0 if it should be drawn as
+	usual. Everything the form inherits from the graphics state goes
+	into the id, except for the ctm, which the draw device keys its
+	tiles on itself.
+*/
+static int
+pdf_form_tile_id(fz_context *ctx, pdf_run_processor *pr, pdf_document *doc, pdf_xobject *xobj, const fz_rect *xobj_bbox)
+{
+	pdf_gstate *gstate = pr->gstate + pr->gtop;
+	fz_stroke_state *stroke = gstate->stroke_state;
+	fz_rect bbox = *xobj_bbox;
+	unsigned char digest[16];
+	fz_md5 md5;
+	int i;
+
+	if (gstate->blendmode || gstate->softmask)
+		return 0;
+	if (gstate->fill.kind == PDF_MAT_PATTERN || gstate->fill.kind == PDF_MAT_SHADE)
+		return 0;
+	if (gstate->stroke.kind == PDF_MAT_PATTERN || gstate->stroke.kind == PDF_MAT_SHADE)
+		return 0;
+
+	/* Forms being edited may change under us. */
+	if (pdf_has_unsaved_changes(ctx, doc))
+		return 0;
+
+	fz_transform_rect(&bbox, &gstate->ctm);
+	if (fz_is_empty_rect(&bbox) || fz_is_infinite_rect(&bbox))
+		return 0;
+	if ((bbox.x1 - bbox.x0) * (bbox.y1 - bbox.y0) > MAX_FORM_TILE_AREA)
+		return 0;
+
+	if (xobj->tile_iteration != xobj->iteration)
+	{
+		pdf_drop_xobject_tiles(ctx, xobj);
+		xobj->tile_iteration = xobj->iteration;
+	}
+	if (xobj->cacheable == 0)
+	{
+		/* Forms without resources of their own use those of whatever
+		 * page they are on, so can differ from use to use. */
+		pdf_obj *resources = pdf_xobject_resources(ctx, xobj);
+		if (resources && !pdf_xobject_knockout(ctx, xobj) && pdf_resources_can_cache(ctx, resources))
+			xobj->cacheable = 1;
+		else
+			xobj->cacheable = -1;
+	}
+	if (xobj->cacheable < 0)
+		return 0;
+
+	fz_md5_init(&md5);
+	pdf_digest_material(ctx, &md5, &gstate->fill);
+	pdf_digest_material(ctx, &md5, &gstate->stroke);
+	fz_md5_update(&md5, (const unsigned char *)&stroke->start_cap, (const unsigned char *)&stroke->dash_list[0] - (const unsigned char *)&stroke->start_cap);
+	fz_md5_update(&md5, (const unsigned char *)stroke->dash_list, stroke->dash_len * sizeof(float));
+	fz_md5_update(&md5, (const unsigned char *)&gstate->char_space, sizeof gstate->char_space);
+	fz_md5_update(&md5, (const unsigned char *)&gstate->word_space, sizeof gstate->word_space);
+	fz_md5_update(&md5, (const unsigned char *)&gstate->scale, sizeof gstate->scale);
+	fz_md5_update(&md5, (const unsigned char *)&gstate->leading, sizeof gstate->leading);
+	fz_md5_update(&md5, (const unsigned char *)&gstate->font, sizeof gstate->font);
+	fz_md5_update(&md5, (const unsigned char *)&gstate->size, sizeof gstate->size);
+	fz_md5_update(&md5, (const unsigned char *)&gstate->render, sizeof gstate->render);
+	fz_md5_update(&md5, (const unsigned char *)&gstate->rise, sizeof gstate->rise);
+	fz_md5_final(&md5, digest);
+
+	for (i = 0; i < xobj->tile_count; i++)
+		if (!memcmp(xobj->tile[i].digest, digest, 16))
+			return xobj->tile[i].id;
+
+	/* A form drawn in more states than this is not worth caching. */
+	if (xobj->tile_count == PDF_XOBJECT_TILE_IDS)
+		return 0;
+
+	memcpy(xobj->tile[i].digest, digest, 16);
+	xobj->tile[i].id = fz_gen_id(ctx);
+	xobj->tile[i].fill_cs = fz_keep_colorspace(ctx, gstate->fill.colorspace);
+	xobj->tile[i].stroke_cs = fz_keep_colorspace(ctx, gstate->stroke.colorspace);
+	xobj->tile[i].font = pdf_keep_font(ctx, gstate->font);
+	xobj->tile_count++;
+
+	return xobj->tile[i].id;
+}
+
 static void
 pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf_obj *page_resources, const fz_matrix *transform)
 {
@@ -1225,6 +1421,7 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf
 	fz_matrix xobj_matrix;
 	int transparency;
 	pdf_document *doc;
+	int tile_id = 0;
 
 	/* Avoid infinite recursion */
 	if (xobj == NULL || pdf_mark_obj(ctx, xobj->obj))
@@ -1303,10 +1500,28 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf
 
 		doc = pdf_get_bound_document(ctx, xobj->obj);
 
-		pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj->obj, NULL);
+		/* Draw the form as a single tile, which the device can keep
+		 * and paint again next time without running the contents. */
+		if (pr->dev->hints & FZ_CACHE_FORMS)
+			tile_id = pdf_form_tile_id(ctx, pr, doc, xobj, &xobj_bbox);
+		if (tile_id)
+		{
+			/* Steps bigger than the tile, so it is painted once. */
+			float xstep = (xobj_bbox.x1 - xobj_bbox.x0) * 2 + 1;
+			float ystep = (xobj_bbox.y1 - xobj_bbox.y0) * 2 + 1;
+
+			cleanup_state = 4;
+			if (!fz_begin_tile_id(ctx, pr->dev, &xobj_bbox, &xobj_bbox, xstep, ystep, &pr->gstate[pr->gtop].ctm, tile_id))
+				pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj->obj, NULL);
+		}
+		else
+			pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj->obj, NULL);
 	}
 	fz_always(ctx)
 	{
+		if (cleanup_state >= 4)
+			fz_end_tile(ctx, pr->dev);
+
 		if (cleanup_state >= 3)
 			pdf_grestore(ctx, pr); /* Remove the clippath */
 
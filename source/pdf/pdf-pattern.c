@@ -52,6 +52,13 @@ pdf_load_pattern(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 		pdf_store_item(ctx, dict, pat, pdf_pattern_size(pat));
 
 		pat->ismask = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_PaintType)) == 2;
+
+		/* Colored patterns draw the same whatever they are used to
+		 * fill, so their rendered tiles can be reused for as long
+		 * as the pattern is loaded (by any page of the document). The
+		 * tiles of uncolored patterns depend on the fill color. */
+		if (!pat->ismask)
+			pat->id = fz_gen_id(ctx);
 		pat->xstep = pdf_to_real(ctx, pdf_dict_get(ctx, dict, PDF_NAME_XStep));
 		pat->ystep = pdf_to_real(ctx, pdf_dict_get(ctx, dict, PDF_NAME_YStep));
 
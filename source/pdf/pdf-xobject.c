@@ -1,4 +1,4 @@
-#include "mupdf/pdf.h"
+#include "pdf-imp.h"
 
 pdf_xobject *
 pdf_keep_xobject(fz_context *ctx, pdf_xobject *xobj)
@@ -16,10 +16,26 @@ static void
 pdf_drop_xobject_imp(fz_context *ctx, fz_storable *xobj_)
 {
 	pdf_xobject *xobj = (pdf_xobject *)xobj_;
+	pdf_drop_xobject_tiles(ctx, xobj);
 	pdf_drop_obj(ctx, xobj->obj);
 	fz_free(ctx, xobj);
 }
 
+void
+pdf_drop_xobject_tiles(fz_context *ctx, pdf_xobject *xobj)
+{
+	int i;
+
+	for (i = 0; i < xobj->tile_count; i++)
+	{
+		fz_drop_colorspace(ctx, xobj->tile[i].fill_cs);
+		fz_drop_colorspace(ctx, xobj->tile[i].stroke_cs);
+		pdf_drop_font(ctx, xobj->tile[i].font);
+	}
+	xobj->tile_count = 0;
+	xobj->cacheable = 0;
+}
+
 static size_t
 pdf_xobject_size(pdf_xobject *xobj)
 {
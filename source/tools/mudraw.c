@@ -442,8 +442,8 @@ static void usage(void)
 		"\t-G -\tapply gamma correction\n"
 		"\t-I\tinvert colors\n"
 		"\n"
-		"\t-A -\tnumber of bits of antialiasing (0 to 8)\n"
-		"\t-A -/-\tnumber of bits of antialiasing (0 to 8) (graphics, text)\n"
+		"\t-A -\tnumber of bits of antialiasing (0 to 8, 9 for analytic)\n"
+		"\t-A -/-\tnumber of bits of antialiasing (0 to 8, 9 for analytic) (graphics, text)\n"
 		"\t-l -\tminimum stroked line width (in pixels)\n"
 		"\t-D\tdisable use of display list\n"
 		"\t-i\tignore errors\n"
@@ -678,8 +678,8 @@ static void usage(void)
 		"\t-S -\tfont size for EPUB layout\n"
 		"\t-U -\tfile name of user stylesheet for EPUB layout\n"
 		"\n"
-		"\t-A -\tnumber of bits of antialiasing (0 to 8)\n"
-		"\t-A -/-\tnumber of bits of antialiasing (0 to 8) (graphics, text)\n"
+		"\t-A -\tnumber of bits of antialiasing (0 to 8, 9 for analytic)\n"
+		"\t-A -/-\tnumber of bits of antialiasing (0 to 8, 9 for analytic) (graphics, text)\n"
 		"\n"
 		"\tpages\tcomma separated list of page numbers and ranges\n"
 		);